@@ -491,6 +491,8 @@ u32 aarch64_set_branch_offset(u32 insn, s32 offset);
 
 int aarch64_insn_patch_text_nosync(void *addr, u32 insn);
 int aarch64_insn_patch_text(void *addrs[], u32 insns[], int cnt);
+void *aarch64_insn_copy(void *dst, const void *src, size_t len);
+void *aarch64_insn_set(void *dst, u32 insn, size_t len);
 
 s32 aarch64_insn_adrp_get_offset(u32 insn);
 u32 aarch64_insn_adrp_set_offset(u32 insn, s32 offset);
@@ -8,6 +8,7 @@
 #include <linux/bitops.h>
 #include <linux/bug.h>
 #include <linux/compiler.h>
+#include <linux/filter.h>
 #include <linux/kernel.h>
 #include <linux/mm.h>
 #include <linux/smp.h>
@@ -98,22 +99,33 @@ static bool is_image_text(unsigned long addr)
 	return core_kernel_text(addr) || is_exit_text(addr);
 }
 
+static void __kprobes *patch_map_page(struct page *page, void *addr,
+				      int fixmap)
+{
+	BUG_ON(!page);
+	return (void *)set_fixmap_offset(fixmap, page_to_phys(page) +
+			offset_in_page(addr));
+}
+
 static void __kprobes *patch_map(void *addr, int fixmap)
 {
 	unsigned long uintaddr = (uintptr_t) addr;
 	bool image = is_image_text(uintaddr);
 	struct page *page;
 
+	/*
+	 * JITed programs live in a bpf_prog_pack, which is read-only
+	 * regardless of CONFIG_STRICT_MODULE_RWX.
+	 */
 	if (image)
 		page = phys_to_page(__pa_symbol(addr));
-	else if (IS_ENABLED(CONFIG_STRICT_MODULE_RWX))
+	else if (IS_ENABLED(CONFIG_STRICT_MODULE_RWX) ||
+		 is_bpf_text_address(uintaddr))
 		page = vmalloc_to_page(addr);
 	else
 		return addr;
 
-	BUG_ON(!page);
-	return (void *)set_fixmap_offset(fixmap, page_to_phys(page) +
-			(uintaddr & ~PAGE_MASK));
+	return patch_map_page(page, addr, fixmap);
 }
 
 static void __kprobes patch_unmap(int fixmap)
@@ -158,6 +170,66 @@ int __kprobes aarch64_insn_write(void *addr, u32 insn)
 	return __aarch64_insn_write(addr, cpu_to_le32(insn));
 }
 
+/*
+ * Write @len bytes of text at @addr, one page at a time through the
+ * fixmap, calling @fn to fill each piece. Used for bulk writes such as
+ * installing a JITed image, where patching single instructions would be
+ * needlessly slow. @addr is always in a bpf_prog_pack, possibly in a
+ * hole not yet known to is_bpf_text_address(), so the page is looked up
+ * directly rather than through patch_map().
+ */
+static void *aarch64_insn_write_range(void *addr, const void *src, size_t len,
+				      void (*fn)(void *dst, const void *src,
+						 size_t done, size_t len))
+{
+	unsigned long flags;
+	size_t done = 0;
+
+	/* A64 instructions must be word aligned */
+	if ((uintptr_t)addr & 0x3 || len & 0x3)
+		return NULL;
+
+	raw_spin_lock_irqsave(&patch_lock, flags);
+	while (done < len) {
+		void *ptr = addr + done;
+		size_t size = min_t(size_t, PAGE_SIZE - offset_in_page(ptr),
+				    len - done);
+		void *waddr = patch_map_page(vmalloc_to_page(ptr), ptr,
+					     FIX_TEXT_POKE0);
+
+		fn(waddr, src, done, size);
+		patch_unmap(FIX_TEXT_POKE0);
+		done += size;
+	}
+	raw_spin_unlock_irqrestore(&patch_lock, flags);
+
+	flush_icache_range((uintptr_t)addr, (uintptr_t)addr + len);
+
+	return addr;
+}
+
+static void insn_copy_fn(void *dst, const void *src, size_t done, size_t len)
+{
+	memcpy(dst, src + done, len);
+}
+
+static void insn_set_fn(void *dst, const void *src, size_t done, size_t len)
+{
+	memset32(dst, *(const u32 *)src, len / AARCH64_INSN_SIZE);
+}
+
+void *aarch64_insn_copy(void *dst, const void *src, size_t len)
+{
+	return aarch64_insn_write_range(dst, src, len, insn_copy_fn);
+}
+
+void *aarch64_insn_set(void *dst, u32 insn, size_t len)
+{
+	__le32 val = cpu_to_le32(insn);
+
+	return aarch64_insn_write_range(dst, &val, len, insn_set_fn);
+}
+
 bool __kprobes aarch64_insn_uses_literal(u32 insn)
 {
 	/* ldr/ldrsw (literal), prfm */
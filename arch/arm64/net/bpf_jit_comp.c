@@ -10,12 +10,14 @@
 #include <linux/bitfield.h>
 #include <linux/bpf.h>
 #include <linux/filter.h>
+#include <linux/memory.h>
 #include <linux/printk.h>
 #include <linux/slab.h>
 
 #include <asm/byteorder.h>
 #include <asm/cacheflush.h>
 #include <asm/debug-monitors.h>
+#include <asm/insn.h>
 #include <asm/set_memory.h>
 
 #include "bpf_jit.h"
@@ -59,6 +61,7 @@ struct jit_ctx {
 	int *offset;
 	int exentry_idx;
 	__le32 *image;
+	__le32 *ro_image;
 	u32 stack_size;
 };
 
@@ -183,9 +186,16 @@ static bool is_addsub_imm(u32 imm)
 
 /* Tail call offset to jump into */
 #if IS_ENABLED(CONFIG_ARM64_BTI_KERNEL)
-#define PROLOGUE_OFFSET 8
+#define PROLOGUE_OFFSET 10
 #else
-#define PROLOGUE_OFFSET 7
+#define PROLOGUE_OFFSET 9
+#endif
+
+/* Instruction index of the trampoline patch site in the prologue */
+#if IS_ENABLED(CONFIG_ARM64_BTI_KERNEL)
+#define POKE_OFFSET 2
+#else
+#define POKE_OFFSET 1
 #endif
 
 static int build_prologue(struct jit_ctx *ctx, bool ebpf_from_cbpf)
@@ -227,6 +237,14 @@ static int build_prologue(struct jit_ctx *ctx, bool ebpf_from_cbpf)
 	if (IS_ENABLED(CONFIG_ARM64_BTI_KERNEL))
 		emit(A64_BTI_C, ctx);
 
+	/*
+	 * Patch site for BPF trampolines, the same sequence ftrace uses at
+	 * kernel function entry: the NOP becomes a BL to the trampoline,
+	 * which finds our caller's LR in x9.
+	 */
+	emit(A64_MOV(1, A64_R(9), A64_LR), ctx);
+	emit(A64_NOP, ctx);
+
 	/* Save FP and LR registers to stay align with ARM64 AAPCS */
 	emit(A64_PUSH(A64_FP, A64_LR, A64_SP), ctx);
 	emit(A64_MOV(1, A64_FP, A64_SP), ctx);
@@ -377,7 +395,7 @@ static int add_exception_handler(const struct bpf_insn *insn,
 {
 	off_t offset;
 	unsigned long pc;
-	struct exception_table_entry *ex;
+	struct exception_table_entry *ex, *dst_ex;
 
 	if (!ctx->image)
 		/* First pass */
@@ -390,13 +408,18 @@ static int add_exception_handler(const struct bpf_insn *insn,
 	    WARN_ON_ONCE(ctx->exentry_idx >= ctx->prog->aux->num_exentries))
 		return -EINVAL;
 
+	/*
+	 * The image is built in a rw buffer, but offsets are relative to where
+	 * the program and its extable end up, see bpf_jit_binary_pack_alloc().
+	 */
 	ex = &ctx->prog->aux->extable[ctx->exentry_idx];
-	pc = (unsigned long)&ctx->image[ctx->idx - 1];
+	dst_ex = (void *)ex - (void *)ctx->ro_image + (void *)ctx->image;
+	pc = (unsigned long)&ctx->ro_image[ctx->idx - 1];
 
 	offset = pc - (long)&ex->insn;
 	if (WARN_ON_ONCE(offset >= 0 || offset < INT_MIN))
 		return -ERANGE;
-	ex->insn = offset;
+	dst_ex->insn = offset;
 
 	/*
 	 * Since the extable follows the program, the fixup offset is always
@@ -410,8 +433,8 @@ static int add_exception_handler(const struct bpf_insn *insn,
 	if (!FIELD_FIT(BPF_FIXUP_OFFSET_MASK, offset))
 		return -ERANGE;
 
-	ex->fixup = FIELD_PREP(BPF_FIXUP_OFFSET_MASK, offset) |
-		    FIELD_PREP(BPF_FIXUP_REG_MASK, dst_reg);
+	dst_ex->fixup = FIELD_PREP(BPF_FIXUP_OFFSET_MASK, offset) |
+			FIELD_PREP(BPF_FIXUP_REG_MASK, dst_reg);
 
 	ctx->exentry_idx++;
 	return 0;
@@ -794,7 +817,13 @@ static int build_insn(const struct bpf_insn *insn, struct jit_ctx *ctx,
 		u64 imm64;
 
 		imm64 = (u64)insn1.imm << 32 | (u32)imm;
-		emit_a64_mov_i64(dst, imm64, ctx);
+		/* Callback addresses are only known after the first pass,
+		 * so they need a sequence that doesn't change length.
+		 */
+		if (bpf_pseudo_func(insn))
+			emit_addr_mov_i64(dst, imm64, ctx);
+		else
+			emit_a64_mov_i64(dst, imm64, ctx);
 
 		return 1;
 	}
@@ -984,7 +1013,8 @@ static inline void bpf_flush_icache(void *start, void *end)
 
 struct arm64_jit_data {
 	struct bpf_binary_header *header;
-	u8 *image;
+	struct bpf_binary_header *ro_header;
+	u8 *ro_image;
 	struct jit_ctx ctx;
 };
 
@@ -992,13 +1022,13 @@ struct bpf_prog *bpf_int_jit_compile(struct bpf_prog *prog)
 {
 	int image_size, prog_size, extable_size;
 	struct bpf_prog *tmp, *orig_prog = prog;
-	struct bpf_binary_header *header;
+	struct bpf_binary_header *header, *ro_header = NULL;
 	struct arm64_jit_data *jit_data;
 	bool was_classic = bpf_prog_was_classic(prog);
 	bool tmp_blinded = false;
 	bool extra_pass = false;
 	struct jit_ctx ctx;
-	u8 *image_ptr;
+	u8 *image_ptr, *ro_image_ptr;
 
 	if (!prog->jit_requested)
 		return orig_prog;
@@ -1025,8 +1055,10 @@ struct bpf_prog *bpf_int_jit_compile(struct bpf_prog *prog)
 	}
 	if (jit_data->ctx.offset) {
 		ctx = jit_data->ctx;
-		image_ptr = jit_data->image;
+		ro_image_ptr = jit_data->ro_image;
+		ro_header = jit_data->ro_header;
 		header = jit_data->header;
+		image_ptr = (void *)header + (ro_image_ptr - (u8 *)ro_header);
 		extra_pass = true;
 		prog_size = sizeof(u32) * ctx.idx;
 		goto skip_init_ctx;
@@ -1065,9 +1097,10 @@ struct bpf_prog *bpf_int_jit_compile(struct bpf_prog *prog)
 	/* Now we know the actual image size. */
 	prog_size = sizeof(u32) * ctx.idx;
 	image_size = prog_size + extable_size;
-	header = bpf_jit_binary_alloc(image_size, &image_ptr,
-				      sizeof(u32), jit_fill_hole);
-	if (header == NULL) {
+	ro_header = bpf_jit_binary_pack_alloc(image_size, &ro_image_ptr,
+					      sizeof(u32), &header, &image_ptr,
+					      jit_fill_hole);
+	if (ro_header == NULL) {
 		prog = orig_prog;
 		goto out_off;
 	}
@@ -1075,8 +1108,9 @@ struct bpf_prog *bpf_int_jit_compile(struct bpf_prog *prog)
 	/* 2. Now, the actual pass. */
 
 	ctx.image = (__le32 *)image_ptr;
+	ctx.ro_image = (__le32 *)ro_image_ptr;
 	if (extable_size)
-		prog->aux->extable = (void *)image_ptr + prog_size;
+		prog->aux->extable = (void *)ro_image_ptr + prog_size;
 skip_init_ctx:
 	ctx.idx = 0;
 	ctx.exentry_idx = 0;
@@ -1084,43 +1118,44 @@ struct bpf_prog *bpf_int_jit_compile(struct bpf_prog *prog)
 	build_prologue(&ctx, was_classic);
 
 	if (build_body(&ctx, extra_pass)) {
-		bpf_jit_binary_free(header);
 		prog = orig_prog;
-		goto out_off;
+		goto out_free_hdr;
 	}
 
 	build_epilogue(&ctx);
 
 	/* 3. Extra pass to validate JITed code. */
 	if (validate_code(&ctx)) {
-		bpf_jit_binary_free(header);
 		prog = orig_prog;
-		goto out_off;
+		goto out_free_hdr;
 	}
 
 	/* And we're done. */
 	if (bpf_jit_enable > 1)
 		bpf_jit_dump(prog->len, prog_size, 2, ctx.image);
 
-	bpf_flush_icache(header, ctx.image + ctx.idx);
-
 	if (!prog->is_func || extra_pass) {
 		if (extra_pass && ctx.idx != jit_data->ctx.idx) {
 			pr_err_once("multi-func JIT bug %d != %d\n",
 				    ctx.idx, jit_data->ctx.idx);
-			bpf_jit_binary_free(header);
 			prog->bpf_func = NULL;
 			prog->jited = 0;
 			prog->jited_len = 0;
+			goto out_free_hdr;
+		}
+		/* Copy the image into the pack, this also flushes the icache */
+		if (WARN_ON(bpf_jit_binary_pack_finalize(ro_header, header))) {
+			/* freed along with header */
+			prog = orig_prog;
 			goto out_off;
 		}
-		bpf_jit_binary_lock_ro(header);
 	} else {
 		jit_data->ctx = ctx;
-		jit_data->image = image_ptr;
+		jit_data->ro_image = ro_image_ptr;
 		jit_data->header = header;
+		jit_data->ro_header = ro_header;
 	}
-	prog->bpf_func = (void *)ctx.image;
+	prog->bpf_func = (void *)ctx.ro_image;
 	prog->jited = 1;
 	prog->jited_len = prog_size;
 
@@ -1141,6 +1176,54 @@ struct bpf_prog *bpf_int_jit_compile(struct bpf_prog *prog)
 		bpf_jit_prog_release_other(prog, prog == orig_prog ?
 					   tmp : orig_prog);
 	return prog;
+
+out_free_hdr:
+	/* the pack needs the size, which only the rw header has so far */
+	bpf_arch_text_copy(&ro_header->size, &header->size,
+			   sizeof(header->size));
+	bpf_jit_binary_pack_free(ro_header, header);
+	goto out_off;
+}
+
+void bpf_jit_free(struct bpf_prog *prog)
+{
+	if (prog->jited) {
+		struct arm64_jit_data *jit_data = prog->aux->jit_data;
+		struct bpf_binary_header *hdr = bpf_jit_binary_pack_hdr(prog);
+		struct bpf_binary_header *rw_hdr = NULL;
+
+		/*
+		 * A subprog whose extra pass never ran (jit_subprogs() failed)
+		 * still has its rw buffer and no size in the pack.
+		 */
+		if (jit_data) {
+			rw_hdr = jit_data->header;
+			bpf_arch_text_copy(&hdr->size, &rw_hdr->size,
+					   sizeof(rw_hdr->size));
+			kfree(jit_data->ctx.offset);
+			kfree(jit_data);
+			prog->aux->jit_data = NULL;
+		}
+		bpf_jit_binary_pack_free(hdr, rw_hdr);
+
+		WARN_ON_ONCE(!bpf_prog_kallsyms_verify_off(prog));
+	}
+
+	bpf_prog_unlock_free(prog);
+}
+
+void *bpf_arch_text_copy(void *dst, void *src, size_t len)
+{
+	if (!aarch64_insn_copy(dst, src, len))
+		return ERR_PTR(-EINVAL);
+	return dst;
+}
+
+int bpf_arch_text_invalidate(void *dst, size_t len)
+{
+	if (!aarch64_insn_set(dst, AARCH64_BREAK_FAULT, len))
+		return -EINVAL;
+	return 0;
 }
 
 u64 bpf_jit_alloc_exec_limit(void)
@@ -1160,3 +1243,392 @@ void bpf_jit_free_exec(void *addr)
 {
 	return vfree(addr);
 }
+
+/*
+ * BPF trampoline
+ *
+ * The trampoline is entered from the patch site of a BPF program (see
+ * build_prologue()) with:
+ *
+ *	x9  = return address into the parent
+ *	x30 = address after the patch site, i.e. the traced function's body
+ *
+ * struct_ops trampolines are instead called as regular functions. They set
+ * x9 from x30 themselves, so the same frame layout and exit path apply.
+ */
+
+/* Load/store a 64-bit value at [sp + off], using TMP_REG_2 for the offset */
+static void emit_sp_load(const u8 reg, int off, struct jit_ctx *ctx)
+{
+	const u8 tmp = bpf2a64[TMP_REG_2];
+
+	emit_a64_mov_i(1, tmp, off, ctx);
+	emit(A64_LDR64(reg, A64_SP, tmp), ctx);
+}
+
+static void emit_sp_store(const u8 reg, int off, struct jit_ctx *ctx)
+{
+	const u8 tmp = bpf2a64[TMP_REG_2];
+
+	emit_a64_mov_i(1, tmp, off, ctx);
+	emit(A64_STR64(reg, A64_SP, tmp), ctx);
+}
+
+static void emit_call(u64 target, struct jit_ctx *ctx)
+{
+	const u8 tmp = bpf2a64[TMP_REG_1];
+
+	emit_addr_mov_i64(tmp, target, ctx);
+	emit(A64_BLR(tmp), ctx);
+}
+
+static void save_args(struct jit_ctx *ctx, int args_off, int nargs)
+{
+	int i;
+
+	for (i = 0; i < nargs; i++)
+		emit_sp_store(A64_R(i), args_off + i * 8, ctx);
+}
+
+static void restore_args(struct jit_ctx *ctx, int args_off, int nargs)
+{
+	int i;
+
+	for (i = 0; i < nargs; i++)
+		emit_sp_load(A64_R(i), args_off + i * 8, ctx);
+}
+
+static void invoke_bpf_prog(struct jit_ctx *ctx, struct bpf_prog *p,
+			    int args_off, int retval_off, bool save_ret)
+{
+	/* x19 and x20 are saved by the trampoline and survive the calls */
+	const u8 prog = A64_R(19);
+	const u8 start = A64_R(20);
+
+	emit_addr_mov_i64(prog, (const u64)p, ctx);
+
+	if (p->aux->sleepable) {
+		emit_call((const u64)__bpf_prog_enter_sleepable, ctx);
+	} else {
+		emit_call((const u64)__bpf_prog_enter, ctx);
+		/* remember the start time for __bpf_prog_exit() */
+		emit(A64_MOV(1, start, A64_R(0)), ctx);
+	}
+
+	/* arg1: pointer to the saved arguments, arg2: insns if interpreted */
+	emit(A64_ADD_I(1, A64_R(0), A64_SP, args_off), ctx);
+	if (!p->jited)
+		emit_addr_mov_i64(A64_R(1), (const u64)p->insnsi, ctx);
+
+	emit_call((const u64)p->bpf_func, ctx);
+
+	/* BPF_TRAMP_MODIFY_RETURN and struct_ops progs return a value */
+	if (save_ret)
+		emit_sp_store(A64_R(0), retval_off, ctx);
+
+	if (p->aux->sleepable) {
+		emit_call((const u64)__bpf_prog_exit_sleepable, ctx);
+	} else {
+		emit(A64_MOV(1, A64_R(0), prog), ctx);
+		emit(A64_MOV(1, A64_R(1), start), ctx);
+		emit_call((const u64)__bpf_prog_exit, ctx);
+	}
+}
+
+static void invoke_bpf_mod_ret(struct jit_ctx *ctx, struct bpf_tramp_progs *tp,
+			       int args_off, int retval_off, __le32 **branches)
+{
+	const u8 tmp = bpf2a64[TMP_REG_1];
+	int i;
+
+	/* The first fmod_ret program will receive a garbage return value.
+	 * Set this to 0 to avoid confusing the program.
+	 */
+	emit_sp_store(A64_ZR, retval_off, ctx);
+	for (i = 0; i < tp->nr_progs; i++) {
+		invoke_bpf_prog(ctx, tp->progs[i], args_off, retval_off, true);
+		/* if (*(u64 *)(sp + retval_off) != 0)
+		 *	goto do_fexit;
+		 *
+		 * The target is not known yet, so leave a NOP to be replaced
+		 * with a CBNZ once the fexit part is emitted.
+		 */
+		emit_sp_load(tmp, retval_off, ctx);
+		branches[i] = ctx->image + ctx->idx;
+		emit(A64_NOP, ctx);
+	}
+}
+
+static int prepare_trampoline(struct jit_ctx *ctx, struct bpf_tramp_image *im,
+			      struct bpf_tramp_progs *tprogs, int nargs,
+			      u32 flags, bool patch_site)
+{
+	struct bpf_tramp_progs *fentry = &tprogs[BPF_TRAMP_FENTRY];
+	struct bpf_tramp_progs *fexit = &tprogs[BPF_TRAMP_FEXIT];
+	struct bpf_tramp_progs *fmod_ret = &tprogs[BPF_TRAMP_MODIFY_RETURN];
+	const u8 tmp = bpf2a64[TMP_REG_1];
+	int args_off, retval_off, regs_off, retaddr_off, stack_size;
+	__le32 **branches = NULL;
+	bool save_ret;
+	int i;
+
+	/*
+	 * Trampoline stack layout
+	 *
+	 *                         high
+	 *                        +-----------+
+	 *                        | FP / x9   | frame record for the parent
+	 *                        +-----------+
+	 *                        | FP / LR   | frame record for the traced
+	 * current A64_FP =>      +-----------+ function, LR = its body
+	 *                        | padding   |
+	 *      regs_off + 8 =>   | x20       |
+	 *      regs_off     =>   | x19       | callee saved, used here
+	 *      retval_off   =>   | retval    | if the return value is kept
+	 *                        | argN      |
+	 *                        | ...       |
+	 *      args_off     =>   | arg1      |
+	 * current A64_SP =>      +-----------+
+	 *                          low
+	 */
+	args_off = 0;
+	stack_size = nargs * 8;
+
+	save_ret = flags & (BPF_TRAMP_F_CALL_ORIG | BPF_TRAMP_F_RET_FENTRY_RET);
+	retval_off = stack_size;
+	if (save_ret)
+		stack_size += 8;
+
+	regs_off = stack_size;
+	stack_size += 16;
+
+	stack_size = STACK_ALIGN(stack_size);
+
+	/* the traced function's LR sits right above the frame pointer */
+	retaddr_off = stack_size + 8;
+
+	/*
+	 * Entered with BL from a patch site and with BLR as a struct_ops
+	 * function pointer.
+	 */
+	if (IS_ENABLED(CONFIG_ARM64_BTI_KERNEL))
+		emit(A64_BTI_C, ctx);
+
+	/* a struct_ops caller has no patch site to set up x9 */
+	if (!patch_site)
+		emit(A64_MOV(1, A64_R(9), A64_LR), ctx);
+
+	/* frame record for the parent */
+	emit(A64_PUSH(A64_FP, A64_R(9), A64_SP), ctx);
+	emit(A64_MOV(1, A64_FP, A64_SP), ctx);
+
+	/* frame record for the traced function */
+	emit(A64_PUSH(A64_FP, A64_LR, A64_SP), ctx);
+	emit(A64_MOV(1, A64_FP, A64_SP), ctx);
+
+	emit(A64_SUB_I(1, A64_SP, A64_SP, stack_size), ctx);
+
+	save_args(ctx, args_off, nargs);
+
+	emit_sp_store(A64_R(19), regs_off, ctx);
+	emit_sp_store(A64_R(20), regs_off + 8, ctx);
+
+	if (flags & BPF_TRAMP_F_CALL_ORIG) {
+		emit_addr_mov_i64(A64_R(0), (const u64)im, ctx);
+		emit_call((const u64)__bpf_tramp_enter, ctx);
+	}
+
+	for (i = 0; i < fentry->nr_progs; i++)
+		invoke_bpf_prog(ctx, fentry->progs[i], args_off, retval_off,
+				flags & BPF_TRAMP_F_RET_FENTRY_RET);
+
+	if (fmod_ret->nr_progs) {
+		branches = kcalloc(fmod_ret->nr_progs, sizeof(__le32 *),
+				   GFP_KERNEL);
+		if (!branches)
+			return -ENOMEM;
+
+		invoke_bpf_mod_ret(ctx, fmod_ret, args_off, retval_off,
+				   branches);
+	}
+
+	if (flags & BPF_TRAMP_F_CALL_ORIG) {
+		restore_args(ctx, args_off, nargs);
+		/* call the traced function's body, returning right after */
+		emit_sp_load(tmp, retaddr_off, ctx);
+		emit(A64_ADR(A64_LR, AARCH64_INSN_SIZE * 2), ctx);
+		emit(A64_RET(tmp), ctx);
+		emit_sp_store(A64_R(0), retval_off, ctx);
+		/* bpf_tramp_image_put() turns this into a jump to the epilogue */
+		im->ip_after_call = ctx->image + ctx->idx;
+		emit(A64_NOP, ctx);
+	}
+
+	/* now that do_fexit is known, fix up the fmod_ret branches */
+	for (i = 0; i < fmod_ret->nr_progs && ctx->image; i++) {
+		int offset = &ctx->image[ctx->idx] - branches[i];
+
+		*branches[i] = cpu_to_le32(A64_CBNZ(1, tmp, offset));
+	}
+
+	for (i = 0; i < fexit->nr_progs; i++)
+		invoke_bpf_prog(ctx, fexit->progs[i], args_off, retval_off,
+				false);
+
+	if (flags & BPF_TRAMP_F_CALL_ORIG) {
+		im->ip_epilogue = ctx->image + ctx->idx;
+		emit_addr_mov_i64(A64_R(0), (const u64)im, ctx);
+		emit_call((const u64)__bpf_tramp_exit, ctx);
+	}
+
+	if (flags & BPF_TRAMP_F_RESTORE_REGS)
+		restore_args(ctx, args_off, nargs);
+
+	emit_sp_load(A64_R(19), regs_off, ctx);
+	emit_sp_load(A64_R(20), regs_off + 8, ctx);
+
+	if (save_ret)
+		emit_sp_load(A64_R(0), retval_off, ctx);
+
+	emit(A64_MOV(1, A64_SP, A64_FP), ctx);
+	emit(A64_POP(A64_FP, A64_LR, A64_SP), ctx);
+	emit(A64_POP(A64_FP, A64_R(9), A64_SP), ctx);
+
+	if (flags & BPF_TRAMP_F_SKIP_FRAME) {
+		/* skip the traced function, return to the parent */
+		emit(A64_MOV(1, A64_LR, A64_R(9)), ctx);
+		emit(A64_RET(A64_R(9)), ctx);
+	} else {
+		/* continue into the traced function's body */
+		emit(A64_MOV(1, tmp, A64_LR), ctx);
+		emit(A64_MOV(1, A64_LR, A64_R(9)), ctx);
+		emit(A64_RET(tmp), ctx);
+	}
+
+	kfree(branches);
+
+	return ctx->idx;
+}
+
+int arch_prepare_bpf_trampoline(struct bpf_tramp_image *im, void *image,
+				void *image_end, const struct btf_func_model *m,
+				u32 flags, struct bpf_tramp_progs *tprogs,
+				void *orig_call)
+{
+	int max_insns = (image_end - image) / AARCH64_INSN_SIZE;
+	int nargs = m->nr_args;
+	struct jit_ctx ctx = {};
+	int ret, i;
+
+	/* only the arguments passed in x0-x7 are supported */
+	if (nargs > 8)
+		return -ENOTSUPP;
+	for (i = 0; i < nargs; i++)
+		if (m->arg_size[i] > 8)
+			return -ENOTSUPP;
+
+	/* 1. fake pass to size the trampoline */
+	ret = prepare_trampoline(&ctx, im, tprogs, nargs, flags, orig_call);
+	if (ret < 0)
+		return ret;
+	if (ret > max_insns)
+		return -EFBIG;
+
+	/* 2. the actual pass */
+	ctx.image = image;
+	ctx.idx = 0;
+
+	jit_fill_hole(image, (unsigned int)(image_end - image));
+	ret = prepare_trampoline(&ctx, im, tprogs, nargs, flags, orig_call);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < ctx.idx; i++)
+		if (le32_to_cpu(ctx.image[i]) == AARCH64_BREAK_FAULT)
+			return -EINVAL;
+
+	bpf_flush_icache(ctx.image, ctx.image + ctx.idx);
+
+	return ctx.idx * AARCH64_INSN_SIZE;
+}
+
+static int gen_branch_or_nop(enum aarch64_insn_branch_type type, void *ip,
+			     void *addr, u32 *insn)
+{
+	if (!addr)
+		*insn = aarch64_insn_gen_nop();
+	else
+		*insn = aarch64_insn_gen_branch_imm((unsigned long)ip,
+						    (unsigned long)addr, type);
+
+	return *insn != AARCH64_BREAK_FAULT ? 0 : -EFAULT;
+}
+
+/* Does @ip point at the prologue emitted by build_prologue()? */
+static bool is_bpf_prog_entry(void *ip)
+{
+	u32 insn;
+
+	if (IS_ENABLED(CONFIG_ARM64_BTI_KERNEL)) {
+		if (aarch64_insn_read(ip, &insn) || insn != A64_BTI_C)
+			return false;
+		ip += AARCH64_INSN_SIZE;
+	}
+
+	return !aarch64_insn_read(ip, &insn) &&
+	       insn == A64_MOV(1, A64_R(9), A64_LR);
+}
+
+/*
+ * Replace the branch at @ip from @old_addr to @new_addr, a NULL address
+ * standing for a NOP. @ip is either the entry of a BPF program, in which
+ * case the patch site reserved by build_prologue() is used, or a location
+ * inside a BPF trampoline.
+ *
+ * Both live in the BPF JIT region, which is smaller than the range of a
+ * 'BL', so a direct branch always reaches. The region is checked instead
+ * of looking up a BPF symbol, as programs loaded without CAP_BPF have
+ * none. Kernel functions are not supported.
+ */
+int bpf_arch_text_poke(void *ip, enum bpf_text_poke_type poke_type,
+		       void *old_addr, void *new_addr)
+{
+	enum aarch64_insn_branch_type type;
+	u32 old_insn, new_insn, replaced;
+	int ret;
+
+	if ((unsigned long)ip < BPF_JIT_REGION_START ||
+	    (unsigned long)ip >= BPF_JIT_REGION_END)
+		return -ENOTSUPP;
+
+	/* program entry, skip to the NOP after 'mov x9, lr' */
+	if (is_bpf_prog_entry(ip))
+		ip += POKE_OFFSET * AARCH64_INSN_SIZE;
+
+	type = poke_type == BPF_MOD_CALL ? AARCH64_INSN_BRANCH_LINK :
+					   AARCH64_INSN_BRANCH_NOLINK;
+
+	if (gen_branch_or_nop(type, ip, old_addr, &old_insn) ||
+	    gen_branch_or_nop(type, ip, new_addr, &new_insn))
+		return -EFAULT;
+
+	mutex_lock(&text_mutex);
+	if (aarch64_insn_read(ip, &replaced)) {
+		ret = -EFAULT;
+		goto out;
+	}
+	if (replaced != old_insn) {
+		ret = -EBUSY;
+		goto out;
+	}
+	/*
+	 * A single aligned instruction is replaced, so other CPUs see either
+	 * the old or the new branch. Freeing of an old trampoline is already
+	 * deferred by bpf_tramp_image_put() until nobody can be inside it.
+	 */
+	ret = old_insn == new_insn ? 0 :
+	      aarch64_insn_patch_text_nosync(ip, new_insn);
+out:
+	mutex_unlock(&text_mutex);
+	return ret;
+}
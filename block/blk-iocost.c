@@ -44,7 +44,16 @@
  * /sys/fs/cgroup/io.cost.model.
  *
  * If needed, tools/cgroup/iocost_coef_gen.py can be used to generate
- * device-specific coefficients.
+ * device-specific coefficients.  Alternatively, "ctrl=fit" makes the
+ * controller learn the coefficients online.  Each completion is charged
+ * the device time since the previous completion on the same CPU or its
+ * own issue, whichever is later, which approximates the device busy
+ * time without a device-wide cacheline bounced on every IO.  These
+ * samples are classified by direction and seq/rand, aggregated into
+ * exponentially decaying sums every period and fitted by least squares
+ * to a per-page cost and per-IO base costs.  The absolute scale of the
+ * fitted model is only approximate for devices with internal
+ * parallelism; vrate adjustment takes care of that as usual.
  *
  * 2. Control Strategy
  *
@@ -308,6 +317,26 @@ enum {
 
 	/* if apart further than 16M, consider randio for linear model */
 	LCOEF_RANDIO_PAGES	= 4096,
+
+	/*
+	 * Online cost model fitting.  Per-period samples are folded into
+	 * sums which lose 1/16 of their weight each period.  Coefficients
+	 * are updated once there are enough samples in a direction and the
+	 * per-page cost only if IO sizes vary by at least a page.
+	 */
+	FIT_DECAY_SHIFT		= 4,
+	FIT_MIN_SAMPLES		= 256,
+
+	/*
+	 * With ctrl=fit and without user QoS params, vrate bounds follow
+	 * the latency targets.
+	 * Missing them caps vrate just above the current value, meeting
+	 * them while throttling raises the floor just below it.  Both relax
+	 * slowly so that the bounds can track changing device behavior.
+	 */
+	AUTOB_MARGIN_PCT	= 10,
+	AUTOB_RELAX_PCT		= 2,
+	AUTOB_MISSED_PPM	= 100000,	/* 10%, if no rpct/wpct */
 };
 
 enum ioc_running {
@@ -393,8 +422,27 @@ struct ioc_missed {
 	u32				last_missed;
 };
 
+/* online model fitting samples, indexed by enum ioc_fit_stat_idx */
+enum ioc_fit_stat_idx {
+	FIT_NR,
+	FIT_PAGES,
+	FIT_PAGES_SQ,
+	FIT_LAT,
+	FIT_LAT_PAGES,
+	NR_FIT_STATS,
+};
+
+struct ioc_fit_stat {
+	local64_t			v[NR_FIT_STATS];
+	u64				last[NR_FIT_STATS];
+};
+
 struct ioc_pcpu_stat {
 	struct ioc_missed		missed[2];
+	/* [READ|WRITE][seq|rand] */
+	struct ioc_fit_stat		fit[2][2];
+	local64_t			fit_last_done_ns;
+	sector_t			fit_cursor;
 
 	local64_t			rq_wait_ns;
 	u64				last_rq_wait_ns;
@@ -413,6 +461,10 @@ struct ioc {
 	u64				vrate_min;
 	u64				vrate_max;
 
+	/* vrate bounds derived from QoS latency targets */
+	u64				autob_min;
+	u64				autob_max;
+
 	spinlock_t			lock;
 	struct timer_list		timer;
 	struct list_head		active_iocgs;	/* active cgroups */
@@ -443,6 +495,10 @@ struct ioc {
 	int				autop_idx;
 	bool				user_qos_params:1;
 	bool				user_cost_model:1;
+	bool				fit_cost_model:1;
+
+	/* online model fitting, see FIT_DECAY_SHIFT */
+	u64				fit_sums[2][2][NR_FIT_STATS];
 };
 
 struct iocg_pcpu_stat {
@@ -823,8 +879,9 @@ static int ioc_autop_idx(struct ioc *ioc)
 	if (idx < AUTOP_SSD_DFL)
 		return AUTOP_SSD_DFL;
 
-	/* if user is overriding anything, maintain what was there */
-	if (ioc->user_qos_params || ioc->user_cost_model)
+	/* if user is overriding or we're fitting, maintain what was there */
+	if (ioc->user_qos_params || ioc->user_cost_model ||
+	    ioc->fit_cost_model)
 		return idx;
 
 	/* step up/down based on the vrate */
@@ -922,7 +979,7 @@ static bool ioc_refresh_params(struct ioc *ioc, bool force)
 
 	if (!ioc->user_qos_params)
 		memcpy(ioc->params.qos, p->qos, sizeof(p->qos));
-	if (!ioc->user_cost_model)
+	if (!ioc->user_cost_model && !ioc->fit_cost_model)
 		memcpy(ioc->params.i_lcoefs, p->i_lcoefs, sizeof(p->i_lcoefs));
 
 	ioc_refresh_period_us(ioc);
@@ -933,6 +990,10 @@ static bool ioc_refresh_params(struct ioc *ioc, bool force)
 	ioc->vrate_max = div64_u64((u64)ioc->params.qos[QOS_MAX] *
 				   VTIME_PER_USEC, MILLION);
 
+	/* start learning the bounds afresh */
+	ioc->autob_min = ioc->vrate_min;
+	ioc->autob_max = ioc->vrate_max;
+
 	return true;
 }
 
@@ -1551,6 +1612,170 @@ static void ioc_lat_stat(struct ioc *ioc, u32 *missed_ppm_ar, u32 *rq_wait_pct_p
 				   ioc->period_us * NSEC_PER_USEC);
 }
 
+/* fold this period's fitting samples into the decaying sums */
+static void ioc_fit_collect(struct ioc *ioc)
+{
+	u64 d[2][2][NR_FIT_STATS] = { };
+	int cpu, rw, rand, i;
+
+	lockdep_assert_held(&ioc->lock);
+
+	for_each_online_cpu(cpu) {
+		struct ioc_pcpu_stat *stat = per_cpu_ptr(ioc->pcpu_stat, cpu);
+
+		for (rw = READ; rw <= WRITE; rw++) {
+			for (rand = 0; rand < 2; rand++) {
+				struct ioc_fit_stat *fs = &stat->fit[rw][rand];
+
+				for (i = 0; i < NR_FIT_STATS; i++) {
+					u64 v = local64_read(&fs->v[i]);
+
+					d[rw][rand][i] += v - fs->last[i];
+					fs->last[i] = v;
+				}
+			}
+		}
+	}
+
+	for (rw = READ; rw <= WRITE; rw++) {
+		for (rand = 0; rand < 2; rand++) {
+			u64 *sum = ioc->fit_sums[rw][rand];
+
+			for (i = 0; i < NR_FIT_STATS; i++)
+				sum[i] += d[rw][rand][i] -
+					  (sum[i] >> FIT_DECAY_SHIFT);
+		}
+	}
+}
+
+/*
+ * Fit lat = base[seq|rand] + pages * page for one direction.  The per-page
+ * cost is the pooled within-class slope so that the seq/rand mix doesn't
+ * leak into it, the base costs are what's left of the class means.
+ * Returns whether the coefficients changed.
+ */
+static bool ioc_fit_dir(struct ioc *ioc, int rw, u64 *pagep, u64 *seqiop,
+			u64 *randiop)
+{
+	u64 (*sums)[NR_FIT_STATS] = ioc->fit_sums[rw];
+	u64 *base[2] = { seqiop, randiop };
+	u64 nr = sums[0][FIT_NR] + sums[1][FIT_NR];
+	s64 cov = 0, var = 0;
+	int rand;
+
+	if (nr < FIT_MIN_SAMPLES)
+		return false;
+
+	for (rand = 0; rand < 2; rand++) {
+		u64 *sum = sums[rand];
+
+		if (!sum[FIT_NR])
+			continue;
+		cov += sum[FIT_LAT_PAGES] -
+			mul_u64_u64_div_u64(sum[FIT_LAT], sum[FIT_PAGES],
+					    sum[FIT_NR]);
+		var += sum[FIT_PAGES_SQ] -
+			mul_u64_u64_div_u64(sum[FIT_PAGES], sum[FIT_PAGES],
+					    sum[FIT_NR]);
+	}
+
+	/* need some spread in IO sizes to tell per-page from per-IO cost */
+	if (var >= (s64)nr && cov > 0)
+		*pagep = mul_u64_u64_div_u64(cov, VTIME_PER_NSEC, var);
+
+	for (rand = 0; rand < 2; rand++) {
+		u64 *sum = sums[rand];
+		u64 lat_vt, page_vt;
+
+		if (sum[FIT_NR] < FIT_MIN_SAMPLES / 8)
+			continue;
+
+		lat_vt = sum[FIT_LAT] * VTIME_PER_NSEC;
+		page_vt = sum[FIT_PAGES] * *pagep;
+		*base[rand] = lat_vt > page_vt ?
+			div64_u64(lat_vt - page_vt, sum[FIT_NR]) : 0;
+	}
+
+	return true;
+}
+
+static u64 ioc_fit_to_iops(u64 cost)
+{
+	return div64_u64(VTIME_PER_SEC, max_t(u64, cost, 1));
+}
+
+/* update the linear model from the samples collected so far */
+static void ioc_fit_model(struct ioc *ioc)
+{
+	u64 *c = ioc->params.lcoefs;
+	u64 *u = ioc->params.i_lcoefs;
+	u64 page, seqio, randio;
+
+	lockdep_assert_held(&ioc->lock);
+
+	ioc_fit_collect(ioc);
+
+	page = c[LCOEF_RPAGE];
+	seqio = c[LCOEF_RSEQIO];
+	randio = c[LCOEF_RRANDIO];
+	if (ioc_fit_dir(ioc, READ, &page, &seqio, &randio)) {
+		u[I_LCOEF_RBPS] = ioc_fit_to_iops(page) * IOC_PAGE_SIZE;
+		u[I_LCOEF_RSEQIOPS] = ioc_fit_to_iops(seqio + page);
+		u[I_LCOEF_RRANDIOPS] = ioc_fit_to_iops(randio + page);
+	}
+
+	page = c[LCOEF_WPAGE];
+	seqio = c[LCOEF_WSEQIO];
+	randio = c[LCOEF_WRANDIO];
+	if (ioc_fit_dir(ioc, WRITE, &page, &seqio, &randio)) {
+		u[I_LCOEF_WBPS] = ioc_fit_to_iops(page) * IOC_PAGE_SIZE;
+		u[I_LCOEF_WSEQIOPS] = ioc_fit_to_iops(seqio + page);
+		u[I_LCOEF_WRANDIOPS] = ioc_fit_to_iops(randio + page);
+	}
+
+	ioc_refresh_lcoefs(ioc);
+}
+
+static void ioc_fit_reset(struct ioc *ioc)
+{
+	int cpu;
+
+	memset(ioc->fit_sums, 0, sizeof(ioc->fit_sums));
+	for_each_possible_cpu(cpu)
+		local64_set(&per_cpu_ptr(ioc->pcpu_stat, cpu)->fit_last_done_ns,
+			    0);
+}
+
+/*
+ * Learn vrate bounds from the latency targets, see AUTOB_MARGIN_PCT.
+ * @missed: the latency targets were missed this period
+ * @met: the targets were met with margin while issuers were throttled
+ */
+static void ioc_adjust_autob(struct ioc *ioc, bool missed, bool met)
+{
+	u64 vrate = ioc->vtime_base_rate;
+	u64 above = div64_u64(vrate * (100 + AUTOB_MARGIN_PCT), 100);
+	u64 below = div64_u64(vrate * (100 - AUTOB_MARGIN_PCT), 100);
+
+	lockdep_assert_held(&ioc->lock);
+
+	if (missed) {
+		ioc->autob_max = min(ioc->autob_max, above);
+		ioc->autob_min = min(ioc->autob_min, below);
+	} else {
+		ioc->autob_max = div64_u64(ioc->autob_max *
+					   (100 + AUTOB_RELAX_PCT), 100);
+		if (met)
+			ioc->autob_min = max(ioc->autob_min, below);
+		else
+			ioc->autob_min = div64_u64(ioc->autob_min *
+						   (100 - AUTOB_RELAX_PCT), 100);
+	}
+
+	ioc->autob_min = clamp(ioc->autob_min, ioc->vrate_min, ioc->vrate_max);
+	ioc->autob_max = clamp(ioc->autob_max, ioc->autob_min, ioc->vrate_max);
+}
+
 /* was iocg idle this period? */
 static bool iocg_is_idle(struct ioc_gq *iocg)
 {
@@ -2095,6 +2320,7 @@ static void ioc_timer_fn(struct timer_list *timer)
 	u32 missed_ppm[2], rq_wait_pct;
 	u64 period_vtime;
 	int prev_busy_level;
+	bool qos_met = false;
 
 	/* how were the latencies during the period? */
 	ioc_lat_stat(ioc, missed_ppm, &rq_wait_pct);
@@ -2314,6 +2540,7 @@ static void ioc_timer_fn(struct timer_list *timer)
 			 * capacity.  If vrate was being slowed down, stop.
 			 */
 			ioc->busy_level = min(ioc->busy_level, 0);
+			qos_met = true;
 
 			/*
 			 * If there are IOs spanning multiple periods, wait
@@ -2337,9 +2564,16 @@ static void ioc_timer_fn(struct timer_list *timer)
 
 	ioc->busy_level = clamp(ioc->busy_level, -1000, 1000);
 
+	if (ioc->fit_cost_model && !ioc->user_qos_params)
+		ioc_adjust_autob(ioc, missed_ppm[READ] > AUTOB_MISSED_PPM ||
+				 missed_ppm[WRITE] > AUTOB_MISSED_PPM,
+				 qos_met &&
+				 missed_ppm[READ] <= AUTOB_MISSED_PPM &&
+				 missed_ppm[WRITE] <= AUTOB_MISSED_PPM);
+
 	if (ioc->busy_level > 0 || (ioc->busy_level < 0 && !nr_lagging)) {
 		u64 vrate = ioc->vtime_base_rate;
-		u64 vrate_min = ioc->vrate_min, vrate_max = ioc->vrate_max;
+		u64 vrate_min = ioc->autob_min, vrate_max = ioc->autob_max;
 
 		/* rq_wait signal is always reliable, ignore user vrate_min */
 		if (rq_wait_pct > RQ_WAIT_BUSY_PCT)
@@ -2385,6 +2619,9 @@ static void ioc_timer_fn(struct timer_list *timer)
 
 	ioc_refresh_params(ioc, false);
 
+	if (ioc->fit_cost_model)
+		ioc_fit_model(ioc);
+
 	ioc_forgive_debts(ioc, usage_us_sum, nr_debtors, &now);
 
 	/*
@@ -2744,11 +2981,38 @@ static void ioc_rqos_done_bio(struct rq_qos *rqos, struct bio *bio)
 		atomic64_add(bio->bi_iocost_cost, &iocg->done_vtime);
 }
 
+/* account @rq's share of the device busy time for model fitting */
+static void ioc_fit_sample(struct ioc *ioc, struct ioc_pcpu_stat *ccs,
+			   struct request *rq, int rw, u64 now_ns)
+{
+	unsigned int sectors = blk_rq_stats_sectors(rq);
+	u64 pages = max_t(u64, sectors >> IOC_SECT_TO_PAGE_SHIFT, 1);
+	sector_t pos = blk_rq_pos(rq);
+	sector_t cursor = READ_ONCE(ccs->fit_cursor);
+	u64 busy_from, lat_ns, seek_pages;
+	struct ioc_fit_stat *fs;
+
+	busy_from = max_t(u64, local64_xchg(&ccs->fit_last_done_ns, now_ns),
+			  rq->io_start_time_ns);
+	lat_ns = now_ns > busy_from ? now_ns - busy_from : 0;
+
+	WRITE_ONCE(ccs->fit_cursor, pos + sectors);
+	seek_pages = (pos > cursor ? pos - cursor : cursor - pos) >>
+		IOC_SECT_TO_PAGE_SHIFT;
+
+	fs = &ccs->fit[rw][seek_pages > LCOEF_RANDIO_PAGES];
+	local64_inc(&fs->v[FIT_NR]);
+	local64_add(pages, &fs->v[FIT_PAGES]);
+	local64_add(pages * pages, &fs->v[FIT_PAGES_SQ]);
+	local64_add(lat_ns, &fs->v[FIT_LAT]);
+	local64_add(lat_ns * pages, &fs->v[FIT_LAT_PAGES]);
+}
+
 static void ioc_rqos_done(struct rq_qos *rqos, struct request *rq)
 {
 	struct ioc *ioc = rqos_to_ioc(rqos);
 	struct ioc_pcpu_stat *ccs;
-	u64 on_q_ns, rq_wait_ns, size_nsec;
+	u64 now_ns, on_q_ns, rq_wait_ns, size_nsec;
 	int pidx, rw;
 
 	if (!ioc->enabled || !rq->alloc_time_ns || !rq->start_time_ns)
@@ -2767,7 +3031,8 @@ static void ioc_rqos_done(struct rq_qos *rqos, struct request *rq)
 		return;
 	}
 
-	on_q_ns = ktime_get_ns() - rq->alloc_time_ns;
+	now_ns = ktime_get_ns();
+	on_q_ns = now_ns - rq->alloc_time_ns;
 	rq_wait_ns = rq->start_time_ns - rq->alloc_time_ns;
 	size_nsec = div64_u64(calc_size_vtime_cost(rq, ioc), VTIME_PER_NSEC);
 
@@ -2781,6 +3046,9 @@ static void ioc_rqos_done(struct rq_qos *rqos, struct request *rq)
 
 	local64_add(rq_wait_ns, &ccs->rq_wait_ns);
 
+	if (ioc->fit_cost_model && rq->io_start_time_ns)
+		ioc_fit_sample(ioc, ccs, rq, rw, now_ns);
+
 	put_cpu_ptr(ccs);
 }
 
@@ -2998,6 +3266,18 @@ static size_t ioc_pd_stat(struct blkg_policy_data *pd, char *buf, size_t size)
 			VTIME_PER_USEC);
 		pos += scnprintf(buf + pos, size - pos, " cost.vrate=%u.%02u",
 				  vp10k / 100, vp10k % 100);
+
+		if (blkcg_debug_stats) {
+			unsigned min10k = DIV64_U64_ROUND_CLOSEST(
+				ioc->autob_min * 10000, VTIME_PER_USEC);
+			unsigned max10k = DIV64_U64_ROUND_CLOSEST(
+				ioc->autob_max * 10000, VTIME_PER_USEC);
+
+			pos += scnprintf(buf + pos, size - pos,
+					 " cost.vrate_min=%u.%02u cost.vrate_max=%u.%02u",
+					 min10k / 100, min10k % 100,
+					 max10k / 100, max10k % 100);
+		}
 	}
 
 	pos += scnprintf(buf + pos, size - pos, " cost.usage=%llu",
@@ -3287,7 +3567,8 @@ static u64 ioc_cost_model_prfill(struct seq_file *sf,
 	seq_printf(sf, "%s ctrl=%s model=linear "
 		   "rbps=%llu rseqiops=%llu rrandiops=%llu "
 		   "wbps=%llu wseqiops=%llu wrandiops=%llu\n",
-		   dname, ioc->user_cost_model ? "user" : "auto",
+		   dname, ioc->user_cost_model ? "user" :
+		   ioc->fit_cost_model ? "fit" : "auto",
 		   u[I_LCOEF_RBPS], u[I_LCOEF_RSEQIOPS], u[I_LCOEF_RRANDIOPS],
 		   u[I_LCOEF_WBPS], u[I_LCOEF_WSEQIOPS], u[I_LCOEF_WRANDIOPS]);
 	return 0;
@@ -3324,7 +3605,7 @@ static ssize_t ioc_cost_model_write(struct kernfs_open_file *of, char *input,
 	struct gendisk *disk;
 	struct ioc *ioc;
 	u64 u[NR_I_LCOEFS];
-	bool user;
+	bool user, fit;
 	char *p;
 	int ret;
 
@@ -3343,6 +3624,7 @@ static ssize_t ioc_cost_model_write(struct kernfs_open_file *of, char *input,
 	spin_lock_irq(&ioc->lock);
 	memcpy(u, ioc->params.i_lcoefs, sizeof(u));
 	user = ioc->user_cost_model;
+	fit = ioc->fit_cost_model;
 	spin_unlock_irq(&ioc->lock);
 
 	while ((p = strsep(&input, " \t\n"))) {
@@ -3357,12 +3639,18 @@ static ssize_t ioc_cost_model_write(struct kernfs_open_file *of, char *input,
 		switch (match_token(p, cost_ctrl_tokens, args)) {
 		case COST_CTRL:
 			match_strlcpy(buf, &args[0], sizeof(buf));
-			if (!strcmp(buf, "auto"))
+			if (!strcmp(buf, "auto")) {
 				user = false;
-			else if (!strcmp(buf, "user"))
+				fit = false;
+			} else if (!strcmp(buf, "user")) {
 				user = true;
-			else
+				fit = false;
+			} else if (!strcmp(buf, "fit")) {
+				user = false;
+				fit = true;
+			} else {
 				goto einval;
+			}
 			continue;
 		case COST_MODEL:
 			match_strlcpy(buf, &args[0], sizeof(buf));
@@ -3378,6 +3666,7 @@ static ssize_t ioc_cost_model_write(struct kernfs_open_file *of, char *input,
 			goto einval;
 		u[tok] = v;
 		user = true;
+		fit = false;
 	}
 
 	spin_lock_irq(&ioc->lock);
@@ -3387,6 +3676,10 @@ static ssize_t ioc_cost_model_write(struct kernfs_open_file *of, char *input,
 	} else {
 		ioc->user_cost_model = false;
 	}
+	/* fitting starts from whatever coefficients are in effect */
+	if (fit && !ioc->fit_cost_model)
+		ioc_fit_reset(ioc);
+	ioc->fit_cost_model = fit;
 	ioc_refresh_params(ioc, true);
 	spin_unlock_irq(&ioc->lock);
 
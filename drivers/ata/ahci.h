@@ -21,6 +21,7 @@
 
 #include <linux/pci.h>
 #include <linux/clk.h>
+#include <linux/hrtimer.h>
 #include <linux/libata.h>
 #include <linux/phy/phy.h>
 #include <linux/regulator/consumer.h>
@@ -72,6 +73,8 @@ enum {
 	HOST_IRQ_STAT		= 0x08, /* interrupt status */
 	HOST_PORTS_IMPL		= 0x0c, /* bitmap of implemented ports */
 	HOST_VERSION		= 0x10, /* AHCI spec. version compliancy */
+	HOST_CCC_CTL		= 0x14, /* Command Completion Coalescing ctl */
+	HOST_CCC_PORTS		= 0x18, /* ports taking part in CCC */
 	HOST_EM_LOC		= 0x1c, /* Enclosure Management location */
 	HOST_EM_CTL		= 0x20, /* Enclosure Management Control */
 	HOST_CAP2		= 0x24, /* host capabilities, extended */
@@ -82,6 +85,15 @@ enum {
 	HOST_MRSM		= (1 << 2),  /* MSI Revert to Single Message */
 	HOST_AHCI_EN		= (1 << 31), /* AHCI enabled */
 
+	/* HOST_CCC_CTL bits */
+	HOST_CCC_TV_OFFSET	= 16, /* timeout value, in ms */
+	HOST_CCC_TV_MAX		= 0xffff,
+	HOST_CCC_CC_OFFSET	= 8,  /* command completions */
+	HOST_CCC_CC_MAX		= 0xff,
+	HOST_CCC_INT_OFFSET	= 3,  /* interrupt used for CCC */
+	HOST_CCC_INT_MASK	= (0x1f << HOST_CCC_INT_OFFSET),
+	HOST_CCC_EN		= (1 << 0),  /* enable CCC */
+
 	/* HOST_CAP bits */
 	HOST_CAP_SXS		= (1 << 5),  /* Supports External SATA */
 	HOST_CAP_EMS		= (1 << 6),  /* Enclosure Management support */
@@ -160,6 +172,9 @@ enum {
 	DEF_PORT_IRQ		= PORT_IRQ_ERROR | PORT_IRQ_SG_DONE |
 				  PORT_IRQ_SDB_FIS | PORT_IRQ_DMAS_FIS |
 				  PORT_IRQ_PIOS_FIS | PORT_IRQ_D2H_REG_FIS,
+	/* completion interrupts that may be coalesced */
+	PORT_IRQ_COMPLETION	= PORT_IRQ_SDB_FIS | PORT_IRQ_DMAS_FIS |
+				  PORT_IRQ_D2H_REG_FIS,
 
 	/* PORT_CMD bits */
 	PORT_CMD_ASP		= (1 << 27), /* Aggressive Slumber/Partial */
@@ -300,7 +315,16 @@ struct ahci_em_priv {
 	struct ata_link *link;
 };
 
+struct ahci_irq_stats {
+	unsigned long		irqs;		/* completion interrupts */
+	unsigned long		polls;		/* coalescing timer polls */
+	unsigned long		completions;	/* commands completed */
+	/* completions per event, in log2 buckets: 0, 1, 2-3, ..., 32 */
+	unsigned long		hist[7];
+};
+
 struct ahci_port_priv {
+	struct ata_port		*ap;
 	struct ata_link		*active_link;
 	struct ahci_cmd_hdr	*cmd_slot;
 	dma_addr_t		cmd_slot_dma;
@@ -320,6 +344,13 @@ struct ahci_port_priv {
 	/* enclosure management info per PM slot */
 	struct ahci_em_priv	em_priv[EM_MAX_SLOTS];
 	char			*irq_desc;	/* desc in /proc/interrupts */
+	/* interrupt coalescing, protected by the ata_port lock */
+	unsigned int		coalesce_count;	/* completions per event */
+	unsigned int		coalesce_usecs;	/* 0 disables coalescing */
+	bool			ccc_enabled;	/* coalesced by the HBA */
+	bool			irq_polling;	/* completion irqs masked */
+	struct hrtimer		poll_timer;	/* software coalescing */
+	struct ahci_irq_stats	irq_stats;
 };
 
 struct ahci_host_priv {
@@ -333,6 +364,8 @@ struct ahci_host_priv {
 	u32			cap2;		/* cap2 to use */
 	u32			version;	/* cached version */
 	u32			port_map;	/* port map to use */
+	u32			ccc_ports;	/* ports using h/w CCC */
+	u32			ccc_irq;	/* HOST_IRQ_STAT bit of CCC */
 	u32			saved_cap;	/* saved initial cap */
 	u32			saved_cap2;	/* saved initial cap2 */
 	u32			saved_port_map;	/* saved initial port_map */
@@ -98,7 +98,21 @@ static ssize_t ahci_store_em_buffer(struct device *dev,
 				    const char *buf, size_t size);
 static ssize_t ahci_show_em_supported(struct device *dev,
 				      struct device_attribute *attr, char *buf);
+static ssize_t ahci_show_irq_coalesce_count(struct device *dev,
+			struct device_attribute *attr, char *buf);
+static ssize_t ahci_store_irq_coalesce_count(struct device *dev,
+			struct device_attribute *attr, const char *buf,
+			size_t size);
+static ssize_t ahci_show_irq_coalesce_usecs(struct device *dev,
+			struct device_attribute *attr, char *buf);
+static ssize_t ahci_store_irq_coalesce_usecs(struct device *dev,
+			struct device_attribute *attr, const char *buf,
+			size_t size);
+static ssize_t ahci_show_irq_stats(struct device *dev,
+				   struct device_attribute *attr, char *buf);
 static irqreturn_t ahci_single_level_irq_intr(int irq, void *dev_instance);
+static int ahci_port_set_coalesce(struct ata_port *ap, unsigned int count,
+				  unsigned int usecs);
 
 static DEVICE_ATTR(ahci_host_caps, S_IRUGO, ahci_show_host_caps, NULL);
 static DEVICE_ATTR(ahci_host_cap2, S_IRUGO, ahci_show_host_cap2, NULL);
@@ -107,6 +121,11 @@ static DEVICE_ATTR(ahci_port_cmd, S_IRUGO, ahci_show_port_cmd, NULL);
 static DEVICE_ATTR(em_buffer, S_IWUSR | S_IRUGO,
 		   ahci_read_em_buffer, ahci_store_em_buffer);
 static DEVICE_ATTR(em_message_supported, S_IRUGO, ahci_show_em_supported, NULL);
+static DEVICE_ATTR(ahci_irq_coalesce_count, S_IWUSR | S_IRUGO,
+		   ahci_show_irq_coalesce_count, ahci_store_irq_coalesce_count);
+static DEVICE_ATTR(ahci_irq_coalesce_usecs, S_IWUSR | S_IRUGO,
+		   ahci_show_irq_coalesce_usecs, ahci_store_irq_coalesce_usecs);
+static DEVICE_ATTR(ahci_irq_stats, S_IRUGO, ahci_show_irq_stats, NULL);
 
 struct device_attribute *ahci_shost_attrs[] = {
 	&dev_attr_link_power_management_policy,
@@ -118,6 +137,9 @@ struct device_attribute *ahci_shost_attrs[] = {
 	&dev_attr_ahci_port_cmd,
 	&dev_attr_em_buffer,
 	&dev_attr_em_message_supported,
+	&dev_attr_ahci_irq_coalesce_count,
+	&dev_attr_ahci_irq_coalesce_usecs,
+	&dev_attr_ahci_irq_stats,
 	NULL
 };
 EXPORT_SYMBOL_GPL(ahci_shost_attrs);
@@ -403,6 +425,107 @@ static ssize_t ahci_show_em_supported(struct device *dev,
 		       em_ctl & EM_CTL_SGPIO ? "sgpio " : "");
 }
 
+static ssize_t ahci_show_irq_coalesce_count(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct Scsi_Host *shost = class_to_shost(dev);
+	struct ata_port *ap = ata_shost_to_port(shost);
+	struct ahci_port_priv *pp = ap->private_data;
+
+	if (!pp)
+		return -ENODEV;
+
+	return sprintf(buf, "%u\n", pp->coalesce_count);
+}
+
+static ssize_t ahci_store_irq_coalesce_count(struct device *dev,
+			struct device_attribute *attr, const char *buf,
+			size_t size)
+{
+	struct Scsi_Host *shost = class_to_shost(dev);
+	struct ata_port *ap = ata_shost_to_port(shost);
+	struct ahci_port_priv *pp = ap->private_data;
+	unsigned int count;
+	int rc;
+
+	if (!pp)
+		return -ENODEV;
+
+	rc = kstrtouint(buf, 0, &count);
+	if (rc)
+		return rc;
+	if (count > HOST_CCC_CC_MAX)
+		return -EINVAL;
+
+	rc = ahci_port_set_coalesce(ap, count, pp->coalesce_usecs);
+
+	return rc ? rc : size;
+}
+
+static ssize_t ahci_show_irq_coalesce_usecs(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct Scsi_Host *shost = class_to_shost(dev);
+	struct ata_port *ap = ata_shost_to_port(shost);
+	struct ahci_port_priv *pp = ap->private_data;
+
+	if (!pp)
+		return -ENODEV;
+
+	return sprintf(buf, "%u\n", pp->coalesce_usecs);
+}
+
+static ssize_t ahci_store_irq_coalesce_usecs(struct device *dev,
+			struct device_attribute *attr, const char *buf,
+			size_t size)
+{
+	struct Scsi_Host *shost = class_to_shost(dev);
+	struct ata_port *ap = ata_shost_to_port(shost);
+	struct ahci_port_priv *pp = ap->private_data;
+	unsigned int usecs;
+	int rc;
+
+	if (!pp)
+		return -ENODEV;
+
+	rc = kstrtouint(buf, 0, &usecs);
+	if (rc)
+		return rc;
+	if (usecs > USEC_PER_SEC)
+		return -EINVAL;
+
+	rc = ahci_port_set_coalesce(ap, pp->coalesce_count, usecs);
+
+	return rc ? rc : size;
+}
+
+/*
+ * Output is: irqs polls completions, followed by the number of events
+ * which completed 0, 1, 2-3, 4-7, 8-15, 16-31 and 32 commands.
+ */
+static ssize_t ahci_show_irq_stats(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct Scsi_Host *shost = class_to_shost(dev);
+	struct ata_port *ap = ata_shost_to_port(shost);
+	struct ahci_port_priv *pp = ap->private_data;
+	struct ahci_irq_stats stats;
+	unsigned long flags;
+
+	if (!pp)
+		return -ENODEV;
+
+	spin_lock_irqsave(ap->lock, flags);
+	stats = pp->irq_stats;
+	spin_unlock_irqrestore(ap->lock, flags);
+
+	return sprintf(buf, "%lu %lu %lu %lu %lu %lu %lu %lu %lu %lu\n",
+		       stats.irqs, stats.polls, stats.completions,
+		       stats.hist[0], stats.hist[1], stats.hist[2],
+		       stats.hist[3], stats.hist[4], stats.hist[5],
+		       stats.hist[6]);
+}
+
 /**
  *	ahci_save_initial_config - Save and fixup initial config values
  *	@dev: target AHCI device
@@ -1804,8 +1927,8 @@ static void ahci_error_intr(struct ata_port *ap, u32 irq_stat)
 		ata_port_abort(ap);
 }
 
-static void ahci_handle_port_interrupt(struct ata_port *ap,
-				       void __iomem *port_mmio, u32 status)
+static int ahci_handle_port_interrupt(struct ata_port *ap,
+				      void __iomem *port_mmio, u32 status)
 {
 	struct ata_eh_info *ehi = &ap->link.eh_info;
 	struct ahci_port_priv *pp = ap->private_data;
@@ -1825,7 +1948,7 @@ static void ahci_handle_port_interrupt(struct ata_port *ap,
 
 	if (unlikely(status & PORT_IRQ_ERROR)) {
 		ahci_error_intr(ap, status);
-		return;
+		return 0;
 	}
 
 	if (status & PORT_IRQ_SDB_FIS) {
@@ -1886,17 +2009,217 @@ static void ahci_handle_port_interrupt(struct ata_port *ap,
 		ehi->action |= ATA_EH_RESET;
 		ata_port_freeze(ap);
 	}
+
+	return max(rc, 0);
+}
+
+static void ahci_account_completions(struct ahci_port_priv *pp, int nr)
+{
+	struct ahci_irq_stats *stats = &pp->irq_stats;
+
+	stats->completions += nr;
+	stats->hist[min_t(int, fls(nr), ARRAY_SIZE(stats->hist) - 1)]++;
+}
+
+static void ahci_port_stop_polling(struct ata_port *ap)
+{
+	struct ahci_port_priv *pp = ap->private_data;
+	void __iomem *port_mmio = ahci_port_base(ap);
+
+	pp->irq_polling = false;
+
+	/*
+	 * Completions which arrived since the last poll are latched in
+	 * PxIS and raise the interrupt as soon as it is unmasked.
+	 */
+	if (!(ap->pflags & ATA_PFLAG_FROZEN))
+		writel(pp->intr_mask, port_mmio + PORT_IRQ_MASK);
+}
+
+/*
+ * Software fallback for controllers without CCC, or with per-port MSI
+ * where the CCC interrupt can't be routed.  After a completion interrupt
+ * with commands still in flight, completion interrupts are masked and the
+ * port is polled every coalesce_usecs instead.  Interrupts are unmasked
+ * again once the port goes idle or a poll reaps fewer than coalesce_count
+ * commands, i.e. when the load is too light for polling to pay off.
+ * Error interrupts are never masked.
+ */
+static void ahci_port_start_polling(struct ata_port *ap)
+{
+	struct ahci_port_priv *pp = ap->private_data;
+	void __iomem *port_mmio = ahci_port_base(ap);
+
+	if (!pp->coalesce_usecs || pp->ccc_enabled || pp->irq_polling)
+		return;
+	if (!ap->qc_active || (ap->pflags & ATA_PFLAG_FROZEN))
+		return;
+
+	pp->irq_polling = true;
+	writel(pp->intr_mask & ~PORT_IRQ_COMPLETION,
+	       port_mmio + PORT_IRQ_MASK);
+	hrtimer_start(&pp->poll_timer, ns_to_ktime(pp->coalesce_usecs *
+						   NSEC_PER_USEC),
+		      HRTIMER_MODE_REL);
+}
+
+static enum hrtimer_restart ahci_port_poll_timer(struct hrtimer *timer)
+{
+	struct ahci_port_priv *pp = container_of(timer, struct ahci_port_priv,
+						 poll_timer);
+	struct ata_port *ap = pp->ap;
+	void __iomem *port_mmio = ahci_port_base(ap);
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	unsigned long flags;
+	u32 status;
+	int nr;
+
+	spin_lock_irqsave(ap->lock, flags);
+
+	/* cancelled by freeze or by disabling coalescing */
+	if (!pp->irq_polling)
+		goto out_unlock;
+
+	status = readl(port_mmio + PORT_IRQ_STAT);
+	writel(status, port_mmio + PORT_IRQ_STAT);
+
+	nr = ahci_handle_port_interrupt(ap, port_mmio, status);
+	pp->irq_stats.polls++;
+	ahci_account_completions(pp, nr);
+
+	if (pp->irq_polling && ap->qc_active && nr &&
+	    nr >= pp->coalesce_count) {
+		hrtimer_forward_now(timer, ns_to_ktime(pp->coalesce_usecs *
+						       NSEC_PER_USEC));
+		ret = HRTIMER_RESTART;
+	} else if (pp->irq_polling) {
+		ahci_port_stop_polling(ap);
+	}
+
+out_unlock:
+	spin_unlock_irqrestore(ap->lock, flags);
+
+	return ret;
+}
+
+/*
+ * Program the HBA-wide CCC registers from the per-port settings.  The
+ * completion counter is shared by all coalesced ports, so it is set to
+ * the sum of their counts, and the shortest timeout wins.
+ */
+static void ahci_ccc_program(struct ata_host *host)
+{
+	struct ahci_host_priv *hpriv = host->private_data;
+	void __iomem *mmio = hpriv->mmio;
+	unsigned int cc = 0, tv = HOST_CCC_TV_MAX;
+	unsigned int i;
+	u32 ctl;
+
+	/* TV and CC may only be changed while CCC is disabled */
+	ctl = readl(mmio + HOST_CCC_CTL);
+	writel(ctl & ~HOST_CCC_EN, mmio + HOST_CCC_CTL);
+	writel(hpriv->ccc_ports, mmio + HOST_CCC_PORTS);
+
+	if (!hpriv->ccc_ports) {
+		hpriv->ccc_irq = 0;
+		return;
+	}
+
+	for (i = 0; i < host->n_ports; i++) {
+		struct ahci_port_priv *pp = host->ports[i]->private_data;
+
+		if (!pp || !pp->ccc_enabled)
+			continue;
+		cc += pp->coalesce_count;
+		tv = min_t(unsigned int, tv,
+			   DIV_ROUND_UP(pp->coalesce_usecs, USEC_PER_MSEC));
+	}
+
+	cc = min_t(unsigned int, cc, HOST_CCC_CC_MAX);
+	tv = max(tv, 1U);
+
+	ctl = (tv << HOST_CCC_TV_OFFSET) | (cc << HOST_CCC_CC_OFFSET) |
+	      HOST_CCC_EN;
+	writel(ctl, mmio + HOST_CCC_CTL);
+
+	ctl = readl(mmio + HOST_CCC_CTL);
+	hpriv->ccc_irq = BIT((ctl & HOST_CCC_INT_MASK) >> HOST_CCC_INT_OFFSET);
+}
+
+/*
+ * Hardware CCC raises a host-level interrupt of its own, which only the
+ * stock single-vector handler knows how to dispatch.
+ */
+static bool ahci_ccc_usable(struct ata_host *host)
+{
+	struct ahci_host_priv *hpriv = host->private_data;
+
+	return (hpriv->cap & HOST_CAP_CCC) &&
+	       !(hpriv->flags & AHCI_HFLAG_MULTI_MSI) &&
+	       hpriv->irq_handler == ahci_single_level_irq_intr;
+}
+
+static int ahci_port_set_coalesce(struct ata_port *ap, unsigned int count,
+				  unsigned int usecs)
+{
+	struct ahci_host_priv *hpriv = ap->host->private_data;
+	struct ahci_port_priv *pp = ap->private_data;
+	void __iomem *port_mmio = ahci_port_base(ap);
+	unsigned long flags;
+
+	/* ports set up by a driver's own ->port_start have no poll timer */
+	if (!pp->ap)
+		return -EOPNOTSUPP;
+
+	ahci_rpm_get_port(ap);
+	spin_lock_irqsave(ap->lock, flags);
+
+	pp->coalesce_count = count;
+	pp->coalesce_usecs = usecs;
+
+	if (ahci_ccc_usable(ap->host)) {
+		pp->ccc_enabled = usecs != 0;
+		if (pp->ccc_enabled) {
+			pp->intr_mask &= ~PORT_IRQ_COMPLETION;
+			hpriv->ccc_ports |= 1 << ap->port_no;
+		} else {
+			pp->intr_mask |= PORT_IRQ_COMPLETION;
+			hpriv->ccc_ports &= ~(1 << ap->port_no);
+		}
+		ahci_ccc_program(ap->host);
+
+		if (!(ap->pflags & ATA_PFLAG_FROZEN))
+			writel(pp->intr_mask, port_mmio + PORT_IRQ_MASK);
+	} else if (!usecs && pp->irq_polling) {
+		ahci_port_stop_polling(ap);
+	}
+
+	spin_unlock_irqrestore(ap->lock, flags);
+	ahci_rpm_put_port(ap);
+
+	return 0;
+}
+
+static void ahci_port_intr_done(struct ata_port *ap, int nr)
+{
+	struct ahci_port_priv *pp = ap->private_data;
+
+	pp->irq_stats.irqs++;
+	ahci_account_completions(pp, nr);
+	ahci_port_start_polling(ap);
 }
 
 static void ahci_port_intr(struct ata_port *ap)
 {
 	void __iomem *port_mmio = ahci_port_base(ap);
 	u32 status;
+	int nr;
 
 	status = readl(port_mmio + PORT_IRQ_STAT);
 	writel(status, port_mmio + PORT_IRQ_STAT);
 
-	ahci_handle_port_interrupt(ap, port_mmio, status);
+	nr = ahci_handle_port_interrupt(ap, port_mmio, status);
+	ahci_port_intr_done(ap, nr);
 }
 
 static irqreturn_t ahci_multi_irqs_intr_hard(int irq, void *dev_instance)
@@ -1904,6 +2227,7 @@ static irqreturn_t ahci_multi_irqs_intr_hard(int irq, void *dev_instance)
 	struct ata_port *ap = dev_instance;
 	void __iomem *port_mmio = ahci_port_base(ap);
 	u32 status;
+	int nr;
 
 	VPRINTK("ENTER\n");
 
@@ -1911,7 +2235,8 @@ static irqreturn_t ahci_multi_irqs_intr_hard(int irq, void *dev_instance)
 	writel(status, port_mmio + PORT_IRQ_STAT);
 
 	spin_lock(ap->lock);
-	ahci_handle_port_interrupt(ap, port_mmio, status);
+	nr = ahci_handle_port_interrupt(ap, port_mmio, status);
+	ahci_port_intr_done(ap, nr);
 	spin_unlock(ap->lock);
 
 	VPRINTK("EXIT\n");
@@ -1969,6 +2294,13 @@ static irqreturn_t ahci_single_level_irq_intr(int irq, void *dev_instance)
 
 	spin_lock(&host->lock);
 
+	/*
+	 * The CCC interrupt is reported on a bit of its own; service all
+	 * coalesced ports, their PxIS bits are set but not forwarded.
+	 */
+	if (irq_stat & hpriv->ccc_irq)
+		irq_masked |= hpriv->ccc_ports;
+
 	rc = ahci_handle_port_intr(host, irq_masked);
 
 	/* HOST_IRQ_STAT behaves as level triggered latch meaning that
@@ -2047,9 +2379,13 @@ static bool ahci_qc_fill_rtf(struct ata_queued_cmd *qc)
 static void ahci_freeze(struct ata_port *ap)
 {
 	void __iomem *port_mmio = ahci_port_base(ap);
+	struct ahci_port_priv *pp = ap->private_data;
 
 	/* turn IRQ off */
 	writel(0, port_mmio + PORT_IRQ_MASK);
+
+	/* the poll timer notices and stops, thaw restores pp->intr_mask */
+	pp->irq_polling = false;
 }
 
 static void ahci_thaw(struct ata_port *ap)
@@ -2289,8 +2625,18 @@ static void ahci_pmp_detach(struct ata_port *ap)
 
 int ahci_port_resume(struct ata_port *ap)
 {
+	struct ahci_port_priv *pp = ap->private_data;
+	unsigned long flags;
+
 	ahci_rpm_get_port(ap);
 
+	/* a host reset disabled CCC, which would leave the port deaf */
+	if (pp->ccc_enabled) {
+		spin_lock_irqsave(ap->lock, flags);
+		ahci_ccc_program(ap->host);
+		spin_unlock_irqrestore(ap->lock, flags);
+	}
+
 	ahci_power_up(ap);
 	ahci_start_port(ap);
 
@@ -2404,6 +2750,10 @@ static int ahci_port_start(struct ata_port *ap)
 	 */
 	pp->intr_mask = DEF_PORT_IRQ;
 
+	pp->ap = ap;
+	hrtimer_init(&pp->poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	pp->poll_timer.function = ahci_port_poll_timer;
+
 	/*
 	 * Switch to per-port locking in case each port has its own MSI vector.
 	 */
@@ -2422,9 +2772,13 @@ static void ahci_port_stop(struct ata_port *ap)
 {
 	const char *emsg = NULL;
 	struct ahci_host_priv *hpriv = ap->host->private_data;
+	struct ahci_port_priv *pp = ap->private_data;
 	void __iomem *host_mmio = hpriv->mmio;
 	int rc;
 
+	if (pp->ap)
+		hrtimer_cancel(&pp->poll_timer);
+
 	/* de-initialize port */
 	rc = ahci_deinit_port(ap, &emsg);
 	if (rc)
@@ -537,9 +537,16 @@ struct cache_set {
 	/* For the btree cache */
 	struct shrinker		shrink;
 
-	/* For the btree cache and anything allocation related */
+	/* For anything allocation related */
 	struct mutex		bucket_lock;
 
+	/*
+	 * Protects the btree cache lists below and updates to bucket_hash;
+	 * nests inside bucket_lock. Lookups in bucket_hash only need RCU, so
+	 * cache hits never touch either lock.
+	 */
+	struct mutex		btree_cache_lock;
+
 	/* log2(bucket_size), in sectors */
 	unsigned short		bucket_bits;
 
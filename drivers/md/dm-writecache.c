@@ -191,6 +191,10 @@ struct dm_writecache {
 	struct task_struct *flush_thread;
 	struct bio_list flush_list;
 
+	unsigned long flush_requests;
+	unsigned long flush_commits;
+	unsigned long flushes_coalesced;
+
 	struct dm_kcopyd_client *dm_kcopyd;
 	unsigned long *dirty_bitmap;
 	unsigned dirty_bitmap_size;
@@ -1267,11 +1271,32 @@ static int writecache_flush_thread(void *data)
 			bio_set_dev(bio, wc->dev->bdev);
 			submit_bio_noacct(bio);
 		} else {
+			struct bio_list flushes;
+
+			/*
+			 * One commit makes everything that completed before it
+			 * stable, so it also satisfies every flush that queued
+			 * up behind this one while the previous commit was in
+			 * progress. Take them all, up to the next discard.
+			 */
+			bio_list_init(&flushes);
+			bio_list_add(&flushes, bio);
+			while ((bio = bio_list_peek(&wc->flush_list)) &&
+			       bio_op(bio) != REQ_OP_DISCARD) {
+				bio_list_pop(&wc->flush_list);
+				bio_list_add(&flushes, bio);
+				wc->flushes_coalesced++;
+			}
+
 			writecache_flush(wc);
+			wc->flush_commits++;
 			wc_unlock(wc);
-			if (writecache_has_error(wc))
-				bio->bi_status = BLK_STS_IOERR;
-			bio_endio(bio);
+
+			while ((bio = bio_list_pop(&flushes))) {
+				if (writecache_has_error(wc))
+					bio->bi_status = BLK_STS_IOERR;
+				bio_endio(bio);
+			}
 		}
 	}
 
@@ -1297,8 +1322,10 @@ static int writecache_map(struct dm_target *ti, struct bio *bio)
 	if (unlikely(bio->bi_opf & REQ_PREFLUSH)) {
 		if (writecache_has_error(wc))
 			goto unlock_error;
+		wc->flush_requests++;
 		if (WC_MODE_PMEM(wc)) {
 			writecache_flush(wc);
+			wc->flush_commits++;
 			if (writecache_has_error(wc))
 				goto unlock_error;
 			if (unlikely(wc->cleaner))
@@ -2517,9 +2544,11 @@ static void writecache_status(struct dm_target *ti, status_type_t type,
 
 	switch (type) {
 	case STATUSTYPE_INFO:
-		DMEMIT("%ld %llu %llu %llu", writecache_has_error(wc),
+		DMEMIT("%ld %llu %llu %llu %lu %lu %lu", writecache_has_error(wc),
 		       (unsigned long long)wc->n_blocks, (unsigned long long)wc->freelist_size,
-		       (unsigned long long)wc->writeback_size);
+		       (unsigned long long)wc->writeback_size,
+		       READ_ONCE(wc->flush_requests), READ_ONCE(wc->flush_commits),
+		       READ_ONCE(wc->flushes_coalesced));
 		break;
 	case STATUSTYPE_TABLE:
 		DMEMIT("%c %s %s %u ", WC_MODE_PMEM(wc) ? 'p' : 's',
@@ -2569,7 +2598,7 @@ static void writecache_status(struct dm_target *ti, status_type_t type,
 
 static struct target_type writecache_target = {
 	.name			= "writecache",
-	.version		= {1, 4, 0},
+	.version		= {1, 5, 0},
 	.module			= THIS_MODULE,
 	.ctr			= writecache_ctr,
 	.dtr			= writecache_dtr,
@@ -386,6 +386,7 @@
 #define     MVPP2_TXQ_REFILL_TOKENS_ALL_MASK	0x7ffff
 #define     MVPP2_TXQ_REFILL_PERIOD_ALL_MASK	0x3ff00000
 #define     MVPP2_TXQ_REFILL_PERIOD_MASK(v)	((v) << 20)
+#define     MVPP2_REFILL_PERIOD_MAX		0x3ff
 #define MVPP2_TXQ_SCHED_TOKEN_SIZE_REG(q)	(0x8060 + ((q) << 2))
 #define     MVPP2_TXQ_TOKEN_SIZE_MAX		0x7fffffff
 #define MVPP2_TXQ_SCHED_TOKEN_CNTR_REG(q)	(0x8080 + ((q) << 2))
@@ -698,6 +699,16 @@
 /* Maximum number of TXQs used by single port */
 #define MVPP2_MAX_TXQ			8
 
+/* TXQs left to unclassified traffic while HTB is offloaded, the others
+ * are handed out to leaf classes.
+ */
+#define MVPP2_HTB_NREGULAR		1
+
+/* Smallest refill worth of tokens (bits) a shaper is programmed with,
+ * which keeps its rate error below 0.1%
+ */
+#define MVPP2_SHAPER_MIN_TOKENS		1000
+
 /* MVPP2_MAX_TSO_SEGS is the maximum number of fragments to allow in the GSO
  * skb. As we need a maxium of two descriptors per fragments (1 header, 1 data),
  * multiply this value by two to count the maximum number of skb descs needed.
@@ -1087,6 +1098,19 @@ struct mvpp2_hwtstamp_queue {
 	u8 next;
 };
 
+/* HTB offload state. Leaf classes own TXQs [MVPP2_HTB_NREGULAR, ntxqs)
+ * and are shaped by their TXQ token bucket; a single inner class may sit
+ * above them, shaped by the port token bucket. Updated under RTNL, read
+ * locklessly by ndo_select_queue.
+ */
+struct mvpp2_htb {
+	u16 maj_id;		/* qdisc handle major, 0 when not offloaded */
+	u16 defcls;		/* default class minor */
+	u16 inner;		/* classid minor of the inner class, or 0 */
+	unsigned int nleaves;
+	u16 leaf[MVPP2_MAX_TXQ];	/* classid minor by qid, 0 if free */
+};
+
 struct mvpp2_port {
 	u8 id;
 
@@ -1175,6 +1199,11 @@ struct mvpp2_port {
 	bool rx_hwtstamp;
 	enum hwtstamp_tx_types tx_hwtstamp_type;
 	struct mvpp2_hwtstamp_queue tx_hwtstamp_queue[2];
+
+	struct mvpp2_htb htb;
+	/* Shaper rates in bytes per second, 0 when unlimited */
+	u64 txq_rate[MVPP2_MAX_TXQ];
+	u64 txp_rate;
 };
 
 /* The mvpp2_tx_desc and mvpp2_rx_desc structures describe the
@@ -37,6 +37,7 @@
 #include <net/ip.h>
 #include <net/ipv6.h>
 #include <net/tso.h>
+#include <net/pkt_cls.h>
 #include <linux/bpf_trace.h>
 
 #include "mvpp2.h"
@@ -2348,6 +2349,87 @@ static void mvpp2_txp_max_tx_size_set(struct mvpp2_port *port)
 	}
 }
 
+/* The TX scheduler refills a token bucket every refill period, counted in
+ * the 1 usec base periods set up by mvpp2_defaults_set(), with a number of
+ * tokens worth one bit each. Pick the shortest period giving a refill of
+ * at least MVPP2_SHAPER_MIN_TOKENS.
+ */
+static void mvpp2_shaper_calc(u64 rate, u32 *period, u32 *tokens)
+{
+	u64 bps = rate * BITS_PER_BYTE;
+	u64 p;
+
+	p = DIV64_U64_ROUND_UP((u64)MVPP2_SHAPER_MIN_TOKENS * USEC_PER_SEC,
+			       bps);
+	p = clamp_t(u64, p, 1, MVPP2_REFILL_PERIOD_MAX);
+
+	*period = p;
+	*tokens = clamp_t(u64, div_u64(bps * p, USEC_PER_SEC), 1,
+			  MVPP2_TXQ_REFILL_TOKENS_ALL_MASK);
+}
+
+/* Buckets must hold at least the (tripled) MTU, see
+ * mvpp2_txp_max_tx_size_set()
+ */
+static u32 mvpp2_shaper_size(struct mvpp2_port *port, u32 tokens)
+{
+	u32 mtu = min_t(u32, port->pkt_size * 8, MVPP2_TXP_MTU_MAX);
+
+	return max(3 * mtu, tokens);
+}
+
+/* Program the token bucket of a TXQ from port->txq_rate */
+static void mvpp2_txq_shaper_set(struct mvpp2_port *port, int txq)
+{
+	u32 val, period, tokens, size;
+
+	if (port->txq_rate[txq]) {
+		mvpp2_shaper_calc(port->txq_rate[txq], &period, &tokens);
+		size = mvpp2_shaper_size(port, tokens);
+	} else {
+		period = 1;
+		tokens = MVPP2_TXQ_REFILL_TOKENS_ALL_MASK;
+		size = MVPP2_TXQ_TOKEN_SIZE_MAX;
+	}
+
+	/* Indirect access to registers */
+	mvpp2_write(port->priv, MVPP2_TXP_SCHED_PORT_INDEX_REG,
+		    mvpp2_egress_port(port));
+
+	val = mvpp2_read(port->priv, MVPP2_TXQ_SCHED_REFILL_REG(txq));
+	val &= ~(MVPP2_TXQ_REFILL_PERIOD_ALL_MASK |
+		 MVPP2_TXQ_REFILL_TOKENS_ALL_MASK);
+	val |= MVPP2_TXQ_REFILL_PERIOD_MASK(period) | tokens;
+	mvpp2_write(port->priv, MVPP2_TXQ_SCHED_REFILL_REG(txq), val);
+	mvpp2_write(port->priv, MVPP2_TXQ_SCHED_TOKEN_SIZE_REG(txq), size);
+}
+
+/* Program the port token bucket from port->txp_rate */
+static void mvpp2_txp_shaper_set(struct mvpp2_port *port)
+{
+	u32 val, period, tokens, size;
+
+	if (port->txp_rate) {
+		mvpp2_shaper_calc(port->txp_rate, &period, &tokens);
+		size = mvpp2_shaper_size(port, tokens);
+	} else {
+		period = 1;
+		tokens = MVPP2_TXP_REFILL_TOKENS_ALL_MASK;
+		size = MVPP2_TXP_TOKEN_SIZE_MAX;
+	}
+
+	/* Indirect access to registers */
+	mvpp2_write(port->priv, MVPP2_TXP_SCHED_PORT_INDEX_REG,
+		    mvpp2_egress_port(port));
+
+	val = mvpp2_read(port->priv, MVPP2_TXP_SCHED_REFILL_REG);
+	val &= ~(MVPP2_TXP_REFILL_PERIOD_ALL_MASK |
+		 MVPP2_TXP_REFILL_TOKENS_ALL_MASK);
+	val |= MVPP2_TXP_REFILL_PERIOD_MASK(period) | tokens;
+	mvpp2_write(port->priv, MVPP2_TXP_SCHED_REFILL_REG, val);
+	mvpp2_write(port->priv, MVPP2_TXP_SCHED_TOKEN_SIZE_REG, size);
+}
+
 /* Set the number of packets that will be received before Rx interrupt
  * will be generated by HW.
  */
@@ -2712,7 +2794,7 @@ static int mvpp2_txq_init(struct mvpp2_port *port,
 {
 	u32 val;
 	unsigned int thread;
-	int desc, desc_per_txq, tx_port_num;
+	int desc, desc_per_txq;
 	struct mvpp2_txq_pcpu *txq_pcpu;
 
 	txq->size = port->tx_ring_size;
@@ -2754,19 +2836,10 @@ static int mvpp2_txq_init(struct mvpp2_port *port,
 			   MVPP2_PREF_BUF_THRESH(desc_per_txq / 2));
 	put_cpu();
 
-	/* WRR / EJP configuration - indirect access */
-	tx_port_num = mvpp2_egress_port(port);
-	mvpp2_write(port->priv, MVPP2_TXP_SCHED_PORT_INDEX_REG, tx_port_num);
-
-	val = mvpp2_read(port->priv, MVPP2_TXQ_SCHED_REFILL_REG(txq->log_id));
-	val &= ~MVPP2_TXQ_REFILL_PERIOD_ALL_MASK;
-	val |= MVPP2_TXQ_REFILL_PERIOD_MASK(1);
-	val |= MVPP2_TXQ_REFILL_TOKENS_ALL_MASK;
-	mvpp2_write(port->priv, MVPP2_TXQ_SCHED_REFILL_REG(txq->log_id), val);
-
-	val = MVPP2_TXQ_TOKEN_SIZE_MAX;
-	mvpp2_write(port->priv, MVPP2_TXQ_SCHED_TOKEN_SIZE_REG(txq->log_id),
-		    val);
+	/* WRR / EJP configuration: unlimited, unless an offloaded HTB leaf
+	 * shapes this queue
+	 */
+	mvpp2_txq_shaper_set(port, txq->log_id);
 
 	for (thread = 0; thread < port->priv->nthreads; thread++) {
 		txq_pcpu = per_cpu_ptr(txq->pcpu, thread);
@@ -4915,6 +4988,12 @@ static int mvpp2_set_features(struct net_device *dev,
 	netdev_features_t changed = dev->features ^ features;
 	struct mvpp2_port *port = netdev_priv(dev);
 
+	if ((changed & NETIF_F_HW_TC) && !(features & NETIF_F_HW_TC) &&
+	    port->htb.maj_id) {
+		netdev_err(dev, "Active HTB offload, can't turn hw_tc_offload off\n");
+		return -EBUSY;
+	}
+
 	if (changed & NETIF_F_HW_VLAN_CTAG_FILTER) {
 		if (features & NETIF_F_HW_VLAN_CTAG_FILTER) {
 			mvpp2_prs_vid_enable_filtering(port);
@@ -4959,6 +5038,12 @@ static int mvpp2_xdp_setup(struct mvpp2_port *port, struct netdev_bpf *bpf)
 		return -EOPNOTSUPP;
 	}
 
+	/* XDP_TX uses the upper half of the TXQs, which HTB hands to leaves */
+	if (prog && port->htb.maj_id) {
+		NL_SET_ERR_MSG_MOD(bpf->extack, "XDP can't be used with HTB offload");
+		return -EBUSY;
+	}
+
 	/* device is up and bpf is added/removed, must setup the RX queues */
 	if (running && reset)
 		mvpp2_stop(port->dev);
@@ -4993,6 +5078,274 @@ static int mvpp2_xdp(struct net_device *dev, struct netdev_bpf *xdp)
 	}
 }
 
+/* HTB offload. The TX scheduler only has a token bucket per TXQ and one
+ * for the whole port, so the supported trees are leaves directly below
+ * the root, or a single top level class (the port bucket) with leaves
+ * below it. Only ceil is enforced: leaves share what the port leaves them
+ * in round robin, so a leaf's rate is not guaranteed.
+ */
+static int mvpp2_htb_find_leaf(struct mvpp2_port *port, u16 classid)
+{
+	int qid;
+
+	if (!classid)
+		return -ENOENT;
+
+	for (qid = MVPP2_HTB_NREGULAR; qid < port->ntxqs; qid++)
+		if (READ_ONCE(port->htb.leaf[qid]) == classid)
+			return qid;
+
+	return -ENOENT;
+}
+
+static u16 mvpp2_select_queue(struct net_device *dev, struct sk_buff *skb,
+			      struct net_device *sb_dev)
+{
+	struct mvpp2_port *port = netdev_priv(dev);
+	u16 maj_id = READ_ONCE(port->htb.maj_id);
+	int qid = -ENOENT;
+
+	if (likely(!maj_id))
+		return netdev_pick_tx(dev, skb, sb_dev);
+
+	if (TC_H_MAJ(skb->priority) >> 16 == maj_id)
+		qid = mvpp2_htb_find_leaf(port, TC_H_MIN(skb->priority));
+	if (qid < 0)
+		qid = mvpp2_htb_find_leaf(port, READ_ONCE(port->htb.defcls));
+	/* A leaf being deleted may be past the queues still in use */
+	if (qid >= 0 && qid < dev->real_num_tx_queues)
+		return qid;
+
+	return netdev_pick_tx(dev, skb, sb_dev) % MVPP2_HTB_NREGULAR;
+}
+
+static int mvpp2_htb_create(struct mvpp2_port *port, u16 maj_id, u16 defcls,
+			    struct netlink_ext_ack *extack)
+{
+	int err;
+
+	if (port->xdp_prog) {
+		NL_SET_ERR_MSG_MOD(extack, "HTB offload can't be used with XDP");
+		return -EBUSY;
+	}
+
+	if (port->ntxqs <= MVPP2_HTB_NREGULAR) {
+		NL_SET_ERR_MSG_MOD(extack, "Not enough TX queues for HTB offload");
+		return -EOPNOTSUPP;
+	}
+
+	/* Leave only the regular queues to the qdisc, leaves get the rest */
+	err = netif_set_real_num_tx_queues(port->dev, MVPP2_HTB_NREGULAR);
+	if (err)
+		return err;
+
+	memset(&port->htb, 0, sizeof(port->htb));
+	port->htb.defcls = defcls;
+	WRITE_ONCE(port->htb.maj_id, maj_id);
+
+	return 0;
+}
+
+static int mvpp2_htb_destroy(struct mvpp2_port *port)
+{
+	int qid;
+
+	WRITE_ONCE(port->htb.maj_id, 0);
+
+	for (qid = MVPP2_HTB_NREGULAR; qid < port->ntxqs; qid++) {
+		WRITE_ONCE(port->htb.leaf[qid], 0);
+		if (port->txq_rate[qid]) {
+			port->txq_rate[qid] = 0;
+			mvpp2_txq_shaper_set(port, qid);
+		}
+	}
+	if (port->txp_rate) {
+		port->txp_rate = 0;
+		mvpp2_txp_shaper_set(port);
+	}
+	port->htb.nleaves = 0;
+	port->htb.inner = 0;
+
+	return netif_set_real_num_tx_queues(port->dev, port->ntxqs);
+}
+
+static int mvpp2_htb_leaf_alloc(struct mvpp2_port *port,
+				struct tc_htb_qopt_offload *opt)
+{
+	struct mvpp2_htb *htb = &port->htb;
+	unsigned int qid;
+	int err;
+
+	if (opt->parent_classid == TC_HTB_CLASSID_ROOT) {
+		if (htb->inner) {
+			NL_SET_ERR_MSG_MOD(opt->extack,
+					   "The port shaper class must be the only top level class");
+			return -EOPNOTSUPP;
+		}
+	} else if (opt->parent_classid != htb->inner) {
+		NL_SET_ERR_MSG_MOD(opt->extack,
+				   "Only two levels of classes are supported");
+		return -EOPNOTSUPP;
+	}
+
+	qid = MVPP2_HTB_NREGULAR + htb->nleaves;
+	if (qid >= port->ntxqs) {
+		NL_SET_ERR_MSG_MOD(opt->extack, "No TX queue left for a new leaf");
+		return -ENOSPC;
+	}
+
+	err = netif_set_real_num_tx_queues(port->dev, qid + 1);
+	if (err)
+		return err;
+
+	port->txq_rate[qid] = opt->ceil;
+	mvpp2_txq_shaper_set(port, qid);
+	WRITE_ONCE(htb->leaf[qid], opt->classid);
+	htb->nleaves++;
+
+	opt->qid = qid;
+	return 0;
+}
+
+static int mvpp2_htb_leaf_to_inner(struct mvpp2_port *port,
+				   struct tc_htb_qopt_offload *opt)
+{
+	struct mvpp2_htb *htb = &port->htb;
+	int qid;
+
+	qid = mvpp2_htb_find_leaf(port, opt->parent_classid);
+	if (qid < 0)
+		return qid;
+
+	/* The port bucket also limits every other queue */
+	if (htb->inner || htb->nleaves > 1) {
+		NL_SET_ERR_MSG_MOD(opt->extack,
+				   "Only a lone top level class can have children");
+		return -EOPNOTSUPP;
+	}
+
+	port->txp_rate = port->txq_rate[qid];
+	mvpp2_txp_shaper_set(port);
+	htb->inner = opt->parent_classid;
+
+	port->txq_rate[qid] = opt->ceil;
+	mvpp2_txq_shaper_set(port, qid);
+	WRITE_ONCE(htb->leaf[qid], opt->classid);
+
+	opt->qid = qid;
+	return 0;
+}
+
+static int mvpp2_htb_leaf_del(struct mvpp2_port *port,
+			      struct tc_htb_qopt_offload *opt)
+{
+	struct mvpp2_htb *htb = &port->htb;
+	int qid, last;
+
+	qid = mvpp2_htb_find_leaf(port, opt->classid);
+	if (qid < 0)
+		return qid;
+
+	/* Keep the leaves packed: the last one takes over the freed TXQ */
+	last = MVPP2_HTB_NREGULAR + htb->nleaves - 1;
+	if (qid != last) {
+		port->txq_rate[qid] = port->txq_rate[last];
+		mvpp2_txq_shaper_set(port, qid);
+		WRITE_ONCE(htb->leaf[qid], htb->leaf[last]);
+		opt->classid = htb->leaf[last];
+	}
+
+	WRITE_ONCE(htb->leaf[last], 0);
+	port->txq_rate[last] = 0;
+	mvpp2_txq_shaper_set(port, last);
+	htb->nleaves--;
+
+	return netif_set_real_num_tx_queues(port->dev, last);
+}
+
+static int mvpp2_htb_leaf_del_last(struct mvpp2_port *port,
+				   struct tc_htb_qopt_offload *opt)
+{
+	struct mvpp2_htb *htb = &port->htb;
+	int qid;
+
+	qid = mvpp2_htb_find_leaf(port, opt->classid);
+	if (qid < 0)
+		return qid;
+
+	/* The parent is the inner class, it turns back into a leaf on the
+	 * same TXQ, taking the port rate with it.
+	 */
+	port->txq_rate[qid] = port->txp_rate;
+	mvpp2_txq_shaper_set(port, qid);
+	WRITE_ONCE(htb->leaf[qid], htb->inner);
+
+	port->txp_rate = 0;
+	mvpp2_txp_shaper_set(port);
+	htb->inner = 0;
+
+	return 0;
+}
+
+static int mvpp2_htb_node_modify(struct mvpp2_port *port,
+				 struct tc_htb_qopt_offload *opt)
+{
+	int qid;
+
+	if (opt->classid == port->htb.inner) {
+		port->txp_rate = opt->ceil;
+		mvpp2_txp_shaper_set(port);
+		return 0;
+	}
+
+	qid = mvpp2_htb_find_leaf(port, opt->classid);
+	if (qid < 0)
+		return qid;
+
+	port->txq_rate[qid] = opt->ceil;
+	mvpp2_txq_shaper_set(port, qid);
+
+	return 0;
+}
+
+static int mvpp2_setup_tc_htb(struct mvpp2_port *port,
+			      struct tc_htb_qopt_offload *opt)
+{
+	switch (opt->command) {
+	case TC_HTB_CREATE:
+		return mvpp2_htb_create(port, opt->parent_classid,
+					opt->classid, opt->extack);
+	case TC_HTB_DESTROY:
+		return mvpp2_htb_destroy(port);
+	case TC_HTB_LEAF_ALLOC_QUEUE:
+		return mvpp2_htb_leaf_alloc(port, opt);
+	case TC_HTB_LEAF_TO_INNER:
+		return mvpp2_htb_leaf_to_inner(port, opt);
+	case TC_HTB_LEAF_DEL:
+		return mvpp2_htb_leaf_del(port, opt);
+	case TC_HTB_LEAF_DEL_LAST:
+	case TC_HTB_LEAF_DEL_LAST_FORCE:
+		return mvpp2_htb_leaf_del_last(port, opt);
+	case TC_HTB_NODE_MODIFY:
+		return mvpp2_htb_node_modify(port, opt);
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static int mvpp2_setup_tc(struct net_device *dev, enum tc_setup_type type,
+			  void *type_data)
+{
+	struct mvpp2_port *port = netdev_priv(dev);
+
+	switch (type) {
+	case TC_SETUP_QDISC_HTB:
+		return mvpp2_setup_tc_htb(port, type_data);
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
 /* Ethtool methods */
 
 static int mvpp2_ethtool_nway_reset(struct net_device *dev)
@@ -5345,6 +5698,8 @@ static const struct net_device_ops mvpp2_netdev_ops = {
 	.ndo_set_features	= mvpp2_set_features,
 	.ndo_bpf		= mvpp2_xdp,
 	.ndo_xdp_xmit		= mvpp2_xdp_xmit,
+	.ndo_select_queue	= mvpp2_select_queue,
+	.ndo_setup_tc		= mvpp2_setup_tc,
 };
 
 static const struct ethtool_ops mvpp2_eth_tool_ops = {
@@ -6506,7 +6861,7 @@ static int mvpp2_port_probe(struct platform_device *pdev,
 		   NETIF_F_TSO;
 	dev->features = features | NETIF_F_RXCSUM;
 	dev->hw_features |= features | NETIF_F_RXCSUM | NETIF_F_GRO |
-			    NETIF_F_HW_VLAN_CTAG_FILTER;
+			    NETIF_F_HW_VLAN_CTAG_FILTER | NETIF_F_HW_TC;
 
 	if (mvpp22_rss_is_supported()) {
 		dev->hw_features |= NETIF_F_RXHASH;
@@ -48,7 +48,7 @@ struct bpf_reg_state {
 		int range;
 
 		/* valid when type == CONST_PTR_TO_MAP | PTR_TO_MAP_VALUE |
-		 *   PTR_TO_MAP_VALUE_OR_NULL
+		 *   PTR_TO_MAP_VALUE_OR_NULL | PTR_TO_MAP_KEY
 		 */
 		struct bpf_map *map_ptr;
 
@@ -56,6 +56,8 @@ struct bpf_reg_state {
 
 		u32 mem_size; /* for PTR_TO_MEM | PTR_TO_MEM_OR_NULL */
 
+		u32 subprogno; /* for PTR_TO_FUNC */
+
 		/* Max size from any of the above. */
 		unsigned long raw;
 	};
@@ -191,6 +193,14 @@ struct bpf_func_state {
 	 * zero == main subprog
 	 */
 	u32 subprogno;
+	/* Every async callback state pushed by bpf_timer_set_callback()
+	 * starts with the caller's async_entry_cnt + 1. It's used to
+	 * distinguish:
+	 * void foo(void) { for(;;); }
+	 * void foo(void) { bpf_timer_set_callback(,foo); }
+	 */
+	u32 async_entry_cnt;
+	bool in_async_callback_fn;
 
 	/* The following fields should be last. See copy_func_state() */
 	int acquired_refs;
@@ -405,6 +415,7 @@ struct bpf_subprog_info {
 	bool has_tail_call;
 	bool tail_call_reachable;
 	bool has_ld_abs;
+	bool is_async_cb;
 };
 
 /* single container for all structs
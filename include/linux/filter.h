@@ -206,6 +206,12 @@ static inline bool insn_is_zext(const struct bpf_insn *insn)
 #define BPF_LD_MAP_FD(DST, MAP_FD)				\
 	BPF_LD_IMM64_RAW(DST, BPF_PSEUDO_MAP_FD, MAP_FD)
 
+static inline bool bpf_pseudo_func(const struct bpf_insn *insn)
+{
+	return insn->code == (BPF_LD | BPF_IMM | BPF_DW) &&
+	       insn->src_reg == BPF_PSEUDO_FUNC;
+}
+
 /* Short form of mov based on type, BPF_X: dst_reg = src_reg, BPF_K: dst_reg = imm32 */
 
 #define BPF_MOV64_RAW(TYPE, DST, SRC, IMM)			\
@@ -534,6 +540,7 @@ struct sock_fprog_kern {
 
 struct bpf_binary_header {
 	u32 pages;
+	u32 size;	/* in bytes, for images in a bpf_prog_pack */
 	u8 image[] __aligned(BPF_IMAGE_ALIGNMENT);
 };
 
@@ -1008,6 +1015,22 @@ bpf_jit_binary_alloc(unsigned int proglen, u8 **image_ptr,
 		     bpf_jit_fill_hole_t bpf_fill_ill_insns);
 void bpf_jit_binary_free(struct bpf_binary_header *hdr);
 u64 bpf_jit_alloc_exec_limit(void);
+
+void *bpf_arch_text_copy(void *dst, void *src, size_t len);
+int bpf_arch_text_invalidate(void *dst, size_t len);
+
+struct bpf_binary_header *
+bpf_jit_binary_pack_alloc(unsigned int proglen, u8 **ro_image,
+			  unsigned int alignment,
+			  struct bpf_binary_header **rw_hdr,
+			  u8 **rw_image,
+			  bpf_jit_fill_hole_t bpf_fill_ill_insns);
+int bpf_jit_binary_pack_finalize(struct bpf_binary_header *ro_hdr,
+				 struct bpf_binary_header *rw_hdr);
+void bpf_jit_binary_pack_free(struct bpf_binary_header *ro_hdr,
+			      struct bpf_binary_header *rw_hdr);
+struct bpf_binary_header *bpf_jit_binary_pack_hdr(const struct bpf_prog *fp);
+
 void *bpf_jit_alloc_exec(unsigned long size);
 void bpf_jit_free_exec(void *addr);
 void bpf_jit_free(struct bpf_prog *fp);
@@ -315,8 +315,18 @@ struct gro_list {
 /*
  * size of gro hash buckets, must less than bit number of
  * napi_struct::gro_bitmask
+ * Only the first gro_hash_buckets of them are in use; the bound keeps
+ * the table embedded in napi_struct small.
  */
-#define GRO_HASH_BUCKETS	8
+#define GRO_HASH_BUCKETS	16
+
+struct napi_gro_stats {
+	u64	held;		/* packets starting a new GRO chain */
+	u64	merged;		/* packets merged into a held chain */
+	u64	normal;		/* packets passed up without GRO */
+	u64	evicted;	/* chains completed early, bucket was full */
+	u64	aged;		/* chains completed because of their age */
+};
 
 /*
  * Structure for NAPI scheduling similar to tasklet but with weighting
@@ -343,10 +353,12 @@ struct napi_struct {
 	struct sk_buff		*skb;
 	struct list_head	rx_list; /* Pending GRO_NORMAL skbs */
 	int			rx_count; /* length of rx_list */
+	u32			gro_hash_mask; /* buckets in use - 1 */
 	struct hrtimer		timer;
 	struct list_head	dev_list;
 	struct hlist_node	napi_hash_node;
 	unsigned int		napi_id;
+	struct napi_gro_stats	gro_stats;
 };
 
 enum {
@@ -866,6 +878,7 @@ enum tc_setup_type {
 	TC_SETUP_QDISC_ETS,
 	TC_SETUP_QDISC_TBF,
 	TC_SETUP_QDISC_FIFO,
+	TC_SETUP_QDISC_HTB,
 };
 
 /* These structures hold the attributes of bpf state that are being passed
@@ -1834,6 +1847,10 @@ enum netdev_ml_priv_type {
  *	@gso_max_size:	Maximum size of generic segmentation offload
  *	@gso_max_segs:	Maximum number of segments that can be passed to the
  *			NIC for GSO
+ *	@tso_max_size:	Device (as in HW) limit on the max TSO request size,
+ *			@gso_max_size can't be raised above it
+ *	@gro_max_size:	Maximum size of aggregated packet in generic
+ *			receive offload (GRO)
  *
  *	@dcbnl_ops:	Data Center Bridging netlink ops
  *	@num_tc:	Number of traffic classes in the net device
@@ -2151,10 +2168,19 @@ struct net_device {
 	const struct rtnl_link_ops *rtnl_link_ops;
 
 	/* for setting kernel sock attribute on TCP connection setup */
-#define GSO_MAX_SIZE		65536
+#define GSO_LEGACY_MAX_SIZE	65536u
+/* IPv6 jumbograms let TCP go past the 16-bit payload length, see
+ * ipv6_hopopt_jumbo_remove().  Keep the skb within MAX_SKB_FRAGS worth of
+ * page frags.
+ */
+#define GSO_MAX_SIZE		(8 * GSO_LEGACY_MAX_SIZE)
 	unsigned int		gso_max_size;
+	unsigned int		tso_max_size;
 #define GSO_MAX_SEGS		65535
 	u16			gso_max_segs;
+#define GRO_LEGACY_MAX_SIZE	65536u
+#define GRO_MAX_SIZE		(8 * GRO_LEGACY_MAX_SIZE)
+	unsigned int		gro_max_size;
 
 #ifdef CONFIG_DCB
 	const struct dcbnl_rtnl_ops *dcbnl_ops;
@@ -4584,6 +4610,10 @@ extern int		dev_weight_tx_bias;
 extern int		dev_rx_weight;
 extern int		dev_tx_weight;
 extern int		gro_normal_batch;
+extern int		gro_hash_buckets;
+extern int		gro_max_skbs;
+extern int		gro_flush_age;
+extern int		gro_sw_hash;
 
 enum {
 	NESTED_SYNC_IMM_BIT,
@@ -4909,7 +4939,33 @@ static inline bool netif_needs_gso(struct sk_buff *skb,
 static inline void netif_set_gso_max_size(struct net_device *dev,
 					  unsigned int size)
 {
-	dev->gso_max_size = size;
+	/* dev->gso_max_size is read locklessly from sk_setup_caps() */
+	WRITE_ONCE(dev->gso_max_size, size);
+}
+
+/**
+ *	netif_set_tso_max_size - set the max size of TSO frames supported
+ *	@dev:	netdev to update
+ *	@size:	max skb->len of a TSO frame
+ *
+ *	Set the limit on the size of TSO super-frames the device can handle.
+ *	Drivers which strip the IPv6 jumbo hop-by-hop header on transmit,
+ *	see ipv6_hopopt_jumbo_remove(), may go up to %GSO_MAX_SIZE.
+ *	Lowers the current gso_max_size if needed.
+ */
+static inline void netif_set_tso_max_size(struct net_device *dev,
+					  unsigned int size)
+{
+	dev->tso_max_size = min_t(unsigned int, size, GSO_MAX_SIZE);
+	if (dev->gso_max_size > dev->tso_max_size)
+		netif_set_gso_max_size(dev, dev->tso_max_size);
+}
+
+static inline void netif_set_gro_max_size(struct net_device *dev,
+					  unsigned int size)
+{
+	/* This pairs with the READ_ONCE() in skb_gro_receive() */
+	WRITE_ONCE(dev->gro_max_size, size);
 }
 
 static inline void skb_gso_error_unwind(struct sk_buff *skb, __be16 protocol,
@@ -228,6 +228,7 @@ struct tcp_sock {
 		unused:5;
 	u32	chrono_start;	/* Start time in jiffies of a TCP chrono */
 	u32	chrono_stat[3];	/* Time in jiffies for chrono_stat stats */
+	u8	defer_type;	/* current reason sends are deferred */
 	u8	chrono_type:2,	/* current chronograph type */
 		rate_app_limited:1,  /* rate_{delivered,interval_us} limited? */
 		fastopen_connect:1, /* FASTOPEN_CONNECT sockopt */
@@ -412,6 +413,11 @@ struct tcp_sock {
 	 */
 	struct request_sock __rcu *fastopen_rsk;
 	struct saved_syn *saved_syn;
+
+/* Send deferral accounting, only touched when the reason changes */
+	u32	defer_start;	/* Start time in jiffies of a send deferral */
+	u32	defer_stat[6];	/* Time in jiffies deferred, per reason */
+	u32	defer_events[6]; /* Deferral episodes, per reason */
 };
 
 enum tsq_enum {
@@ -52,6 +52,7 @@ struct udp_sock {
 					   * this
 					   */
 			 gro_enabled:1,	/* Request GRO aggregation */
+			 gro_fraglist:1, /* Request fraglist GRO aggregation */
 			 accept_udp_l4:1,
 			 accept_udp_fraglist:1;
 	/*
@@ -120,15 +121,28 @@ static inline bool udp_get_no_check6_rx(struct sock *sk)
 	return udp_sk(sk)->no_check6_rx;
 }
 
+void udp_cmsg_recv_fraglist(struct msghdr *msg, struct sk_buff *skb);
+
 static inline void udp_cmsg_recv(struct msghdr *msg, struct sock *sk,
 				 struct sk_buff *skb)
 {
 	int gso_size;
 
+	/* fraglist packets also carry SKB_GSO_UDP_L4 */
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_FRAGLIST) {
+		udp_cmsg_recv_fraglist(msg, skb);
+		return;
+	}
+
 	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4) {
 		gso_size = skb_shinfo(skb)->gso_size;
 		put_cmsg(msg, SOL_UDP, UDP_GRO, sizeof(gso_size), &gso_size);
+		return;
 	}
+
+	/* a lone datagram is a fraglist of one */
+	if (udp_sk(sk)->gro_fraglist)
+		udp_cmsg_recv_fraglist(msg, skb);
 }
 
 static inline bool udp_unexpected_gso(struct sock *sk, struct sk_buff *skb)
@@ -136,10 +150,11 @@ static inline bool udp_unexpected_gso(struct sock *sk, struct sk_buff *skb)
 	if (!skb_is_gso(skb))
 		return false;
 
-	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4 && !udp_sk(sk)->accept_udp_l4)
-		return true;
+	/* fraglist packets also carry SKB_GSO_UDP_L4 */
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_FRAGLIST)
+		return !udp_sk(sk)->accept_udp_fraglist;
 
-	if (skb_shinfo(skb)->gso_type & SKB_GSO_FRAGLIST && !udp_sk(sk)->accept_udp_fraglist)
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4 && !udp_sk(sk)->accept_udp_l4)
 		return true;
 
 	return false;
@@ -307,6 +307,12 @@ static inline bool INET_MATCH(struct net *net, const struct sock *sk,
 /* Sockets in TCP_CLOSE state are _always_ taken out of the hash, so we need
  * not check it for lookups anymore, thanks Alexey. -DaveM
  */
+struct inet_ehash_bucket *inet_ehash_prefetch(const struct net *net,
+					      struct inet_hashinfo *hashinfo,
+					      const __be32 saddr,
+					      const __be16 sport,
+					      const __be32 daddr,
+					      const u16 hnum);
 struct sock *__inet_lookup_established(struct net *net,
 				       struct inet_hashinfo *hashinfo,
 				       const __be32 saddr, const __be16 sport,
@@ -19,6 +19,7 @@
 #include <net/fib_rules.h>
 #include <net/inetpeer.h>
 #include <linux/percpu.h>
+#include <linux/jump_label.h>
 #include <linux/notifier.h>
 #include <linux/refcount.h>
 
@@ -302,8 +303,9 @@ static inline struct fib_table *fib_new_table(struct net *net, u32 id)
 	return fib_get_table(net, id);
 }
 
-static inline int fib_lookup(struct net *net, const struct flowi4 *flp,
-			     struct fib_result *res, unsigned int flags)
+static inline int fib_lookup_uncached(struct net *net,
+				      const struct flowi4 *flp,
+				      struct fib_result *res, unsigned int flags)
 {
 	struct fib_table *tb;
 	int err = -ENETUNREACH;
@@ -360,8 +362,8 @@ struct fib_table *fib_get_table(struct net *net, u32 id);
 int __fib_lookup(struct net *net, struct flowi4 *flp,
 		 struct fib_result *res, unsigned int flags);
 
-static inline int fib_lookup(struct net *net, struct flowi4 *flp,
-			     struct fib_result *res, unsigned int flags)
+static inline int fib_lookup_uncached(struct net *net, struct flowi4 *flp,
+				      struct fib_result *res, unsigned int flags)
 {
 	struct fib_table *tb;
 	int err = -ENETUNREACH;
@@ -424,6 +426,34 @@ static inline bool fib4_rules_early_flow_dissect(struct net *net,
 
 #endif /* CONFIG_IP_MULTIPLE_TABLES */
 
+/* Optional per-CPU cache of fib_lookup() results, see fib_frontend.c.
+ * Entries are tagged with a generation built from rt_genid_ipv4() and
+ * fib_lookup_cache_genid; the latter must be bumped before any object a
+ * cached fib_result may point to is handed to RCU for freeing.
+ */
+DECLARE_STATIC_KEY_FALSE(fib_lookup_cache_key);
+extern atomic_t fib_lookup_cache_genid;
+
+int fib_lookup_cached(struct net *net, struct flowi4 *flp,
+		      struct fib_result *res, unsigned int flags);
+int fib_lookup_cache_enable(struct net *net);
+void fib_lookup_cache_free(struct net *net);
+
+static inline void fib_lookup_cache_invalidate(void)
+{
+	smp_mb__before_atomic();
+	atomic_inc(&fib_lookup_cache_genid);
+}
+
+static inline int fib_lookup(struct net *net, struct flowi4 *flp,
+			     struct fib_result *res, unsigned int flags)
+{
+	if (static_branch_unlikely(&fib_lookup_cache_key))
+		return fib_lookup_cached(net, flp, res, flags);
+
+	return fib_lookup_uncached(net, flp, res, flags);
+}
+
 /* Exported by fib_frontend.c */
 extern const struct nla_policy rtm_ipv4_policy[];
 void ip_fib_init(void);
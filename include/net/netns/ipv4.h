@@ -17,6 +17,7 @@ struct ipv4_devconf;
 struct fib_rules_ops;
 struct hlist_head;
 struct fib_table;
+struct fib_lookup_cache;
 struct sock;
 struct local_ports {
 	seqlock_t	lock;
@@ -65,6 +66,8 @@ struct netns_ipv4 {
 #endif
 	struct hlist_head	*fib_table_hash;
 	bool			fib_offload_disabled;
+	int			sysctl_fib_lookup_cache;
+	struct fib_lookup_cache __percpu *fib_lookup_cache;
 	struct sock		*fibnl;
 
 	struct sock  * __percpu	*icmp_sk;
@@ -122,8 +122,10 @@ static inline bool nexthop_get(struct nexthop *nh)
 
 static inline void nexthop_put(struct nexthop *nh)
 {
-	if (refcount_dec_and_test(&nh->refcnt))
+	if (refcount_dec_and_test(&nh->refcnt)) {
+		fib_lookup_cache_invalidate();
 		call_rcu(&nh->rcu, nexthop_free_rcu);
+	}
 }
 
 static inline bool nexthop_cmp(const struct nexthop *nh1,
@@ -979,4 +979,42 @@ struct tc_fifo_qopt_offload {
 	};
 };
 
+enum tc_htb_command {
+	/* Root */
+	TC_HTB_CREATE, /* Initialize HTB offload. */
+	TC_HTB_DESTROY, /* Destroy HTB offload. */
+
+	/* Classes */
+	/* Allocate qid and create leaf. */
+	TC_HTB_LEAF_ALLOC_QUEUE,
+	/* Convert leaf to inner, preserve and return qid, create new leaf. */
+	TC_HTB_LEAF_TO_INNER,
+	/* Delete leaf, while siblings remain. */
+	TC_HTB_LEAF_DEL,
+	/* Delete leaf, convert parent to leaf, preserving qid. */
+	TC_HTB_LEAF_DEL_LAST,
+	/* TC_HTB_LEAF_DEL_LAST, but delete driver data on hardware errors. */
+	TC_HTB_LEAF_DEL_LAST_FORCE,
+	/* Modify parameters of a node. */
+	TC_HTB_NODE_MODIFY,
+};
+
+/* TC_HTB_CREATE is issued before the qdisc sizes its set of direct
+ * queues, so the driver may shrink real_num_tx_queues there to reserve
+ * queues for leaves; it grows it again as leaf qids are handed out.
+ * On TC_HTB_LEAF_DEL the driver may move the leaf owning the highest qid
+ * into the freed one, and then reports that leaf's classid back.
+ */
+struct tc_htb_qopt_offload {
+	struct netlink_ext_ack *extack;
+	enum tc_htb_command command;
+	u16 classid;
+	u32 parent_classid;
+	u16 qid;
+	u64 rate;	/* bytes per second */
+	u64 ceil;	/* bytes per second */
+};
+
+#define TC_HTB_CLASSID_ROOT U32_MAX
+
 #endif
@@ -282,7 +282,8 @@ struct bpf_local_storage;
   *	@sk_route_forced_caps: static, forced route capabilities
   *		(set in tcp_init_sock())
   *	@sk_gso_type: GSO type (e.g. %SKB_GSO_TCPV4)
-  *	@sk_gso_max_size: Maximum GSO segment size to build
+  *	@sk_gso_max_size: Maximum GSO segment size to build, excluding
+  *			  MAX_TCP_HEADER
   *	@sk_gso_max_segs: Maximum number of GSO segments
   *	@sk_pacing_shift: scaling factor for TCP Small Queues
   *	@sk_lingertime: %SO_LINGER l_linger setting
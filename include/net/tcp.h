@@ -309,6 +309,7 @@ int tcp_v4_err(struct sk_buff *skb, u32);
 void tcp_shutdown(struct sock *sk, int how);
 
 int tcp_v4_early_demux(struct sk_buff *skb);
+void tcp_v4_early_demux_prefetch(struct net *net, struct list_head *head);
 int tcp_v4_rcv(struct sk_buff *skb);
 
 int tcp_v4_tw_remember_stamp(struct inet_timewait_sock *tw);
@@ -1751,6 +1752,21 @@ enum tcp_chrono {
 void tcp_chrono_start(struct sock *sk, const enum tcp_chrono type);
 void tcp_chrono_stop(struct sock *sk, const enum tcp_chrono type);
 
+/* Why tcp_write_xmit() or tcp_push() held back data that was queued */
+enum tcp_defer {
+	TCP_DEFER_NONE,
+	TCP_DEFER_TSO, /* tcp_tso_should_defer() waits for a bigger burst */
+	TCP_DEFER_TSQ, /* TCP Small Queues limit reached */
+	TCP_DEFER_CWND, /* No room in the congestion window */
+	TCP_DEFER_RWND, /* No room in the peer's receive window */
+	TCP_DEFER_PACING, /* Pacing timer armed */
+	TCP_DEFER_AUTOCORK, /* Autocorking waits for a TX completion */
+	__TCP_DEFER_MAX,
+};
+
+void tcp_defer_start(struct sock *sk, const enum tcp_defer type);
+void tcp_defer_stop(struct sock *sk);
+
 /* This helper is needed, because skb->tcp_tsorted_anchor uses
  * the same memory storage than skb->destructor/_skb_refdst
  */
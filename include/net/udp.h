@@ -181,6 +181,8 @@ void udp_v6_early_demux(struct sk_buff *skb);
 struct sk_buff *__udp_gso_segment(struct sk_buff *gso_skb,
 				  netdev_features_t features, bool is_ipv6);
 
+#define UDP_GRO_CNT_MAX 64
+
 static inline struct udphdr *udp_gro_udphdr(struct sk_buff *skb)
 {
 	struct udphdr *uh;
@@ -283,6 +283,74 @@ TRACE_EVENT(tcp_probe,
 		  __entry->srtt, __entry->rcv_wnd, __entry->sock_cookie)
 );
 
+TRACE_DEFINE_ENUM(TCP_DEFER_NONE);
+TRACE_DEFINE_ENUM(TCP_DEFER_TSO);
+TRACE_DEFINE_ENUM(TCP_DEFER_TSQ);
+TRACE_DEFINE_ENUM(TCP_DEFER_CWND);
+TRACE_DEFINE_ENUM(TCP_DEFER_RWND);
+TRACE_DEFINE_ENUM(TCP_DEFER_PACING);
+TRACE_DEFINE_ENUM(TCP_DEFER_AUTOCORK);
+
+#define show_tcp_defer_type(val)			\
+	__print_symbolic(val,				\
+		{ TCP_DEFER_NONE, "none" },		\
+		{ TCP_DEFER_TSO, "tso" },		\
+		{ TCP_DEFER_TSQ, "tsq" },		\
+		{ TCP_DEFER_CWND, "cwnd" },		\
+		{ TCP_DEFER_RWND, "rwnd" },		\
+		{ TCP_DEFER_PACING, "pacing" },		\
+		{ TCP_DEFER_AUTOCORK, "autocork" })
+
+/* Fired every time queued data is held back, not only when a deferral
+ * episode starts, so that each decision can be attributed.
+ */
+TRACE_EVENT(tcp_defer,
+
+	TP_PROTO(const struct sock *sk, int type),
+
+	TP_ARGS(sk, type),
+
+	TP_STRUCT__entry(
+		/* sockaddr_in6 is always bigger than sockaddr_in */
+		__array(__u8, saddr, sizeof(struct sockaddr_in6))
+		__array(__u8, daddr, sizeof(struct sockaddr_in6))
+		__field(__u16, sport)
+		__field(__u16, dport)
+		__field(int, type)
+		__field(__u32, snd_cwnd)
+		__field(__u32, in_flight)
+		__field(__u32, snd_wnd)
+		__field(__u32, wmem_alloc)
+		__field(__u64, pacing_ns)
+	),
+
+	TP_fast_assign(
+		const struct inet_sock *inet = inet_sk(sk);
+		const struct tcp_sock *tp = tcp_sk(sk);
+
+		memset(__entry->saddr, 0, sizeof(struct sockaddr_in6));
+		memset(__entry->daddr, 0, sizeof(struct sockaddr_in6));
+
+		TP_STORE_ADDR_PORTS(__entry, inet, sk);
+
+		__entry->sport = ntohs(inet->inet_sport);
+		__entry->dport = ntohs(inet->inet_dport);
+		__entry->type = type;
+		__entry->snd_cwnd = tp->snd_cwnd;
+		__entry->in_flight = tcp_packets_in_flight(tp);
+		__entry->snd_wnd = tp->snd_wnd;
+		__entry->wmem_alloc = refcount_read(&sk->sk_wmem_alloc);
+		__entry->pacing_ns = tp->tcp_wstamp_ns > tp->tcp_clock_cache ?
+				     tp->tcp_wstamp_ns - tp->tcp_clock_cache : 0;
+	),
+
+	TP_printk("src=%pISpc dest=%pISpc reason=%s snd_cwnd=%u in_flight=%u snd_wnd=%u wmem_alloc=%u pacing_ns=%llu",
+		  __entry->saddr, __entry->daddr,
+		  show_tcp_defer_type(__entry->type),
+		  __entry->snd_cwnd, __entry->in_flight, __entry->snd_wnd,
+		  __entry->wmem_alloc, __entry->pacing_ns)
+);
+
 #endif /* _TRACE_TCP_H */
 
 /* This part must be outside protection */
@@ -284,6 +284,22 @@ struct tcp_info {
 	__u32	tcpi_snd_wnd;	     /* peer's advertised receive window after
 				      * scaling (bytes)
 				      */
+
+	/* Episodes of queued data held back, by reason */
+	__u32	tcpi_defer_tso;      /* TSO autosizing waited for more data */
+	__u32	tcpi_defer_tsq;      /* TCP Small Queues limit reached */
+	__u32	tcpi_defer_cwnd;     /* Congestion window full */
+	__u32	tcpi_defer_rwnd;     /* Receive window full */
+	__u32	tcpi_defer_pacing;   /* Waiting for the pacing timer */
+	__u32	tcpi_defer_autocork; /* Autocorked until TX completion */
+
+	/* Time (usec) queued data was held back, by reason */
+	__u64	tcpi_defer_tso_time;
+	__u64	tcpi_defer_tsq_time;
+	__u64	tcpi_defer_cwnd_time;
+	__u64	tcpi_defer_rwnd_time;
+	__u64	tcpi_defer_pacing_time;
+	__u64	tcpi_defer_autocork_time;
 };
 
 /* netlink attributes types for SCM_TIMESTAMPING_OPT_STATS */
@@ -343,6 +359,7 @@ struct tcp_diag_md5sig {
 
 /* setsockopt(fd, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE, ...) */
 
+#define TCP_RECEIVE_ZEROCOPY_FLAG_TLB_CLEAN_HINT 0x1
 struct tcp_zerocopy_receive {
 	__u64 address;		/* in: address of mapping */
 	__u32 length;		/* in/out: number of bytes to map/mapped */
@@ -351,5 +368,10 @@ struct tcp_zerocopy_receive {
 	__s32 err; /* out: socket error */
 	__u64 copybuf_address;	/* in: copybuf address (small reads) */
 	__s32 copybuf_len; /* in/out: copybuf bytes avail/used or error */
+	__u32 flags; /* in: flags */
+	__u64 msg_control; /* ancillary data */
+	__u64 msg_controllen;
+	__u32 msg_flags;
+	__u32 reserved; /* set to 0 for now */
 };
 #endif /* _UAPI_LINUX_TCP_H */
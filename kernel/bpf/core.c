@@ -396,6 +396,13 @@ static int bpf_adj_branches(struct bpf_prog *prog, u32 pos, s32 end_old,
 			insn = prog->insnsi + end_old;
 		}
 		code = insn->code;
+		if (bpf_pseudo_func(insn)) {
+			ret = bpf_adj_delta_to_imm(insn, pos, end_old,
+						   end_new, i, probe_pass);
+			if (ret)
+				break;
+			continue;
+		}
 		if ((BPF_CLASS(code) != BPF_JMP &&
 		     BPF_CLASS(code) != BPF_JMP32) ||
 		    BPF_OP(code) == BPF_EXIT)
@@ -535,13 +542,10 @@ long bpf_jit_limit_max __read_mostly;
 static void
 bpf_prog_ksym_set_addr(struct bpf_prog *prog)
 {
-	const struct bpf_binary_header *hdr = bpf_jit_binary_hdr(prog);
-	unsigned long addr = (unsigned long)hdr;
-
 	WARN_ON_ONCE(!bpf_prog_ebpf_jited(prog));
 
 	prog->aux->ksym.start = (unsigned long) prog->bpf_func;
-	prog->aux->ksym.end   = addr + hdr->pages * PAGE_SIZE;
+	prog->aux->ksym.end   = prog->aux->ksym.start + prog->jited_len;
 }
 
 static void
@@ -831,12 +835,11 @@ static int __init bpf_jit_charge_init(void)
 }
 pure_initcall(bpf_jit_charge_init);
 
-int bpf_jit_charge_modmem(u32 pages)
+int bpf_jit_charge_modmem(u32 size)
 {
-	if (atomic_long_add_return(pages, &bpf_jit_current) >
-	    (bpf_jit_limit >> PAGE_SHIFT)) {
+	if (atomic_long_add_return(size, &bpf_jit_current) > bpf_jit_limit) {
 		if (!bpf_capable()) {
-			atomic_long_sub(pages, &bpf_jit_current);
+			atomic_long_sub(size, &bpf_jit_current);
 			return -EPERM;
 		}
 	}
@@ -844,9 +847,9 @@ int bpf_jit_charge_modmem(u32 pages)
 	return 0;
 }
 
-void bpf_jit_uncharge_modmem(u32 pages)
+void bpf_jit_uncharge_modmem(u32 size)
 {
-	atomic_long_sub(pages, &bpf_jit_current);
+	atomic_long_sub(size, &bpf_jit_current);
 }
 
 void *__weak bpf_jit_alloc_exec(unsigned long size)
@@ -877,11 +880,11 @@ bpf_jit_binary_alloc(unsigned int proglen, u8 **image_ptr,
 	size = round_up(proglen + sizeof(*hdr) + 128, PAGE_SIZE);
 	pages = size / PAGE_SIZE;
 
-	if (bpf_jit_charge_modmem(pages))
+	if (bpf_jit_charge_modmem(size))
 		return NULL;
 	hdr = bpf_jit_alloc_exec(size);
 	if (!hdr) {
-		bpf_jit_uncharge_modmem(pages);
+		bpf_jit_uncharge_modmem(size);
 		return NULL;
 	}
 
@@ -901,10 +904,234 @@ bpf_jit_binary_alloc(unsigned int proglen, u8 **image_ptr,
 
 void bpf_jit_binary_free(struct bpf_binary_header *hdr)
 {
-	u32 pages = hdr->pages;
+	u32 size = hdr->pages * PAGE_SIZE;
 
 	bpf_jit_free_exec(hdr);
-	bpf_jit_uncharge_modmem(pages);
+	bpf_jit_uncharge_modmem(size);
+}
+
+/* bpf_prog_pack: JITed images of many programs share one executable
+ * region, carved into BPF_PROG_CHUNK_SIZE chunks. Small programs no
+ * longer take a page each, so they stay close together in the iTLB and
+ * the region's permissions are changed once instead of per program.
+ *
+ * The region is read-only from the start; JITs build the image in a
+ * temporary rw buffer and copy it in with bpf_arch_text_copy().
+ */
+#define BPF_PROG_PACK_SIZE	SZ_2M
+#define BPF_PROG_CHUNK_SHIFT	6
+#define BPF_PROG_CHUNK_SIZE	(1 << BPF_PROG_CHUNK_SHIFT)
+#define BPF_PROG_CHUNK_MASK	(~(BPF_PROG_CHUNK_SIZE - 1))
+#define BPF_PROG_CHUNK_COUNT	(BPF_PROG_PACK_SIZE / BPF_PROG_CHUNK_SIZE)
+
+struct bpf_prog_pack {
+	struct list_head list;
+	void *ptr;
+	unsigned long bitmap[BITS_TO_LONGS(BPF_PROG_CHUNK_COUNT)];
+};
+
+#define BPF_PROG_SIZE_TO_NBITS(size)	(round_up(size, BPF_PROG_CHUNK_SIZE) / BPF_PROG_CHUNK_SIZE)
+
+static DEFINE_MUTEX(pack_mutex);
+static LIST_HEAD(pack_list);
+
+static void bpf_prog_pack_lock_ro(void *ptr, u32 size)
+{
+	set_vm_flush_reset_perms(ptr);
+	set_memory_ro((unsigned long)ptr, size >> PAGE_SHIFT);
+	set_memory_x((unsigned long)ptr, size >> PAGE_SHIFT);
+}
+
+static struct bpf_prog_pack *
+bpf_prog_pack_new(bpf_jit_fill_hole_t bpf_fill_ill_insns)
+{
+	struct bpf_prog_pack *pack;
+
+	pack = kzalloc(sizeof(*pack), GFP_KERNEL);
+	if (!pack)
+		return NULL;
+	pack->ptr = bpf_jit_alloc_exec(BPF_PROG_PACK_SIZE);
+	if (!pack->ptr) {
+		kfree(pack);
+		return NULL;
+	}
+	bpf_fill_ill_insns(pack->ptr, BPF_PROG_PACK_SIZE);
+	bpf_prog_pack_lock_ro(pack->ptr, BPF_PROG_PACK_SIZE);
+	list_add_tail(&pack->list, &pack_list);
+	return pack;
+}
+
+static void *bpf_prog_pack_alloc(u32 size,
+				 bpf_jit_fill_hole_t bpf_fill_ill_insns)
+{
+	unsigned int nbits = BPF_PROG_SIZE_TO_NBITS(size);
+	struct bpf_prog_pack *pack;
+	unsigned long pos;
+	void *ptr = NULL;
+
+	/* large programs gain nothing from sharing, give them their own */
+	if (size > BPF_PROG_PACK_SIZE / 2) {
+		size = round_up(size, PAGE_SIZE);
+		ptr = bpf_jit_alloc_exec(size);
+		if (ptr) {
+			bpf_fill_ill_insns(ptr, size);
+			bpf_prog_pack_lock_ro(ptr, size);
+		}
+		return ptr;
+	}
+
+	mutex_lock(&pack_mutex);
+	list_for_each_entry(pack, &pack_list, list) {
+		pos = bitmap_find_next_zero_area(pack->bitmap,
+						 BPF_PROG_CHUNK_COUNT, 0,
+						 nbits, 0);
+		if (pos < BPF_PROG_CHUNK_COUNT)
+			goto found;
+	}
+
+	pack = bpf_prog_pack_new(bpf_fill_ill_insns);
+	if (!pack)
+		goto out;
+	pos = 0;
+found:
+	bitmap_set(pack->bitmap, pos, nbits);
+	ptr = pack->ptr + (pos << BPF_PROG_CHUNK_SHIFT);
+out:
+	mutex_unlock(&pack_mutex);
+	return ptr;
+}
+
+static void bpf_prog_pack_free(struct bpf_binary_header *hdr)
+{
+	struct bpf_prog_pack *pack = NULL, *tmp;
+	unsigned int nbits;
+	unsigned long pos;
+
+	if (hdr->size > BPF_PROG_PACK_SIZE / 2) {
+		bpf_jit_free_exec(hdr);
+		return;
+	}
+
+	mutex_lock(&pack_mutex);
+	list_for_each_entry(tmp, &pack_list, list) {
+		if ((void *)hdr >= tmp->ptr &&
+		    (void *)hdr < tmp->ptr + BPF_PROG_PACK_SIZE) {
+			pack = tmp;
+			break;
+		}
+	}
+	if (WARN_ONCE(!pack, "bpf_prog_pack bug\n"))
+		goto out;
+
+	nbits = BPF_PROG_SIZE_TO_NBITS(hdr->size);
+	pos = ((unsigned long)hdr - (unsigned long)pack->ptr) >>
+	      BPF_PROG_CHUNK_SHIFT;
+
+	/* leave no stale code behind for the next user of the chunks */
+	WARN_ONCE(bpf_arch_text_invalidate(hdr, hdr->size),
+		  "bpf_prog_pack bug: missing bpf_arch_text_invalidate?\n");
+
+	bitmap_clear(pack->bitmap, pos, nbits);
+	if (bitmap_empty(pack->bitmap, BPF_PROG_CHUNK_COUNT)) {
+		list_del(&pack->list);
+		bpf_jit_free_exec(pack->ptr);
+		kfree(pack);
+	}
+out:
+	mutex_unlock(&pack_mutex);
+}
+
+/* Allocate a JITed image in a bpf_prog_pack. The JIT writes the image
+ * through *rw_image, but computes addresses against *ro_image, where the
+ * image runs once bpf_jit_binary_pack_finalize() has copied it over.
+ */
+struct bpf_binary_header *
+bpf_jit_binary_pack_alloc(unsigned int proglen, u8 **ro_image,
+			  unsigned int alignment,
+			  struct bpf_binary_header **rw_hdr,
+			  u8 **rw_image,
+			  bpf_jit_fill_hole_t bpf_fill_ill_insns)
+{
+	struct bpf_binary_header *ro_hdr;
+	u32 size, hole, start;
+
+	WARN_ON_ONCE(!is_power_of_2(alignment) ||
+		     alignment > BPF_IMAGE_ALIGNMENT);
+
+	/* Leave at least 16 bytes for a random section of illegal
+	 * instructions in front of the program.
+	 */
+	size = round_up(proglen + sizeof(*ro_hdr) + 16, BPF_PROG_CHUNK_SIZE);
+
+	if (bpf_jit_charge_modmem(size))
+		return NULL;
+	ro_hdr = bpf_prog_pack_alloc(size, bpf_fill_ill_insns);
+	if (!ro_hdr) {
+		bpf_jit_uncharge_modmem(size);
+		return NULL;
+	}
+
+	*rw_hdr = kvmalloc(size, GFP_KERNEL);
+	if (!*rw_hdr) {
+		bpf_arch_text_copy(&ro_hdr->size, &size, sizeof(size));
+		bpf_prog_pack_free(ro_hdr);
+		bpf_jit_uncharge_modmem(size);
+		return NULL;
+	}
+
+	/* Fill space with illegal/arch-dep instructions. */
+	bpf_fill_ill_insns(*rw_hdr, size);
+	(*rw_hdr)->pages = 0;
+	(*rw_hdr)->size = size;
+
+	hole = min_t(unsigned int, size - (proglen + sizeof(*ro_hdr)),
+		     BPF_PROG_CHUNK_SIZE - sizeof(*ro_hdr));
+	start = (get_random_int() % hole) & ~(alignment - 1);
+
+	*ro_image = &ro_hdr->image[start];
+	*rw_image = &(*rw_hdr)->image[start];
+
+	return ro_hdr;
+}
+
+/* Copy the finished image into place and release the rw buffer. On error
+ * the image is freed as well.
+ */
+int bpf_jit_binary_pack_finalize(struct bpf_binary_header *ro_hdr,
+				 struct bpf_binary_header *rw_hdr)
+{
+	void *ptr;
+
+	ptr = bpf_arch_text_copy(ro_hdr, rw_hdr, rw_hdr->size);
+
+	kvfree(rw_hdr);
+
+	if (IS_ERR(ptr)) {
+		bpf_jit_binary_pack_free(ro_hdr, NULL);
+		return PTR_ERR(ptr);
+	}
+	return 0;
+}
+
+/* ro_hdr->size must be valid, i.e. the image must have been finalized or
+ * the size copied over, before it can be freed.
+ */
+void bpf_jit_binary_pack_free(struct bpf_binary_header *ro_hdr,
+			      struct bpf_binary_header *rw_hdr)
+{
+	u32 size = ro_hdr->size;
+
+	bpf_prog_pack_free(ro_hdr);
+	kvfree(rw_hdr);
+	bpf_jit_uncharge_modmem(size);
+}
+
+struct bpf_binary_header *
+bpf_jit_binary_pack_hdr(const struct bpf_prog *fp)
+{
+	unsigned long real_start = (unsigned long)fp->bpf_func;
+
+	return (void *)(real_start & BPF_PROG_CHUNK_MASK);
 }
 
 /* This symbol is only overridden by archs that have different
@@ -1153,6 +1380,16 @@ struct bpf_prog *bpf_jit_blind_constants(struct bpf_prog *prog)
 	insn = clone->insnsi;
 
 	for (i = 0; i < insn_cnt; i++, insn++) {
+		if (bpf_pseudo_func(insn)) {
+			/* ld_imm64 with an address of bpf subprog is not
+			 * a user controlled constant. Don't randomize it,
+			 * since it will conflict with jit_subprogs() logic.
+			 */
+			insn++;
+			i++;
+			continue;
+		}
+
 		/* We temporarily need to hold the original ld64 insn
 		 * so that we can still access the first part in the
 		 * second blinding run.
@@ -2338,6 +2575,16 @@ int __weak skb_copy_bits(const struct sk_buff *skb, int offset, void *to,
 	return -EFAULT;
 }
 
+void * __weak bpf_arch_text_copy(void *dst, void *src, size_t len)
+{
+	return ERR_PTR(-ENOTSUPP);
+}
+
+int __weak bpf_arch_text_invalidate(void *dst, size_t len)
+{
+	return -ENOTSUPP;
+}
+
 int __weak bpf_arch_text_poke(void *ip, enum bpf_text_poke_type t,
 			      void *addr1, void *addr2)
 {
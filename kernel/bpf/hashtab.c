@@ -3,11 +3,14 @@
  * Copyright (c) 2016 Facebook
  */
 #include <linux/bpf.h>
+#include <linux/bitrev.h>
 #include <linux/btf.h>
 #include <linux/jhash.h>
 #include <linux/filter.h>
+#include <linux/irq_work.h>
 #include <linux/rculist_nulls.h>
 #include <linux/random.h>
+#include <linux/workqueue.h>
 #include <uapi/linux/btf.h>
 #include <linux/rcupdate_trace.h>
 #include "percpu_freelist.h"
@@ -16,7 +19,11 @@
 
 #define HTAB_CREATE_FLAG_MASK						\
 	(BPF_F_NO_PREALLOC | BPF_F_NO_COMMON_LRU | BPF_F_NUMA_NODE |	\
-	 BPF_F_ACCESS_MASK | BPF_F_ZERO_SEED)
+	 BPF_F_ACCESS_MASK | BPF_F_ZERO_SEED | BPF_F_RESIZABLE)
+
+/* resizable maps start with this many buckets and grow from there */
+#define HTAB_RESIZE_MIN_BUCKETS	64
+#define HTAB_RESIZE_RETRY	HZ	/* backoff after a failed resize */
 
 #define BATCH_OPS(_name)			\
 	.map_lookup_batch =			\
@@ -86,9 +93,42 @@ struct bucket {
 	};
 };
 
+/*
+ * The buckets live in a bucket_table. Only BPF_F_RESIZABLE maps ever
+ * replace their table: once there are more elements than buckets, a
+ * worker builds a table with more buckets and publishes it with RCU.
+ *
+ * Elements of a resizable map carry a second list node after the value,
+ * and each table links its elements through one of the two nodes
+ * (->node_off). That lets an element sit in the old and the new table at
+ * the same time, so whichever table a reader picked up is complete and
+ * lookups never need to consult a second table.
+ *
+ * The worker links the elements of old bucket i into the new table with
+ * the lock of bucket i held, and then moves ->rehash past i. A writer
+ * whose bucket is below ->rehash applies its change to both tables,
+ * taking the new bucket lock nested inside the old one. When every bucket
+ * has been linked the worker sets ->migrated and cycles all old bucket
+ * locks; from then on writers only touch the new table. Finally the new
+ * table is published and the old one freed after a grace period.
+ *
+ * Iterators over a resizable map walk the buckets in bit-reversed order
+ * and keep their position as a bit-reversed hash. Growing the table splits
+ * a bucket into buckets that are adjacent in that order, so a position
+ * stays valid across resizes, see htab_walk_bucket().
+ */
+struct bucket_table {
+	struct bucket_table __rcu *future;	/* table being built by a resize */
+	u32 n_buckets;	/* number of hash buckets */
+	u32 node_off;	/* offset of the list node used by this table */
+	u32 rehash;	/* number of buckets linked into @future */
+	bool migrated;	/* @future is complete, writers must switch to it */
+	struct bucket buckets[];
+};
+
 struct bpf_htab {
 	struct bpf_map map;
-	struct bucket *buckets;
+	struct bucket_table __rcu *tbl;
 	void *elems;
 	union {
 		struct pcpu_freelist freelist;
@@ -96,9 +136,13 @@ struct bpf_htab {
 	};
 	struct htab_elem *__percpu *extra_elems;
 	atomic_t count;	/* number of elements in this hashtable */
-	u32 n_buckets;	/* number of hash buckets */
 	u32 elem_size;	/* size of each element in bytes */
 	u32 hashrnd;
+	u32 alt_node_off;	/* offset of the second list node, if resizable */
+	u32 max_buckets;	/* resizable tables do not grow past this */
+	unsigned long resize_retry;	/* jiffies, after a failed resize */
+	struct irq_work resize_irq_work;
+	struct work_struct resize_work;
 };
 
 /* each htab element is struct htab_elem + key + value */
@@ -132,19 +176,129 @@ static inline bool htab_use_raw_lock(const struct bpf_htab *htab)
 	return (!IS_ENABLED(CONFIG_PREEMPT_RT) || htab_is_prealloc(htab));
 }
 
-static void htab_init_buckets(struct bpf_htab *htab)
+static inline bool htab_is_resizable(const struct bpf_htab *htab)
+{
+	return htab->map.map_flags & BPF_F_RESIZABLE;
+}
+
+static struct bucket_table *htab_tbl_alloc(const struct bpf_htab *htab,
+					   u32 n_buckets, u32 node_off)
 {
+	struct bucket_table *tbl;
 	unsigned i;
 
-	for (i = 0; i < htab->n_buckets; i++) {
-		INIT_HLIST_NULLS_HEAD(&htab->buckets[i].head, i);
+	tbl = bpf_map_area_alloc(struct_size(tbl, buckets, n_buckets),
+				 htab->map.numa_node);
+	if (!tbl)
+		return NULL;
+
+	tbl->n_buckets = n_buckets;
+	tbl->node_off = node_off;
+
+	for (i = 0; i < n_buckets; i++) {
+		INIT_HLIST_NULLS_HEAD(&tbl->buckets[i].head, i);
 		if (htab_use_raw_lock(htab))
-			raw_spin_lock_init(&htab->buckets[i].raw_lock);
+			raw_spin_lock_init(&tbl->buckets[i].raw_lock);
 		else
-			spin_lock_init(&htab->buckets[i].lock);
+			spin_lock_init(&tbl->buckets[i].lock);
 	}
+
+	return tbl;
+}
+
+static u32 htab_tbl_pages(u32 n_buckets)
+{
+	struct bucket_table *tbl;
+
+	return round_up(struct_size(tbl, buckets, n_buckets), PAGE_SIZE) >>
+	       PAGE_SHIFT;
+}
+
+/* Only resizable maps replace their table, and the old one is freed
+ * after a grace period, so any RCU flavour the map is used under will do.
+ */
+static inline struct bucket_table *htab_tbl(const struct bpf_htab *htab)
+{
+	return rcu_dereference_raw(htab->tbl);
+}
+
+/* The table lookups walk. Once a resize marks the next table migrated,
+ * writers change only that one, so readers must follow it even before
+ * it is published in htab->tbl. Writers go through htab_lock_hash().
+ */
+static inline struct bucket_table *htab_read_tbl(const struct bpf_htab *htab)
+{
+	struct bucket_table *tbl = htab_tbl(htab);
+
+	if (unlikely(READ_ONCE(tbl->migrated)))
+		tbl = rcu_dereference_raw(tbl->future);
+	return tbl;
+}
+
+/* Bucket of @tbl at walk position @pos. Other maps never resize and
+ * simply walk the buckets by index.
+ */
+static inline u32 htab_walk_bucket(const struct bpf_htab *htab,
+				   const struct bucket_table *tbl, u32 pos)
+{
+	if (!htab_is_resizable(htab))
+		return pos;
+	return bitrev32(pos) & (tbl->n_buckets - 1);
+}
+
+/* One past the last walk position. A resizable table has fewer than
+ * 2^32 buckets, so U32_MAX never starts a bucket and can mark the end.
+ */
+static inline u32 htab_walk_end(const struct bpf_htab *htab,
+				const struct bucket_table *tbl)
+{
+	return htab_is_resizable(htab) ? U32_MAX : tbl->n_buckets;
+}
+
+/* Walk position of the bucket after the one @pos is in */
+static inline u32 htab_walk_next(const struct bpf_htab *htab,
+				 const struct bucket_table *tbl, u32 pos)
+{
+	u32 last;
+
+	if (!htab_is_resizable(htab))
+		return pos + 1;
+
+	last = pos | (U32_MAX >> ilog2(tbl->n_buckets));
+	return last == U32_MAX ? U32_MAX : last + 1;
 }
 
+static inline struct hlist_nulls_node *
+htab_elem_node(const struct bucket_table *tbl, struct htab_elem *l)
+{
+	return (void *)l + tbl->node_off;
+}
+
+static inline struct htab_elem *
+htab_node_elem(const struct bucket_table *tbl, struct hlist_nulls_node *n)
+{
+	return (void *)n - tbl->node_off;
+}
+
+static inline struct htab_elem *
+htab_node_elem_safe(const struct bucket_table *tbl, struct hlist_nulls_node *n)
+{
+	return !is_a_nulls(n) ? htab_node_elem(tbl, n) : NULL;
+}
+
+/* like hlist_nulls_for_each_entry_rcu(), through the node used by @tbl */
+#define htab_tbl_for_each_entry_rcu(tbl, l, n, head)			\
+	for (n = rcu_dereference_raw(hlist_nulls_first_rcu(head));	\
+	     !is_a_nulls(n) && ({ l = htab_node_elem(tbl, n); 1; });	\
+	     n = rcu_dereference_raw(hlist_nulls_next_rcu(n)))
+
+/* like hlist_nulls_for_each_entry_safe(), @n already points past @l */
+#define htab_tbl_for_each_entry_safe(tbl, l, n, head)			\
+	for (n = rcu_dereference_raw(hlist_nulls_first_rcu(head));	\
+	     !is_a_nulls(n) &&						\
+	     ({ l = htab_node_elem(tbl, n);				\
+		n = rcu_dereference_raw(hlist_nulls_next_rcu(n)); 1; });)
+
 static inline unsigned long htab_lock_bucket(const struct bpf_htab *htab,
 					     struct bucket *b)
 {
@@ -167,7 +321,30 @@ static inline void htab_unlock_bucket(const struct bpf_htab *htab,
 		spin_unlock_irqrestore(&b->lock, flags);
 }
 
+/* Lock a bucket of the table being built by a resize. The caller holds
+ * the matching bucket lock of the current table, so interrupts are off.
+ */
+static inline void htab_lock_bucket_nested(const struct bpf_htab *htab,
+					   struct bucket *b)
+{
+	if (htab_use_raw_lock(htab))
+		raw_spin_lock_nested(&b->raw_lock, SINGLE_DEPTH_NESTING);
+	else
+		spin_lock_nested(&b->lock, SINGLE_DEPTH_NESTING);
+}
+
+static inline void htab_unlock_bucket_nested(const struct bpf_htab *htab,
+					     struct bucket *b)
+{
+	if (htab_use_raw_lock(htab))
+		raw_spin_unlock(&b->raw_lock);
+	else
+		spin_unlock(&b->lock);
+}
+
 static bool htab_lru_map_delete_node(void *arg, struct bpf_lru_node *node);
+static void htab_resize_irq_work(struct irq_work *work);
+static void htab_resize_work(struct work_struct *work);
 
 static bool htab_is_lru(const struct bpf_htab *htab)
 {
@@ -353,12 +530,15 @@ static int htab_map_alloc_check(union bpf_attr *attr)
 	bool percpu_lru = (attr->map_flags & BPF_F_NO_COMMON_LRU);
 	bool prealloc = !(attr->map_flags & BPF_F_NO_PREALLOC);
 	bool zero_seed = (attr->map_flags & BPF_F_ZERO_SEED);
+	bool resizable = (attr->map_flags & BPF_F_RESIZABLE);
 	int numa_node = bpf_map_attr_numa_node(attr);
 
 	BUILD_BUG_ON(offsetof(struct htab_elem, htab) !=
 		     offsetof(struct htab_elem, hash_node.pprev));
 	BUILD_BUG_ON(offsetof(struct htab_elem, fnode.next) !=
 		     offsetof(struct htab_elem, hash_node.pprev));
+	/* tables that never resize link through hash_node at offset 0 */
+	BUILD_BUG_ON(offsetof(struct htab_elem, hash_node) != 0);
 
 	if (lru && !bpf_capable())
 		/* LRU implementation is much complicated than other
@@ -383,6 +563,13 @@ static int htab_map_alloc_check(union bpf_attr *attr)
 	if (numa_node != NUMA_NO_NODE && (percpu || percpu_lru))
 		return -EINVAL;
 
+	/* Preallocated maps already pay for max_entries elements up front,
+	 * growing only the buckets buys them nothing.
+	 */
+	if (resizable &&
+	    (attr->map_type != BPF_MAP_TYPE_HASH || prealloc))
+		return -EINVAL;
+
 	/* check sanity of attributes.
 	 * value_size == 0 may be allowed in the future to use map as a set
 	 */
@@ -421,7 +608,10 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 	 */
 	bool percpu_lru = (attr->map_flags & BPF_F_NO_COMMON_LRU);
 	bool prealloc = !(attr->map_flags & BPF_F_NO_PREALLOC);
+	bool resizable = (attr->map_flags & BPF_F_RESIZABLE);
+	struct bucket_table *tbl;
 	struct bpf_htab *htab;
+	u32 n_buckets;
 	u64 cost;
 	int err;
 
@@ -444,7 +634,10 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 	}
 
 	/* hash table size must be power of 2 */
-	htab->n_buckets = roundup_pow_of_two(htab->map.max_entries);
+	n_buckets = roundup_pow_of_two(htab->map.max_entries);
+	htab->max_buckets = n_buckets;
+	if (resizable)
+		n_buckets = min_t(u32, n_buckets, HTAB_RESIZE_MIN_BUCKETS);
 
 	htab->elem_size = sizeof(struct htab_elem) +
 			  round_up(htab->map.key_size, 8);
@@ -453,13 +646,21 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 	else
 		htab->elem_size += round_up(htab->map.value_size, 8);
 
+	if (resizable) {
+		htab->alt_node_off = htab->elem_size;
+		htab->elem_size += sizeof(struct hlist_nulls_node);
+		init_irq_work(&htab->resize_irq_work, htab_resize_irq_work);
+		INIT_WORK(&htab->resize_work, htab_resize_work);
+	}
+
 	err = -E2BIG;
 	/* prevent zero size kmalloc and check for u32 overflow */
-	if (htab->n_buckets == 0 ||
-	    htab->n_buckets > U32_MAX / sizeof(struct bucket))
+	if (n_buckets == 0 ||
+	    htab->max_buckets > U32_MAX / sizeof(struct bucket))
 		goto free_htab;
 
-	cost = (u64) htab->n_buckets * sizeof(struct bucket) +
+	/* resizable maps charge the buckets as the table grows */
+	cost = (u64) n_buckets * sizeof(struct bucket) +
 	       (u64) htab->elem_size * htab->map.max_entries;
 
 	if (percpu)
@@ -474,19 +675,16 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 		goto free_htab;
 
 	err = -ENOMEM;
-	htab->buckets = bpf_map_area_alloc(htab->n_buckets *
-					   sizeof(struct bucket),
-					   htab->map.numa_node);
-	if (!htab->buckets)
+	tbl = htab_tbl_alloc(htab, n_buckets, 0);
+	if (!tbl)
 		goto free_charge;
+	RCU_INIT_POINTER(htab->tbl, tbl);
 
 	if (htab->map.map_flags & BPF_F_ZERO_SEED)
 		htab->hashrnd = 0;
 	else
 		htab->hashrnd = get_random_int();
 
-	htab_init_buckets(htab);
-
 	if (prealloc) {
 		err = prealloc_init(htab);
 		if (err)
@@ -507,7 +705,7 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 free_prealloc:
 	prealloc_destroy(htab);
 free_buckets:
-	bpf_map_area_free(htab->buckets);
+	bpf_map_area_free(tbl);
 free_charge:
 	bpf_map_charge_finish(&htab->map.memory);
 free_htab:
@@ -520,24 +718,25 @@ static inline u32 htab_map_hash(const void *key, u32 key_len, u32 hashrnd)
 	return jhash(key, key_len, hashrnd);
 }
 
-static inline struct bucket *__select_bucket(struct bpf_htab *htab, u32 hash)
+static inline struct bucket *__select_bucket(struct bucket_table *tbl, u32 hash)
 {
-	return &htab->buckets[hash & (htab->n_buckets - 1)];
+	return &tbl->buckets[hash & (tbl->n_buckets - 1)];
 }
 
-static inline struct hlist_nulls_head *select_bucket(struct bpf_htab *htab, u32 hash)
+static inline struct hlist_nulls_head *select_bucket(struct bucket_table *tbl, u32 hash)
 {
-	return &__select_bucket(htab, hash)->head;
+	return &__select_bucket(tbl, hash)->head;
 }
 
 /* this lookup function can only be called with bucket lock taken */
-static struct htab_elem *lookup_elem_raw(struct hlist_nulls_head *head, u32 hash,
+static struct htab_elem *lookup_elem_raw(struct bucket_table *tbl,
+					 struct hlist_nulls_head *head, u32 hash,
 					 void *key, u32 key_size)
 {
 	struct hlist_nulls_node *n;
 	struct htab_elem *l;
 
-	hlist_nulls_for_each_entry_rcu(l, n, head, hash_node)
+	htab_tbl_for_each_entry_rcu(tbl, l, n, head)
 		if (l->hash == hash && !memcmp(&l->key, key, key_size))
 			return l;
 
@@ -548,24 +747,206 @@ static struct htab_elem *lookup_elem_raw(struct hlist_nulls_head *head, u32 hash
  * the unlikely event when elements moved from one bucket into another
  * while link list is being walked
  */
-static struct htab_elem *lookup_nulls_elem_raw(struct hlist_nulls_head *head,
+static struct htab_elem *lookup_nulls_elem_raw(struct bucket_table *tbl,
+					       struct hlist_nulls_head *head,
 					       u32 hash, void *key,
-					       u32 key_size, u32 n_buckets)
+					       u32 key_size)
 {
 	struct hlist_nulls_node *n;
 	struct htab_elem *l;
 
 again:
-	hlist_nulls_for_each_entry_rcu(l, n, head, hash_node)
+	htab_tbl_for_each_entry_rcu(tbl, l, n, head)
 		if (l->hash == hash && !memcmp(&l->key, key, key_size))
 			return l;
 
-	if (unlikely(get_nulls_value(n) != (hash & (n_buckets - 1))))
+	if (unlikely(get_nulls_value(n) != (hash & (tbl->n_buckets - 1))))
 		goto again;
 
 	return NULL;
 }
 
+/* Lock the bucket @hash belongs to. If a resize has finished building
+ * the next table, move on to it: its buckets are the ones that count now.
+ */
+static struct bucket *htab_lock_hash(struct bpf_htab *htab, u32 hash,
+				     struct bucket_table **ptbl,
+				     unsigned long *pflags)
+{
+	struct bucket_table *tbl = htab_tbl(htab), *future;
+	struct bucket *b;
+
+	for (;;) {
+		b = __select_bucket(tbl, hash);
+		*pflags = htab_lock_bucket(htab, b);
+		future = rcu_dereference_raw(tbl->future);
+		if (likely(!future || !READ_ONCE(tbl->migrated)))
+			break;
+		htab_unlock_bucket(htab, b, *pflags);
+		tbl = future;
+	}
+
+	*ptbl = tbl;
+	return b;
+}
+
+/* With the bucket of @hash locked, return the table that has to see
+ * the same changes, if a resize already linked this bucket into it.
+ */
+static struct bucket_table *htab_mirror_tbl(struct bucket_table *tbl, u32 hash)
+{
+	struct bucket_table *future = rcu_dereference_raw(tbl->future);
+
+	if (likely(!future))
+		return NULL;
+	if ((hash & (tbl->n_buckets - 1)) >= READ_ONCE(tbl->rehash))
+		return NULL;
+	return future;
+}
+
+/* add @l to the head of its bucket in @tbl, whose lock is held, so that
+ * concurrent search will find it before an old elem with the same key
+ */
+static void htab_link_elem(struct bpf_htab *htab, struct bucket_table *tbl,
+			   struct htab_elem *l)
+{
+	struct bucket_table *mirror = htab_mirror_tbl(tbl, l->hash);
+	struct bucket *b;
+
+	hlist_nulls_add_head_rcu(htab_elem_node(tbl, l),
+				 select_bucket(tbl, l->hash));
+	if (unlikely(mirror)) {
+		b = __select_bucket(mirror, l->hash);
+		htab_lock_bucket_nested(htab, b);
+		hlist_nulls_add_head_rcu(htab_elem_node(mirror, l), &b->head);
+		htab_unlock_bucket_nested(htab, b);
+	}
+}
+
+static void htab_unlink_elem(struct bpf_htab *htab, struct bucket_table *tbl,
+			     struct htab_elem *l)
+{
+	struct bucket_table *mirror = htab_mirror_tbl(tbl, l->hash);
+	struct bucket *b;
+
+	hlist_nulls_del_rcu(htab_elem_node(tbl, l));
+	if (unlikely(mirror)) {
+		b = __select_bucket(mirror, l->hash);
+		htab_lock_bucket_nested(htab, b);
+		hlist_nulls_del_rcu(htab_elem_node(mirror, l));
+		htab_unlock_bucket_nested(htab, b);
+	}
+}
+
+/* Called from eBPF program or syscall after an element was added */
+static void htab_check_grow(struct bpf_htab *htab)
+{
+	struct bucket_table *tbl = htab_tbl(htab);
+	unsigned long retry;
+
+	if (atomic_read(&htab->count) <= tbl->n_buckets ||
+	    tbl->n_buckets >= htab->max_buckets ||
+	    rcu_access_pointer(tbl->future))
+		return;
+
+	retry = READ_ONCE(htab->resize_retry);
+	if (unlikely(retry)) {
+		if (time_before(jiffies, retry))
+			return;
+		WRITE_ONCE(htab->resize_retry, 0);
+	}
+
+	/* the update may run with a bucket lock or the rq lock held,
+	 * so leave queueing the work to irq_work
+	 */
+	irq_work_queue(&htab->resize_irq_work);
+}
+
+static void htab_resize_irq_work(struct irq_work *work)
+{
+	struct bpf_htab *htab = container_of(work, struct bpf_htab,
+					     resize_irq_work);
+
+	schedule_work(&htab->resize_work);
+}
+
+static void htab_resize_work(struct work_struct *work)
+{
+	struct bpf_htab *htab = container_of(work, struct bpf_htab,
+					     resize_work);
+	struct bucket_table *tbl, *new_tbl;
+	u32 n_buckets, pages, max_buckets;
+	struct hlist_nulls_node *n;
+	unsigned long flags;
+	struct htab_elem *l;
+	struct bucket *b;
+	u32 i;
+
+	/* this work is the only one replacing htab->tbl */
+	tbl = rcu_dereference_protected(htab->tbl, 1);
+	max_buckets = htab->max_buckets;
+
+	n_buckets = tbl->n_buckets;
+	while (n_buckets < max_buckets &&
+	       atomic_read(&htab->count) > n_buckets)
+		n_buckets <<= 1;
+	if (n_buckets == tbl->n_buckets)
+		return;
+
+	pages = htab_tbl_pages(n_buckets) - htab_tbl_pages(tbl->n_buckets);
+	if (bpf_map_charge_memlock(&htab->map, pages))
+		goto no_grow;
+
+	new_tbl = htab_tbl_alloc(htab, n_buckets,
+				 tbl->node_off ? 0 : htab->alt_node_off);
+	if (!new_tbl) {
+		bpf_map_uncharge_memlock(&htab->map, pages);
+		goto no_grow;
+	}
+
+	rcu_assign_pointer(tbl->future, new_tbl);
+
+	/* The new buckets an old bucket splits into are only written by
+	 * writers mirroring into them, and those hold the old bucket's lock.
+	 * So the old lock alone covers the copy, which is then no more work
+	 * with IRQs off than an update walking the same chain.
+	 */
+	for (i = 0; i < tbl->n_buckets; i++) {
+		b = &tbl->buckets[i];
+		flags = htab_lock_bucket(htab, b);
+		htab_tbl_for_each_entry_rcu(tbl, l, n, &b->head)
+			hlist_nulls_add_head_rcu(htab_elem_node(new_tbl, l),
+						 select_bucket(new_tbl, l->hash));
+		WRITE_ONCE(tbl->rehash, i + 1);
+		htab_unlock_bucket(htab, b, flags);
+		cond_resched();
+	}
+
+	/* From here on readers use new_tbl, see htab_read_tbl(), and
+	 * writers move to it once they hold their bucket lock in tbl.
+	 * Writers that took that lock before seeing ->migrated may still
+	 * update both tables. Wait for them before new_tbl becomes visible
+	 * to writers that never look at tbl.
+	 */
+	WRITE_ONCE(tbl->migrated, true);
+	for (i = 0; i < tbl->n_buckets; i++) {
+		b = &tbl->buckets[i];
+		flags = htab_lock_bucket(htab, b);
+		htab_unlock_bucket(htab, b, flags);
+	}
+
+	rcu_assign_pointer(htab->tbl, new_tbl);
+	synchronize_rcu();
+	bpf_map_area_free(tbl);
+	return;
+
+no_grow:
+	/* Out of memory or memlock: keep working with longer chains for a
+	 * while rather than retrying on every update.
+	 */
+	WRITE_ONCE(htab->resize_retry, (jiffies + HTAB_RESIZE_RETRY) ?: 1);
+}
+
 /* Called from syscall or from eBPF program directly, so
  * arguments have to match bpf_map_lookup_elem() exactly.
  * The return value is adjusted by BPF instructions
@@ -575,6 +956,7 @@ static void *__htab_map_lookup_elem(struct bpf_map *map, void *key)
 {
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
 	struct hlist_nulls_head *head;
+	struct bucket_table *tbl;
 	struct htab_elem *l;
 	u32 hash, key_size;
 
@@ -584,9 +966,11 @@ static void *__htab_map_lookup_elem(struct bpf_map *map, void *key)
 
 	hash = htab_map_hash(key, key_size, htab->hashrnd);
 
-	head = select_bucket(htab, hash);
+	tbl = htab_read_tbl(htab);
+
+	head = select_bucket(tbl, hash);
 
-	l = lookup_nulls_elem_raw(head, hash, key, key_size, htab->n_buckets);
+	l = lookup_nulls_elem_raw(tbl, head, hash, key, key_size);
 
 	return l;
 }
@@ -676,6 +1060,14 @@ static int htab_lru_map_gen_lookup(struct bpf_map *map,
 	return insn - insn_buf;
 }
 
+static void check_and_free_timer(struct bpf_htab *htab, struct htab_elem *elem)
+{
+	if (unlikely(map_value_has_timer(&htab->map)))
+		bpf_timer_cancel_and_free(elem->key +
+					  round_up(htab->map.key_size, 8) +
+					  htab->map.timer_off);
+}
+
 /* It is called from the bpf_lru_list when the LRU needs to delete
  * older elements from the htab.
  */
@@ -689,7 +1081,7 @@ static bool htab_lru_map_delete_node(void *arg, struct bpf_lru_node *node)
 	struct bucket *b;
 
 	tgt_l = container_of(node, struct htab_elem, lru_node);
-	b = __select_bucket(htab, tgt_l->hash);
+	b = __select_bucket(htab_tbl(htab), tgt_l->hash);
 	head = &b->head;
 
 	flags = htab_lock_bucket(htab, b);
@@ -697,6 +1089,7 @@ static bool htab_lru_map_delete_node(void *arg, struct bpf_lru_node *node)
 	hlist_nulls_for_each_entry_rcu(l, n, head, hash_node)
 		if (l == tgt_l) {
 			hlist_nulls_del_rcu(&l->hash_node);
+			check_and_free_timer(htab, l);
 			break;
 		}
 
@@ -705,35 +1098,101 @@ static bool htab_lru_map_delete_node(void *arg, struct bpf_lru_node *node)
 	return l == tgt_l;
 }
 
+/* Order of elements in a walk over a resizable map: by bit-reversed
+ * hash, which sorts them by bucket for every table size, then by key.
+ */
+static int htab_walk_cmp(const struct htab_elem *l, u32 rev, const void *key,
+			 u32 key_size)
+{
+	u32 l_rev = bitrev32(l->hash);
+
+	if (l_rev != rev)
+		return l_rev < rev ? -1 : 1;
+	return memcmp(l->key, key, key_size);
+}
+
+/* The key after @key in walk order, or the first key if @key is NULL.
+ * The order does not depend on the table size, so keys are neither
+ * skipped nor returned twice when the map grows between two calls.
+ */
+static int htab_resizable_get_next_key(struct bpf_htab *htab, void *key,
+				       void *next_key)
+{
+	struct bucket_table *tbl = htab_read_tbl(htab);
+	u32 key_size = htab->map.key_size;
+	struct hlist_nulls_head *head;
+	struct hlist_nulls_node *n;
+	struct htab_elem *l, *next_l;
+	u32 pos = 0, rev = 0, i;
+
+	if (key) {
+		rev = bitrev32(htab_map_hash(key, key_size, htab->hashrnd));
+		pos = rev;
+	}
+
+	do {
+		i = htab_walk_bucket(htab, tbl, pos);
+		head = select_bucket(tbl, i);
+again:
+		next_l = NULL;
+		htab_tbl_for_each_entry_rcu(tbl, l, n, head) {
+			if (key && htab_walk_cmp(l, rev, key, key_size) <= 0)
+				continue;
+			if (!next_l ||
+			    htab_walk_cmp(l, bitrev32(next_l->hash),
+					  next_l->key, key_size) < 0)
+				next_l = l;
+		}
+		/* an element moved to another bucket under us */
+		if (unlikely(get_nulls_value(n) != i))
+			goto again;
+
+		if (next_l) {
+			memcpy(next_key, next_l->key, key_size);
+			return 0;
+		}
+
+		/* later buckets only hold elements after @key */
+		key = NULL;
+		pos = htab_walk_next(htab, tbl, pos);
+	} while (pos != htab_walk_end(htab, tbl));
+
+	return -ENOENT;
+}
+
 /* Called from syscall */
 static int htab_map_get_next_key(struct bpf_map *map, void *key, void *next_key)
 {
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
 	struct hlist_nulls_head *head;
 	struct htab_elem *l, *next_l;
+	struct bucket_table *tbl;
 	u32 hash, key_size;
 	int i = 0;
 
 	WARN_ON_ONCE(!rcu_read_lock_held());
 
+	if (htab_is_resizable(htab))
+		return htab_resizable_get_next_key(htab, key, next_key);
+
 	key_size = map->key_size;
+	tbl = htab_tbl(htab);
 
 	if (!key)
 		goto find_first_elem;
 
 	hash = htab_map_hash(key, key_size, htab->hashrnd);
 
-	head = select_bucket(htab, hash);
+	head = select_bucket(tbl, hash);
 
 	/* lookup the key */
-	l = lookup_nulls_elem_raw(head, hash, key, key_size, htab->n_buckets);
+	l = lookup_nulls_elem_raw(tbl, head, hash, key, key_size);
 
 	if (!l)
 		goto find_first_elem;
 
 	/* key was found, get next key in the same bucket */
-	next_l = hlist_nulls_entry_safe(rcu_dereference_raw(hlist_nulls_next_rcu(&l->hash_node)),
-				  struct htab_elem, hash_node);
+	next_l = htab_node_elem_safe(tbl, rcu_dereference_raw(hlist_nulls_next_rcu(htab_elem_node(tbl, l))));
 
 	if (next_l) {
 		/* if next elem in this hash list is non-zero, just return it */
@@ -742,17 +1201,16 @@ static int htab_map_get_next_key(struct bpf_map *map, void *key, void *next_key)
 	}
 
 	/* no more elements in this hash list, go to the next bucket */
-	i = hash & (htab->n_buckets - 1);
+	i = hash & (tbl->n_buckets - 1);
 	i++;
 
 find_first_elem:
 	/* iterate over buckets */
-	for (; i < htab->n_buckets; i++) {
-		head = select_bucket(htab, i);
+	for (; i < tbl->n_buckets; i++) {
+		head = select_bucket(tbl, i);
 
 		/* pick first element in the bucket */
-		next_l = hlist_nulls_entry_safe(rcu_dereference_raw(hlist_nulls_first_rcu(head)),
-					  struct htab_elem, hash_node);
+		next_l = htab_node_elem_safe(tbl, rcu_dereference_raw(hlist_nulls_first_rcu(head)));
 		if (next_l) {
 			/* if it's not empty, just return it */
 			memcpy(next_key, next_l->key, key_size);
@@ -792,6 +1250,7 @@ static void htab_put_fd_value(struct bpf_htab *htab, struct htab_elem *l)
 
 static void free_htab_elem(struct bpf_htab *htab, struct htab_elem *l)
 {
+	check_and_free_timer(htab, l);
 	htab_put_fd_value(htab, l);
 
 	if (htab_is_prealloc(htab)) {
@@ -897,8 +1356,8 @@ static struct htab_elem *alloc_htab_elem(struct bpf_htab *htab, void *key,
 			l_new = ERR_PTR(-ENOMEM);
 			goto dec_count;
 		}
-		check_and_init_map_lock(&htab->map,
-					l_new->key + round_up(key_size, 8));
+		check_and_init_map_value(&htab->map,
+					 l_new->key + round_up(key_size, 8));
 	}
 
 	memcpy(l_new->key, key, key_size);
@@ -937,6 +1396,12 @@ static struct htab_elem *alloc_htab_elem(struct bpf_htab *htab, void *key,
 	return l_new;
 }
 
+static void htab_lru_push_free(struct bpf_htab *htab, struct htab_elem *elem)
+{
+	check_and_free_timer(htab, elem);
+	bpf_lru_push_free(&htab->lru, &elem->lru_node);
+}
+
 static int check_flags(struct bpf_htab *htab, struct htab_elem *l_old,
 		       u64 map_flags)
 {
@@ -957,7 +1422,7 @@ static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
 {
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
 	struct htab_elem *l_new = NULL, *l_old;
-	struct hlist_nulls_head *head;
+	struct bucket_table *tbl;
 	unsigned long flags;
 	struct bucket *b;
 	u32 key_size, hash;
@@ -973,15 +1438,13 @@ static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
 
 	hash = htab_map_hash(key, key_size, htab->hashrnd);
 
-	b = __select_bucket(htab, hash);
-	head = &b->head;
-
 	if (unlikely(map_flags & BPF_F_LOCK)) {
 		if (unlikely(!map_value_has_spin_lock(map)))
 			return -EINVAL;
 		/* find an element without taking the bucket lock */
-		l_old = lookup_nulls_elem_raw(head, hash, key, key_size,
-					      htab->n_buckets);
+		tbl = htab_read_tbl(htab);
+		l_old = lookup_nulls_elem_raw(tbl, select_bucket(tbl, hash),
+					      hash, key, key_size);
 		ret = check_flags(htab, l_old, map_flags);
 		if (ret)
 			return ret;
@@ -998,9 +1461,9 @@ static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
 		 */
 	}
 
-	flags = htab_lock_bucket(htab, b);
+	b = htab_lock_hash(htab, hash, &tbl, &flags);
 
-	l_old = lookup_elem_raw(head, hash, key, key_size);
+	l_old = lookup_elem_raw(tbl, &b->head, hash, key, key_size);
 
 	ret = check_flags(htab, l_old, map_flags);
 	if (ret)
@@ -1028,18 +1491,19 @@ static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
 		goto err;
 	}
 
-	/* add new element to the head of the list, so that
-	 * concurrent search will find it before old elem
-	 */
-	hlist_nulls_add_head_rcu(&l_new->hash_node, head);
+	htab_link_elem(htab, tbl, l_new);
 	if (l_old) {
-		hlist_nulls_del_rcu(&l_old->hash_node);
+		htab_unlink_elem(htab, tbl, l_old);
 		if (!htab_is_prealloc(htab))
 			free_htab_elem(htab, l_old);
+		else
+			check_and_free_timer(htab, l_old);
 	}
 	ret = 0;
 err:
 	htab_unlock_bucket(htab, b, flags);
+	if (htab_is_resizable(htab) && !ret && !l_old)
+		htab_check_grow(htab);
 	return ret;
 }
 
@@ -1049,6 +1513,7 @@ static int htab_lru_map_update_elem(struct bpf_map *map, void *key, void *value,
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
 	struct htab_elem *l_new, *l_old = NULL;
 	struct hlist_nulls_head *head;
+	struct bucket_table *tbl;
 	unsigned long flags;
 	struct bucket *b;
 	u32 key_size, hash;
@@ -1064,7 +1529,8 @@ static int htab_lru_map_update_elem(struct bpf_map *map, void *key, void *value,
 
 	hash = htab_map_hash(key, key_size, htab->hashrnd);
 
-	b = __select_bucket(htab, hash);
+	tbl = htab_tbl(htab);
+	b = __select_bucket(tbl, hash);
 	head = &b->head;
 
 	/* For LRU, we need to alloc before taking bucket's
@@ -1075,11 +1541,12 @@ static int htab_lru_map_update_elem(struct bpf_map *map, void *key, void *value,
 	l_new = prealloc_lru_pop(htab, key, hash);
 	if (!l_new)
 		return -ENOMEM;
-	memcpy(l_new->key + round_up(map->key_size, 8), value, map->value_size);
+	copy_map_value(&htab->map,
+		       l_new->key + round_up(map->key_size, 8), value);
 
 	flags = htab_lock_bucket(htab, b);
 
-	l_old = lookup_elem_raw(head, hash, key, key_size);
+	l_old = lookup_elem_raw(tbl, head, hash, key, key_size);
 
 	ret = check_flags(htab, l_old, map_flags);
 	if (ret)
@@ -1099,9 +1566,9 @@ static int htab_lru_map_update_elem(struct bpf_map *map, void *key, void *value,
 	htab_unlock_bucket(htab, b, flags);
 
 	if (ret)
-		bpf_lru_push_free(&htab->lru, &l_new->lru_node);
+		htab_lru_push_free(htab, l_new);
 	else if (l_old)
-		bpf_lru_push_free(&htab->lru, &l_old->lru_node);
+		htab_lru_push_free(htab, l_old);
 
 	return ret;
 }
@@ -1113,6 +1580,7 @@ static int __htab_percpu_map_update_elem(struct bpf_map *map, void *key,
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
 	struct htab_elem *l_new = NULL, *l_old;
 	struct hlist_nulls_head *head;
+	struct bucket_table *tbl;
 	unsigned long flags;
 	struct bucket *b;
 	u32 key_size, hash;
@@ -1128,12 +1596,13 @@ static int __htab_percpu_map_update_elem(struct bpf_map *map, void *key,
 
 	hash = htab_map_hash(key, key_size, htab->hashrnd);
 
-	b = __select_bucket(htab, hash);
+	tbl = htab_tbl(htab);
+	b = __select_bucket(tbl, hash);
 	head = &b->head;
 
 	flags = htab_lock_bucket(htab, b);
 
-	l_old = lookup_elem_raw(head, hash, key, key_size);
+	l_old = lookup_elem_raw(tbl, head, hash, key, key_size);
 
 	ret = check_flags(htab, l_old, map_flags);
 	if (ret)
@@ -1165,6 +1634,7 @@ static int __htab_lru_percpu_map_update_elem(struct bpf_map *map, void *key,
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
 	struct htab_elem *l_new = NULL, *l_old;
 	struct hlist_nulls_head *head;
+	struct bucket_table *tbl;
 	unsigned long flags;
 	struct bucket *b;
 	u32 key_size, hash;
@@ -1180,7 +1650,8 @@ static int __htab_lru_percpu_map_update_elem(struct bpf_map *map, void *key,
 
 	hash = htab_map_hash(key, key_size, htab->hashrnd);
 
-	b = __select_bucket(htab, hash);
+	tbl = htab_tbl(htab);
+	b = __select_bucket(tbl, hash);
 	head = &b->head;
 
 	/* For LRU, we need to alloc before taking bucket's
@@ -1196,7 +1667,7 @@ static int __htab_lru_percpu_map_update_elem(struct bpf_map *map, void *key,
 
 	flags = htab_lock_bucket(htab, b);
 
-	l_old = lookup_elem_raw(head, hash, key, key_size);
+	l_old = lookup_elem_raw(tbl, head, hash, key, key_size);
 
 	ret = check_flags(htab, l_old, map_flags);
 	if (ret)
@@ -1239,7 +1710,7 @@ static int htab_lru_percpu_map_update_elem(struct bpf_map *map, void *key,
 static int htab_map_delete_elem(struct bpf_map *map, void *key)
 {
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
-	struct hlist_nulls_head *head;
+	struct bucket_table *tbl;
 	struct bucket *b;
 	struct htab_elem *l;
 	unsigned long flags;
@@ -1251,15 +1722,12 @@ static int htab_map_delete_elem(struct bpf_map *map, void *key)
 	key_size = map->key_size;
 
 	hash = htab_map_hash(key, key_size, htab->hashrnd);
-	b = __select_bucket(htab, hash);
-	head = &b->head;
-
-	flags = htab_lock_bucket(htab, b);
+	b = htab_lock_hash(htab, hash, &tbl, &flags);
 
-	l = lookup_elem_raw(head, hash, key, key_size);
+	l = lookup_elem_raw(tbl, &b->head, hash, key, key_size);
 
 	if (l) {
-		hlist_nulls_del_rcu(&l->hash_node);
+		htab_unlink_elem(htab, tbl, l);
 		free_htab_elem(htab, l);
 		ret = 0;
 	}
@@ -1272,6 +1740,7 @@ static int htab_lru_map_delete_elem(struct bpf_map *map, void *key)
 {
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
 	struct hlist_nulls_head *head;
+	struct bucket_table *tbl;
 	struct bucket *b;
 	struct htab_elem *l;
 	unsigned long flags;
@@ -1283,12 +1752,13 @@ static int htab_lru_map_delete_elem(struct bpf_map *map, void *key)
 	key_size = map->key_size;
 
 	hash = htab_map_hash(key, key_size, htab->hashrnd);
-	b = __select_bucket(htab, hash);
+	tbl = htab_tbl(htab);
+	b = __select_bucket(tbl, hash);
 	head = &b->head;
 
 	flags = htab_lock_bucket(htab, b);
 
-	l = lookup_elem_raw(head, hash, key, key_size);
+	l = lookup_elem_raw(tbl, head, hash, key, key_size);
 
 	if (l) {
 		hlist_nulls_del_rcu(&l->hash_node);
@@ -1297,26 +1767,78 @@ static int htab_lru_map_delete_elem(struct bpf_map *map, void *key)
 
 	htab_unlock_bucket(htab, b, flags);
 	if (l)
-		bpf_lru_push_free(&htab->lru, &l->lru_node);
+		htab_lru_push_free(htab, l);
 	return ret;
 }
 
 static void delete_all_elements(struct bpf_htab *htab)
 {
+	struct bucket_table *tbl = htab_tbl(htab);
 	int i;
 
-	for (i = 0; i < htab->n_buckets; i++) {
-		struct hlist_nulls_head *head = select_bucket(htab, i);
+	for (i = 0; i < tbl->n_buckets; i++) {
+		struct hlist_nulls_head *head = select_bucket(tbl, i);
 		struct hlist_nulls_node *n;
 		struct htab_elem *l;
 
-		hlist_nulls_for_each_entry_safe(l, n, head, hash_node) {
-			hlist_nulls_del_rcu(&l->hash_node);
+		htab_tbl_for_each_entry_safe(tbl, l, n, head) {
+			hlist_nulls_del_rcu(htab_elem_node(tbl, l));
 			htab_elem_free(htab, l);
 		}
 	}
 }
 
+static void htab_free_malloced_timers(struct bpf_htab *htab)
+{
+	struct bucket_table *tbl;
+	int i;
+
+	rcu_read_lock();
+	tbl = htab_tbl(htab);
+	for (i = 0; i < tbl->n_buckets; i++) {
+		struct hlist_nulls_head *head = select_bucket(tbl, i);
+		struct hlist_nulls_node *n;
+		struct htab_elem *l;
+
+		htab_tbl_for_each_entry_rcu(tbl, l, n, head)
+			check_and_free_timer(htab, l);
+		cond_resched_rcu();
+		/* The table may have been replaced by a bigger one while
+		 * the RCU read lock was dropped. Freeing a timer twice is
+		 * harmless, and the elements not seen yet are all past i.
+		 */
+		tbl = htab_tbl(htab);
+	}
+	rcu_read_unlock();
+}
+
+static void htab_free_prealloced_timers(struct bpf_htab *htab)
+{
+	u32 num_entries = htab->map.max_entries;
+	int i;
+
+	if (!htab_is_percpu(htab) && !htab_is_lru(htab))
+		num_entries += num_possible_cpus();
+
+	for (i = 0; i < num_entries; i++) {
+		check_and_free_timer(htab, get_htab_elem(htab, i));
+		cond_resched();
+	}
+}
+
+/* Called when the last user reference to the map is dropped */
+static void htab_map_free_timers(struct bpf_map *map)
+{
+	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
+
+	if (likely(!map_value_has_timer(&htab->map)))
+		return;
+	if (!htab_is_prealloc(htab))
+		htab_free_malloced_timers(htab);
+	else
+		htab_free_prealloced_timers(htab);
+}
+
 /* Called when map->refcnt goes to zero, either from workqueue or from syscall */
 static void htab_map_free(struct bpf_map *map)
 {
@@ -1327,6 +1849,12 @@ static void htab_map_free(struct bpf_map *map)
 	 * There is no need to synchronize_rcu() here to protect map elements.
 	 */
 
+	/* a resize may still be going on, let it finish */
+	if (htab_is_resizable(htab)) {
+		irq_work_sync(&htab->resize_irq_work);
+		cancel_work_sync(&htab->resize_work);
+	}
+
 	/* some of free_htab_elem() callbacks for elements of this map may
 	 * not have executed. Wait for them.
 	 */
@@ -1337,7 +1865,7 @@ static void htab_map_free(struct bpf_map *map)
 		prealloc_destroy(htab);
 
 	free_percpu(htab->extra_elems);
-	bpf_map_area_free(htab->buckets);
+	bpf_map_area_free(rcu_dereference_protected(htab->tbl, 1));
 	kfree(htab);
 }
 
@@ -1375,11 +1903,12 @@ __htab_map_lookup_and_delete_batch(struct bpf_map *map,
 	void __user *uvalues = u64_to_user_ptr(attr->batch.values);
 	void __user *ukeys = u64_to_user_ptr(attr->batch.keys);
 	void *ubatch = u64_to_user_ptr(attr->batch.in_batch);
-	u32 batch, max_count, size, bucket_size;
+	u32 batch, next, end, max_count, size, bucket_size;
 	struct htab_elem *node_to_free = NULL;
 	u64 elem_map_flags, map_flags;
 	struct hlist_nulls_head *head;
 	struct hlist_nulls_node *n;
+	struct bucket_table *tbl;
 	unsigned long flags = 0;
 	bool locked = false;
 	struct htab_elem *l;
@@ -1406,7 +1935,13 @@ __htab_map_lookup_and_delete_batch(struct bpf_map *map,
 	if (ubatch && copy_from_user(&batch, ubatch, sizeof(batch)))
 		return -EFAULT;
 
-	if (batch >= htab->n_buckets)
+	/* batch is a walk position, which a resize between two calls
+	 * leaves valid, see htab_walk_bucket()
+	 */
+	rcu_read_lock();
+	end = htab_walk_end(htab, htab_tbl(htab));
+	rcu_read_unlock();
+	if (batch >= end)
 		return -ENOENT;
 
 	key_size = htab->map.key_size;
@@ -1438,14 +1973,29 @@ __htab_map_lookup_and_delete_batch(struct bpf_map *map,
 again_nocopy:
 	dst_key = keys;
 	dst_val = values;
-	b = &htab->buckets[batch];
+	tbl = htab_tbl(htab);
+	b = &tbl->buckets[htab_walk_bucket(htab, tbl, batch)];
 	head = &b->head;
 	/* do not grab the lock unless need it (bucket_cnt > 0). */
-	if (locked)
+	if (locked) {
 		flags = htab_lock_bucket(htab, b);
+		/* a resize is about to publish the next table, use that */
+		if (unlikely(READ_ONCE(tbl->migrated))) {
+			htab_unlock_bucket(htab, b, flags);
+			tbl = rcu_dereference_raw(tbl->future);
+			b = &tbl->buckets[htab_walk_bucket(htab, tbl, batch)];
+			head = &b->head;
+			flags = htab_lock_bucket(htab, b);
+		}
+	} else if (unlikely(READ_ONCE(tbl->migrated))) {
+		/* only a peek at the count, see htab_read_tbl() */
+		tbl = rcu_dereference_raw(tbl->future);
+		b = &tbl->buckets[htab_walk_bucket(htab, tbl, batch)];
+		head = &b->head;
+	}
 
 	bucket_cnt = 0;
-	hlist_nulls_for_each_entry_rcu(l, n, head, hash_node)
+	htab_tbl_for_each_entry_rcu(tbl, l, n, head)
 		bucket_cnt++;
 
 	if (bucket_cnt && !locked) {
@@ -1482,7 +2032,7 @@ __htab_map_lookup_and_delete_batch(struct bpf_map *map,
 	if (!locked)
 		goto next_batch;
 
-	hlist_nulls_for_each_entry_safe(l, n, head, hash_node) {
+	htab_tbl_for_each_entry_safe(tbl, l, n, head) {
 		memcpy(dst_key, l->key, key_size);
 
 		if (is_percpu) {
@@ -1502,10 +2052,10 @@ __htab_map_lookup_and_delete_batch(struct bpf_map *map,
 						      true);
 			else
 				copy_map_value(map, dst_val, value);
-			check_and_init_map_lock(map, dst_val);
+			check_and_init_map_value(map, dst_val);
 		}
 		if (do_delete) {
-			hlist_nulls_del_rcu(&l->hash_node);
+			htab_unlink_elem(htab, tbl, l);
 
 			/* bpf_lru_push_free() will acquire lru_lock, which
 			 * may cause deadlock. See comments in function
@@ -1529,15 +2079,16 @@ __htab_map_lookup_and_delete_batch(struct bpf_map *map,
 	while (node_to_free) {
 		l = node_to_free;
 		node_to_free = node_to_free->batch_flink;
-		bpf_lru_push_free(&htab->lru, &l->lru_node);
+		htab_lru_push_free(htab, l);
 	}
 
 next_batch:
+	next = htab_walk_next(htab, tbl, batch);
 	/* If we are not copying data, we can go to next bucket and avoid
 	 * unlocking the rcu.
 	 */
-	if (!bucket_cnt && (batch + 1 < htab->n_buckets)) {
-		batch++;
+	if (!bucket_cnt && next < end) {
+		batch = next;
 		goto again_nocopy;
 	}
 
@@ -1552,8 +2103,8 @@ __htab_map_lookup_and_delete_batch(struct bpf_map *map,
 	}
 
 	total += bucket_cnt;
-	batch++;
-	if (batch >= htab->n_buckets) {
+	batch = next;
+	if (batch >= end) {
 		ret = -ENOENT;
 		goto after_loop;
 	}
@@ -1647,8 +2198,9 @@ htab_lru_map_lookup_and_delete_batch(struct bpf_map *map,
 struct bpf_iter_seq_hash_map_info {
 	struct bpf_map *map;
 	struct bpf_htab *htab;
+	struct bucket_table *tbl;	/* table the last elem was found in */
 	void *percpu_value_buf; // non-zero means percpu hash
-	u32 bucket_id;
+	u32 bucket_id;	/* walk position, see htab_walk_bucket() */
 	u32 skip_elems;
 };
 
@@ -1660,45 +2212,57 @@ bpf_hash_map_seq_find_next(struct bpf_iter_seq_hash_map_info *info,
 	u32 skip_elems = info->skip_elems;
 	u32 bucket_id = info->bucket_id;
 	struct hlist_nulls_head *head;
+	struct bucket_table *tbl;
 	struct hlist_nulls_node *n;
 	struct htab_elem *elem;
-	struct bucket *b;
-	u32 i, count;
-
-	if (bucket_id >= htab->n_buckets)
-		return NULL;
+	u32 i, next, count;
 
 	/* try to find next elem in the same bucket */
 	if (prev_elem) {
 		/* no update/deletion on this bucket, prev_elem should be still valid
 		 * and we won't skip elements.
 		 */
-		n = rcu_dereference_raw(hlist_nulls_next_rcu(&prev_elem->hash_node));
-		elem = hlist_nulls_entry_safe(n, struct htab_elem, hash_node);
+		tbl = info->tbl;
+		n = rcu_dereference_raw(hlist_nulls_next_rcu(htab_elem_node(tbl, prev_elem)));
+		elem = htab_node_elem_safe(tbl, n);
 		if (elem)
 			return elem;
 
 		/* not found, unlock and go to the next bucket */
-		b = &htab->buckets[bucket_id++];
+		bucket_id = htab_walk_next(htab, tbl, bucket_id);
 		rcu_read_unlock();
 		skip_elems = 0;
 	}
 
-	for (i = bucket_id; i < htab->n_buckets; i++) {
-		b = &htab->buckets[i];
+	for (i = bucket_id; ; i = next) {
 		rcu_read_lock();
+		tbl = htab_read_tbl(htab);
+		if (i >= htab_walk_end(htab, tbl)) {
+			rcu_read_unlock();
+			break;
+		}
+
+		/* The bucket we stopped in was split by a resize, and the
+		 * elements already shown are now spread over several buckets.
+		 * Show them again rather than skipping others.
+		 */
+		if (skip_elems && tbl != info->tbl)
+			skip_elems = 0;
 
 		count = 0;
-		head = &b->head;
-		hlist_nulls_for_each_entry_rcu(elem, n, head, hash_node) {
+		head = &tbl->buckets[htab_walk_bucket(htab, tbl, i)].head;
+		htab_tbl_for_each_entry_rcu(tbl, elem, n, head) {
 			if (count >= skip_elems) {
 				info->bucket_id = i;
 				info->skip_elems = count;
+				info->tbl = tbl;
 				return elem;
 			}
 			count++;
 		}
 
+		/* tbl may be freed once the RCU lock is dropped */
+		next = htab_walk_next(htab, tbl, i);
 		rcu_read_unlock();
 		skip_elems = 0;
 	}
@@ -1836,6 +2400,7 @@ const struct bpf_map_ops htab_map_ops = {
 	.map_alloc = htab_map_alloc,
 	.map_free = htab_map_free,
 	.map_get_next_key = htab_map_get_next_key,
+	.map_release_uref = htab_map_free_timers,
 	.map_lookup_elem = htab_map_lookup_elem,
 	.map_update_elem = htab_map_update_elem,
 	.map_delete_elem = htab_map_delete_elem,
@@ -1854,6 +2419,7 @@ const struct bpf_map_ops htab_lru_map_ops = {
 	.map_alloc = htab_map_alloc,
 	.map_free = htab_map_free,
 	.map_get_next_key = htab_map_get_next_key,
+	.map_release_uref = htab_map_free_timers,
 	.map_lookup_elem = htab_lru_map_lookup_elem,
 	.map_lookup_elem_sys_only = htab_lru_map_lookup_elem_sys,
 	.map_update_elem = htab_lru_map_update_elem,
@@ -2012,13 +2578,14 @@ static int fd_htab_map_alloc_check(union bpf_attr *attr)
 static void fd_htab_map_free(struct bpf_map *map)
 {
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
+	struct bucket_table *tbl = htab_tbl(htab);
 	struct hlist_nulls_node *n;
 	struct hlist_nulls_head *head;
 	struct htab_elem *l;
 	int i;
 
-	for (i = 0; i < htab->n_buckets; i++) {
-		head = select_bucket(htab, i);
+	for (i = 0; i < tbl->n_buckets; i++) {
+		head = select_bucket(tbl, i);
 
 		hlist_nulls_for_each_entry_safe(l, n, head, hash_node) {
 			void *ptr = fd_htab_map_get_ptr(map, l);
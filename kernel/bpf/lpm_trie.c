@@ -28,6 +28,31 @@ struct lpm_trie_node {
 	u8				data[];
 };
 
+/* Multibit trie, see the comment above lpm_mb_lookup() */
+#define LPM_MB_STRIDE		8
+#define LPM_MB_SLOTS		(1U << LPM_MB_STRIDE)
+#define LPM_MB_SKIP_MAX		8
+
+struct lpm_mb_leaf {
+	struct rcu_head			rcu;
+	struct list_head		list;
+	/* Next less specific prefix stored in the same node */
+	struct lpm_mb_leaf __rcu	*parent;
+	u32				prefixlen;
+	u8				data[];
+};
+
+struct lpm_mb_node {
+	struct rcu_head			rcu;
+	struct list_head		list;
+	u32				n_used;
+	u16				depth;
+	u8				skip;
+	u8				skip_data[LPM_MB_SKIP_MAX];
+	struct lpm_mb_leaf __rcu	*leaf[LPM_MB_SLOTS];
+	struct lpm_mb_node __rcu	*child[LPM_MB_SLOTS];
+};
+
 struct lpm_trie {
 	struct bpf_map			map;
 	struct lpm_trie_node __rcu	*root;
@@ -35,8 +60,19 @@ struct lpm_trie {
 	size_t				max_prefixlen;
 	size_t				data_size;
 	spinlock_t			lock;
+
+	/* BPF_F_LPM_MULTIBIT */
+	bool				multibit;
+	struct lpm_mb_node		*mb_root;
+	struct lpm_mb_leaf __rcu	*mb_default;
+	struct list_head		mb_leaves;
+	struct list_head		mb_nodes;
+	size_t				mb_n_nodes;
+	size_t				mb_max_nodes;
 };
 
+static struct kmem_cache *lpm_mb_node_cachep;
+
 /* This trie implements a longest prefix match algorithm that can be used to
  * match IP addresses to a stored set of ranges.
  *
@@ -223,6 +259,402 @@ static size_t longest_prefix_match(const struct lpm_trie *trie,
 	return prefixlen;
 }
 
+/* With BPF_F_LPM_MULTIBIT the map is kept as a multibit trie instead:
+ * every node consumes a whole byte of the key, so a lookup visits at
+ * most data_size nodes (4 for IPv4, 16 for IPv6) rather than one node
+ * per bit.
+ *
+ * A node at depth d holds the prefixes with a length in (8 * d, 8 * d + 8]
+ * and has 256 slots, indexed by byte d of the key.  A prefix is expanded
+ * into all slots it covers, and each slot points to the most specific
+ * prefix covering it; the less specific ones hang off leaf->parent.
+ * A slot also points to the child node for the following byte.
+ *
+ * Chains of nodes that hold no prefixes are compressed: a child may sit
+ * up to LPM_MB_SKIP_MAX bytes deeper than its parent, in which case it
+ * stores the key bytes it skips in skip_data.  Inserting a prefix in the
+ * skipped range splits the chain again.
+ *
+ * Readers only follow RCU protected pointers.  Writers are serialized by
+ * trie->lock, and never modify a node in a way that would change the
+ * result for a reader that already got a pointer to it: nodes whose skip
+ * has to change are replaced by a copy.
+ */
+static void lpm_mb_node_free_rcu(struct rcu_head *head)
+{
+	kmem_cache_free(lpm_mb_node_cachep,
+			container_of(head, struct lpm_mb_node, rcu));
+}
+
+static void lpm_mb_node_free(struct lpm_trie *trie, struct lpm_mb_node *node)
+{
+	list_del(&node->list);
+	trie->mb_n_nodes--;
+	call_rcu(&node->rcu, lpm_mb_node_free_rcu);
+}
+
+static struct lpm_mb_node *lpm_mb_node_alloc(struct lpm_trie *trie)
+{
+	struct lpm_mb_node *node;
+
+	if (trie->mb_n_nodes >= trie->mb_max_nodes)
+		return ERR_PTR(-ENOSPC);
+
+	node = kmem_cache_alloc_node(lpm_mb_node_cachep,
+				     GFP_ATOMIC | __GFP_NOWARN | __GFP_ZERO,
+				     trie->map.numa_node);
+	if (!node)
+		return ERR_PTR(-ENOMEM);
+
+	list_add(&node->list, &trie->mb_nodes);
+	trie->mb_n_nodes++;
+	return node;
+}
+
+/* Allocate an empty node at @depth below @parent, on the path to @data */
+static struct lpm_mb_node *lpm_mb_node_new(struct lpm_trie *trie,
+					   const struct lpm_mb_node *parent,
+					   const u8 *data, u32 depth)
+{
+	struct lpm_mb_node *node;
+
+	node = lpm_mb_node_alloc(trie);
+	if (IS_ERR(node))
+		return node;
+
+	node->depth = depth;
+	node->skip = depth - parent->depth - 1;
+	memcpy(node->skip_data, data + parent->depth + 1, node->skip);
+	return node;
+}
+
+static bool lpm_mb_skip_match(const struct lpm_mb_node *node, const u8 *data)
+{
+	return !node->skip ||
+	       !memcmp(data + node->depth - node->skip, node->skip_data,
+		       node->skip);
+}
+
+/* Return the first slot covered by @prefixlen at @node, and the number of
+ * slots it covers.
+ */
+static u32 lpm_mb_range(const struct lpm_mb_node *node, const u8 *data,
+			u32 prefixlen, u32 *start)
+{
+	u32 span = 1U << (LPM_MB_STRIDE * (node->depth + 1) - prefixlen);
+
+	*start = data[node->depth] & ~(span - 1);
+	return span;
+}
+
+#define lpm_mb_deref(trie, p)						\
+	rcu_dereference_check(p, lockdep_is_held(&(trie)->lock))
+
+static void *lpm_mb_lookup(struct lpm_trie *trie,
+			   const struct bpf_lpm_trie_key *key)
+{
+	struct lpm_mb_node *node = trie->mb_root, *child;
+	struct lpm_mb_leaf *found, *leaf;
+	u32 idx;
+
+	found = rcu_dereference(trie->mb_default);
+
+	while (key->prefixlen > node->depth * 8) {
+		idx = key->data[node->depth];
+
+		/* The slot holds the most specific match, only fall back to
+		 * less specific ones if the lookup key asks for it.
+		 */
+		leaf = rcu_dereference(node->leaf[idx]);
+		while (leaf && leaf->prefixlen > key->prefixlen)
+			leaf = rcu_dereference(leaf->parent);
+		if (leaf)
+			found = leaf;
+
+		child = rcu_dereference(node->child[idx]);
+		if (!child || !lpm_mb_skip_match(child, key->data))
+			break;
+		node = child;
+	}
+
+	if (!found)
+		return NULL;
+
+	return found->data + trie->data_size;
+}
+
+/* Find the node holding prefixes of @key->prefixlen, without creating it */
+static struct lpm_mb_node *lpm_mb_find_node(struct lpm_trie *trie,
+					    const struct bpf_lpm_trie_key *key)
+{
+	u32 depth = (key->prefixlen - 1) / 8;
+	struct lpm_mb_node *node = trie->mb_root, *child;
+
+	while (node->depth < depth) {
+		child = lpm_mb_deref(trie, node->child[key->data[node->depth]]);
+		if (!child || child->depth > depth ||
+		    !lpm_mb_skip_match(child, key->data))
+			return NULL;
+		node = child;
+	}
+
+	return node;
+}
+
+static struct lpm_mb_leaf *lpm_mb_find_leaf(struct lpm_trie *trie,
+					    const struct bpf_lpm_trie_key *key,
+					    struct lpm_mb_node **pnode)
+{
+	struct lpm_mb_leaf *leaf;
+	struct lpm_mb_node *node;
+	u32 start;
+
+	if (!key->prefixlen)
+		return lpm_mb_deref(trie, trie->mb_default);
+
+	node = lpm_mb_find_node(trie, key);
+	if (pnode)
+		*pnode = node;
+	if (!node)
+		return NULL;
+
+	lpm_mb_range(node, key->data, key->prefixlen, &start);
+	leaf = lpm_mb_deref(trie, node->leaf[start]);
+	while (leaf && leaf->prefixlen > key->prefixlen)
+		leaf = lpm_mb_deref(trie, leaf->parent);
+
+	return leaf && leaf->prefixlen == key->prefixlen ? leaf : NULL;
+}
+
+/* Find or create the node holding prefixes of @key->prefixlen */
+static struct lpm_mb_node *lpm_mb_get_node(struct lpm_trie *trie,
+					   const struct bpf_lpm_trie_key *key)
+{
+	u32 depth = (key->prefixlen - 1) / 8;
+	struct lpm_mb_node *node = trie->mb_root, *child, *mid, *copy;
+	const u8 *data = key->data;
+	u32 idx, first, pos;
+
+	while (node->depth < depth) {
+		idx = data[node->depth];
+		child = lpm_mb_deref(trie, node->child[idx]);
+
+		if (!child) {
+			child = lpm_mb_node_new(trie, node, data,
+						min_t(u32, depth, node->depth +
+						      1 + LPM_MB_SKIP_MAX));
+			if (IS_ERR(child))
+				return child;
+			rcu_assign_pointer(node->child[idx], child);
+			node->n_used++;
+			node = child;
+			continue;
+		}
+
+		first = child->depth - child->skip;
+		for (pos = first; pos < child->depth; pos++)
+			if (data[pos] != child->skip_data[pos - first])
+				break;
+
+		if (pos == child->depth && child->depth <= depth) {
+			node = child;
+			continue;
+		}
+
+		/* @key leaves the compressed path to @child, or needs a node
+		 * inside of it.  Put a new node at that depth in between,
+		 * and replace @child by a copy that skips fewer bytes.
+		 */
+		pos = min(pos, depth);
+		mid = lpm_mb_node_new(trie, node, data, pos);
+		if (IS_ERR(mid))
+			return mid;
+		copy = lpm_mb_node_alloc(trie);
+		if (IS_ERR(copy)) {
+			lpm_mb_node_free(trie, mid);
+			return copy;
+		}
+
+		memcpy(copy->leaf, child->leaf, sizeof(child->leaf));
+		memcpy(copy->child, child->child, sizeof(child->child));
+		copy->n_used = child->n_used;
+		copy->depth = child->depth;
+		copy->skip = child->depth - pos - 1;
+		memcpy(copy->skip_data, child->skip_data + child->skip - copy->skip,
+		       copy->skip);
+
+		rcu_assign_pointer(mid->child[child->skip_data[pos - first]], copy);
+		mid->n_used = 1;
+		rcu_assign_pointer(node->child[idx], mid);
+		lpm_mb_node_free(trie, child);
+
+		node = mid;
+	}
+
+	return node;
+}
+
+/* Free the nodes on the path to @data that no longer hold anything */
+static void lpm_mb_prune(struct lpm_trie *trie, const u8 *data)
+{
+	struct lpm_mb_node *node, *parent, *child;
+
+	for (;;) {
+		parent = NULL;
+		node = trie->mb_root;
+		while ((child = lpm_mb_deref(trie, node->child[data[node->depth]])) &&
+		       lpm_mb_skip_match(child, data)) {
+			parent = node;
+			node = child;
+		}
+
+		if (!parent || node->n_used)
+			return;
+
+		RCU_INIT_POINTER(parent->child[data[parent->depth]], NULL);
+		parent->n_used--;
+		lpm_mb_node_free(trie, node);
+	}
+}
+
+static int lpm_mb_update(struct lpm_trie *trie,
+			 const struct bpf_lpm_trie_key *key, void *value,
+			 u64 flags)
+{
+	struct lpm_mb_leaf *new, *old, *parent, *leaf;
+	struct lpm_mb_node *node;
+	u32 i, start, span;
+
+	old = lpm_mb_find_leaf(trie, key, NULL);
+	if (old && flags == BPF_NOEXIST)
+		return -EEXIST;
+	if (!old && flags == BPF_EXIST)
+		return -ENOENT;
+	if (!old && trie->n_entries == trie->map.max_entries)
+		return -ENOSPC;
+
+	new = kmalloc_node(sizeof(*new) + trie->data_size +
+			   trie->map.value_size, GFP_ATOMIC | __GFP_NOWARN,
+			   trie->map.numa_node);
+	if (!new)
+		return -ENOMEM;
+
+	new->prefixlen = key->prefixlen;
+	memcpy(new->data, key->data, trie->data_size);
+	memcpy(new->data + trie->data_size, value, trie->map.value_size);
+
+	if (!key->prefixlen) {
+		RCU_INIT_POINTER(new->parent, NULL);
+		rcu_assign_pointer(trie->mb_default, new);
+		goto done;
+	}
+
+	node = lpm_mb_get_node(trie, key);
+	if (IS_ERR(node)) {
+		lpm_mb_prune(trie, key->data);
+		kfree(new);
+		return PTR_ERR(node);
+	}
+
+	span = lpm_mb_range(node, key->data, key->prefixlen, &start);
+
+	if (old) {
+		/* Take over the place of @old in every slot and chain */
+		parent = lpm_mb_deref(trie, old->parent);
+		RCU_INIT_POINTER(new->parent, parent);
+		for (i = start; i < start + span; i++) {
+			leaf = lpm_mb_deref(trie, node->leaf[i]);
+			if (leaf == old) {
+				rcu_assign_pointer(node->leaf[i], new);
+				continue;
+			}
+			while (lpm_mb_deref(trie, leaf->parent) != old &&
+			       lpm_mb_deref(trie, leaf->parent) != new)
+				leaf = lpm_mb_deref(trie, leaf->parent);
+			rcu_assign_pointer(leaf->parent, new);
+		}
+		goto done;
+	}
+
+	/* The less specific prefix covering the whole range, if any */
+	parent = lpm_mb_deref(trie, node->leaf[start]);
+	while (parent && parent->prefixlen > key->prefixlen)
+		parent = lpm_mb_deref(trie, parent->parent);
+	RCU_INIT_POINTER(new->parent, parent);
+
+	/* Slots showing @parent now show @new.  Slots showing something
+	 * more specific get @new inserted in their chain right above
+	 * @parent, unless an earlier slot sharing the chain did that.
+	 */
+	for (i = start; i < start + span; i++) {
+		leaf = lpm_mb_deref(trie, node->leaf[i]);
+		if (leaf == parent) {
+			rcu_assign_pointer(node->leaf[i], new);
+			continue;
+		}
+		while (lpm_mb_deref(trie, leaf->parent) != parent &&
+		       lpm_mb_deref(trie, leaf->parent) != new)
+			leaf = lpm_mb_deref(trie, leaf->parent);
+		if (lpm_mb_deref(trie, leaf->parent) == parent)
+			rcu_assign_pointer(leaf->parent, new);
+	}
+	node->n_used++;
+
+done:
+	if (old) {
+		list_replace_rcu(&old->list, &new->list);
+		kfree_rcu(old, rcu);
+	} else {
+		list_add_tail_rcu(&new->list, &trie->mb_leaves);
+		trie->n_entries++;
+	}
+
+	return 0;
+}
+
+static int lpm_mb_delete(struct lpm_trie *trie,
+			 const struct bpf_lpm_trie_key *key)
+{
+	struct lpm_mb_leaf *old, *parent, *leaf;
+	struct lpm_mb_node *node = NULL;
+	u32 i, start, span;
+
+	old = lpm_mb_find_leaf(trie, key, &node);
+	if (!old)
+		return -ENOENT;
+
+	parent = lpm_mb_deref(trie, old->parent);
+
+	if (!key->prefixlen) {
+		RCU_INIT_POINTER(trie->mb_default, NULL);
+		goto done;
+	}
+
+	/* Unlink @old from every slot and chain it shows up in */
+	span = lpm_mb_range(node, key->data, key->prefixlen, &start);
+	for (i = start; i < start + span; i++) {
+		leaf = lpm_mb_deref(trie, node->leaf[i]);
+		if (leaf == old) {
+			rcu_assign_pointer(node->leaf[i], parent);
+			continue;
+		}
+		while (lpm_mb_deref(trie, leaf->parent) != old &&
+		       lpm_mb_deref(trie, leaf->parent) != parent)
+			leaf = lpm_mb_deref(trie, leaf->parent);
+		if (lpm_mb_deref(trie, leaf->parent) == old)
+			rcu_assign_pointer(leaf->parent, parent);
+	}
+
+	node->n_used--;
+	lpm_mb_prune(trie, key->data);
+
+done:
+	list_del_rcu(&old->list);
+	kfree_rcu(old, rcu);
+	trie->n_entries--;
+	return 0;
+}
+
 /* Called from syscall or from eBPF program */
 static void *trie_lookup_elem(struct bpf_map *map, void *_key)
 {
@@ -230,6 +662,9 @@ static void *trie_lookup_elem(struct bpf_map *map, void *_key)
 	struct lpm_trie_node *node, *found = NULL;
 	struct bpf_lpm_trie_key *key = _key;
 
+	if (trie->multibit)
+		return lpm_mb_lookup(trie, key);
+
 	/* Start walking the trie from the root node ... */
 
 	for (node = rcu_dereference(trie->root); node;) {
@@ -317,6 +752,11 @@ static int trie_update_elem(struct bpf_map *map,
 
 	spin_lock_irqsave(&trie->lock, irq_flags);
 
+	if (trie->multibit) {
+		ret = lpm_mb_update(trie, key, value, flags);
+		goto out;
+	}
+
 	/* Allocate and fill a new node */
 
 	if (trie->n_entries == trie->map.max_entries) {
@@ -444,6 +884,11 @@ static int trie_delete_elem(struct bpf_map *map, void *_key)
 
 	spin_lock_irqsave(&trie->lock, irq_flags);
 
+	if (trie->multibit) {
+		ret = lpm_mb_delete(trie, key);
+		goto out;
+	}
+
 	/* Walk the tree looking for an exact key/length match and keeping
 	 * track of the path we traverse.  We will need to know the node
 	 * we wish to delete, and the slot that points to the node we want
@@ -535,7 +980,7 @@ static int trie_delete_elem(struct bpf_map *map, void *_key)
 #define LPM_KEY_SIZE_MIN	LPM_KEY_SIZE(LPM_DATA_SIZE_MIN)
 
 #define LPM_CREATE_FLAG_MASK	(BPF_F_NO_PREALLOC | BPF_F_NUMA_NODE |	\
-				 BPF_F_ACCESS_MASK)
+				 BPF_F_ACCESS_MASK | BPF_F_LPM_MULTIBIT)
 
 static struct bpf_map *trie_alloc(union bpf_attr *attr)
 {
@@ -557,6 +1002,20 @@ static struct bpf_map *trie_alloc(union bpf_attr *attr)
 	    attr->value_size > LPM_VAL_SIZE_MAX)
 		return ERR_PTR(-EINVAL);
 
+	/* map_extra sets the number of multibit nodes.  Each node is about
+	 * 4 KB and is charged up front, and how many of them a set of
+	 * prefixes needs depends on how they spread, so it has to come
+	 * from the user rather than be guessed from max_entries.
+	 */
+	if (attr->map_flags & BPF_F_LPM_MULTIBIT) {
+		if (!attr->map_extra)
+			return ERR_PTR(-EINVAL);
+	} else if (attr->map_extra) {
+		return ERR_PTR(-EINVAL);
+	}
+	if (attr->map_extra > U32_MAX)
+		return ERR_PTR(-E2BIG);
+
 	trie = kzalloc(sizeof(*trie), GFP_USER | __GFP_NOWARN);
 	if (!trie)
 		return ERR_PTR(-ENOMEM);
@@ -569,6 +1028,18 @@ static struct bpf_map *trie_alloc(union bpf_attr *attr)
 
 	cost_per_node = sizeof(struct lpm_trie_node) +
 			attr->value_size + trie->data_size;
+
+	if (attr->map_flags & BPF_F_LPM_MULTIBIT) {
+		trie->multibit = true;
+		trie->mb_max_nodes = attr->map_extra;
+		INIT_LIST_HEAD(&trie->mb_leaves);
+		INIT_LIST_HEAD(&trie->mb_nodes);
+
+		cost_per_node = sizeof(struct lpm_mb_leaf) +
+				attr->value_size + trie->data_size;
+		cost += (u64) (trie->mb_max_nodes + 1) *
+			sizeof(struct lpm_mb_node);
+	}
 	cost += (u64) attr->max_entries * cost_per_node;
 
 	ret = bpf_map_charge_init(&trie->map.memory, cost);
@@ -577,18 +1048,48 @@ static struct bpf_map *trie_alloc(union bpf_attr *attr)
 
 	spin_lock_init(&trie->lock);
 
+	if (trie->multibit) {
+		trie->mb_root = kmem_cache_alloc_node(lpm_mb_node_cachep,
+						      GFP_USER | __GFP_NOWARN |
+						      __GFP_ZERO,
+						      trie->map.numa_node);
+		if (!trie->mb_root) {
+			bpf_map_charge_finish(&trie->map.memory);
+			ret = -ENOMEM;
+			goto out_err;
+		}
+	}
+
 	return &trie->map;
 out_err:
 	kfree(trie);
 	return ERR_PTR(ret);
 }
 
+static void lpm_mb_free(struct lpm_trie *trie)
+{
+	struct lpm_mb_leaf *leaf, *ltmp;
+	struct lpm_mb_node *node, *ntmp;
+
+	list_for_each_entry_safe(leaf, ltmp, &trie->mb_leaves, list)
+		kfree(leaf);
+	list_for_each_entry_safe(node, ntmp, &trie->mb_nodes, list)
+		kmem_cache_free(lpm_mb_node_cachep, node);
+	kmem_cache_free(lpm_mb_node_cachep, trie->mb_root);
+	kfree(trie);
+}
+
 static void trie_free(struct bpf_map *map)
 {
 	struct lpm_trie *trie = container_of(map, struct lpm_trie, map);
 	struct lpm_trie_node __rcu **slot;
 	struct lpm_trie_node *node;
 
+	if (trie->multibit) {
+		lpm_mb_free(trie);
+		return;
+	}
+
 	/* Always start at the root and walk down to a node that has no
 	 * children. Then free that node, nullify its reference in the parent
 	 * and start over.
@@ -622,6 +1123,30 @@ static void trie_free(struct bpf_map *map)
 	kfree(trie);
 }
 
+/* Multibit tries return keys in the order they were first inserted */
+static int lpm_mb_get_next_key(struct lpm_trie *trie,
+			       const struct bpf_lpm_trie_key *key,
+			       struct bpf_lpm_trie_key *next_key)
+{
+	struct lpm_mb_leaf *leaf = NULL;
+
+	if (key && key->prefixlen <= trie->max_prefixlen)
+		leaf = lpm_mb_find_leaf(trie, key, NULL);
+
+	if (leaf)
+		leaf = list_next_or_null_rcu(&trie->mb_leaves, &leaf->list,
+					     struct lpm_mb_leaf, list);
+	else
+		leaf = list_first_or_null_rcu(&trie->mb_leaves,
+					      struct lpm_mb_leaf, list);
+	if (!leaf)
+		return -ENOENT;
+
+	next_key->prefixlen = leaf->prefixlen;
+	memcpy(next_key->data, leaf->data, trie->data_size);
+	return 0;
+}
+
 static int trie_get_next_key(struct bpf_map *map, void *_key, void *_next_key)
 {
 	struct lpm_trie_node *node, *next_node = NULL, *parent, *search_root;
@@ -643,6 +1168,9 @@ static int trie_get_next_key(struct bpf_map *map, void *_key, void *_next_key)
 	 * The idea is to return more specific keys before less specific ones.
 	 */
 
+	if (trie->multibit)
+		return lpm_mb_get_next_key(trie, key, next_key);
+
 	/* Empty trie */
 	search_root = rcu_dereference(trie->root);
 	if (!search_root)
@@ -743,3 +1271,13 @@ const struct bpf_map_ops trie_map_ops = {
 	.map_btf_name = "lpm_trie",
 	.map_btf_id = &trie_map_btf_id,
 };
+
+static int __init lpm_trie_init(void)
+{
+	lpm_mb_node_cachep = KMEM_CACHE(lpm_mb_node, 0);
+	if (!lpm_mb_node_cachep)
+		return -ENOMEM;
+
+	return 0;
+}
+subsys_initcall(lpm_trie_init);
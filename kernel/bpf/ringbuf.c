@@ -37,10 +37,19 @@ struct bpf_ringbuf {
 	struct page **pages;
 	int nr_pages;
 	spinlock_t spinlock ____cacheline_aligned_in_smp;
+	/* For user-space producer ring buffers, an atomic_t busy bit
+	 * serializes BPF consumers instead of the spinlock. A consumer that
+	 * finds it taken backs off with -EBUSY rather than spinning, which
+	 * keeps the drain path usable from NMI context.
+	 */
+	atomic_t busy ____cacheline_aligned_in_smp;
 	/* Consumer and producer counters are put into separate pages to allow
 	 * mapping consumer page as r/w, but restrict producer page to r/o.
 	 * This protects producer position from being modified by user-space
 	 * application and ruining in-kernel position tracking.
+	 *
+	 * For user ring buffers the roles are swapped: user space owns the
+	 * producer page and the kernel owns the consumer page.
 	 */
 	unsigned long consumer_pos __aligned(PAGE_SIZE);
 	unsigned long producer_pos __aligned(PAGE_SIZE);
@@ -139,6 +148,7 @@ static struct bpf_ringbuf *bpf_ringbuf_alloc(size_t data_sz, int numa_node)
 		return ERR_PTR(-ENOMEM);
 
 	spin_lock_init(&rb->spinlock);
+	atomic_set(&rb->busy, 0);
 	init_waitqueue_head(&rb->waitq);
 	init_irq_work(&rb->work, bpf_ringbuf_notify);
 
@@ -260,6 +270,27 @@ static int ringbuf_map_mmap(struct bpf_map *map, struct vm_area_struct *vma)
 				   vma->vm_pgoff + RINGBUF_PGOFF);
 }
 
+static int user_ringbuf_map_mmap(struct bpf_map *map,
+				 struct vm_area_struct *vma)
+{
+	struct bpf_ringbuf_map *rb_map;
+
+	rb_map = container_of(map, struct bpf_ringbuf_map, map);
+
+	if (vma->vm_flags & VM_WRITE) {
+		/* consumer_pos is owned by the kernel, everything else
+		 * is written by the user space producer
+		 */
+		if (vma->vm_pgoff == 0)
+			return -EPERM;
+	} else {
+		vma->vm_flags &= ~VM_MAYWRITE;
+	}
+	/* remap_vmalloc_range() checks size and offset constraints */
+	return remap_vmalloc_range(vma, rb_map->rb,
+				   vma->vm_pgoff + RINGBUF_PGOFF);
+}
+
 static unsigned long ringbuf_avail_data_sz(struct bpf_ringbuf *rb)
 {
 	unsigned long cons_pos, prod_pos;
@@ -282,6 +313,19 @@ static __poll_t ringbuf_map_poll(struct bpf_map *map, struct file *filp,
 	return 0;
 }
 
+static __poll_t user_ringbuf_map_poll(struct bpf_map *map, struct file *filp,
+				      struct poll_table_struct *pts)
+{
+	struct bpf_ringbuf_map *rb_map;
+
+	rb_map = container_of(map, struct bpf_ringbuf_map, map);
+	poll_wait(filp, &rb_map->rb->waitq, pts);
+
+	if (ringbuf_avail_data_sz(rb_map->rb) < rb_map->rb->mask + 1)
+		return EPOLLOUT | EPOLLWRNORM;
+	return 0;
+}
+
 static int ringbuf_map_btf_id;
 const struct bpf_map_ops ringbuf_map_ops = {
 	.map_meta_equal = bpf_map_meta_equal,
@@ -297,6 +341,21 @@ const struct bpf_map_ops ringbuf_map_ops = {
 	.map_btf_id = &ringbuf_map_btf_id,
 };
 
+static int user_ringbuf_map_btf_id;
+const struct bpf_map_ops user_ringbuf_map_ops = {
+	.map_meta_equal = bpf_map_meta_equal,
+	.map_alloc = ringbuf_map_alloc,
+	.map_free = ringbuf_map_free,
+	.map_mmap = user_ringbuf_map_mmap,
+	.map_poll = user_ringbuf_map_poll,
+	.map_lookup_elem = ringbuf_map_lookup_elem,
+	.map_update_elem = ringbuf_map_update_elem,
+	.map_delete_elem = ringbuf_map_delete_elem,
+	.map_get_next_key = ringbuf_map_get_next_key,
+	.map_btf_name = "bpf_ringbuf_map",
+	.map_btf_id = &user_ringbuf_map_btf_id,
+};
+
 /* Given pointer to ring buffer record metadata and struct bpf_ringbuf itself,
  * calculate offset from record metadata to ring buffer in pages, rounded
  * down. This page offset is stored as part of record metadata and allows to
@@ -336,6 +395,14 @@ static void *__bpf_ringbuf_reserve(struct bpf_ringbuf *rb, u64 size)
 
 	cons_pos = smp_load_acquire(&rb->consumer_pos);
 
+	/* Fail early if the ring buffer is already full. producer_pos only
+	 * moves forward, so the check under the lock below can't succeed
+	 * either, and producers dropping samples under load then don't
+	 * bounce the spinlock cache line between CPUs.
+	 */
+	if (READ_ONCE(rb->producer_pos) + len - cons_pos > rb->mask)
+		return NULL;
+
 	if (in_nmi()) {
 		if (!spin_trylock_irqsave(&rb->spinlock, flags))
 			return NULL;
@@ -494,3 +561,96 @@ const struct bpf_func_proto bpf_ringbuf_query_proto = {
 	.arg1_type	= ARG_CONST_MAP_PTR,
 	.arg2_type	= ARG_ANYTHING,
 };
+
+static long __bpf_user_ringbuf_consume(struct bpf_ringbuf *rb, void *buf,
+				       u32 size)
+{
+	unsigned long cons_pos, prod_pos;
+	u32 hdr_len, sample_len, total_len, flags, copy;
+	u32 *hdr;
+
+	/* Synchronizes with smp_store_release() in the user space producer */
+	prod_pos = smp_load_acquire(&rb->producer_pos);
+	if (prod_pos % 8)
+		return -EINVAL;
+
+	/* Only the kernel writes consumer_pos, and rb->busy keeps other
+	 * consumers away, so a plain load is enough here.
+	 */
+	cons_pos = rb->consumer_pos;
+	if (cons_pos >= prod_pos)
+		return -ENODATA;
+
+	hdr = (u32 *)((uintptr_t)rb->data + (uintptr_t)(cons_pos & rb->mask));
+	/* Synchronizes with smp_store_release() in the user space producer */
+	hdr_len = smp_load_acquire(hdr);
+	flags = hdr_len & (BPF_RINGBUF_BUSY_BIT | BPF_RINGBUF_DISCARD_BIT);
+	sample_len = hdr_len & ~flags;
+	total_len = round_up(sample_len + BPF_RINGBUF_HDR_SZ, 8);
+
+	/* The sample must fit within the region advertised by the producer
+	 * position and within the data area of the ring buffer. Everything
+	 * in here is under user space control, so don't trust any of it.
+	 */
+	if (total_len > prod_pos - cons_pos || total_len > rb->mask + 1)
+		return -EINVAL;
+
+	if (flags & BPF_RINGBUF_BUSY_BIT)
+		return -ENODATA;
+
+	if (!(flags & BPF_RINGBUF_DISCARD_BIT)) {
+		/* data pages are mapped twice, so the sample is contiguous
+		 * even if it wraps around the end of the ring
+		 */
+		copy = min(sample_len, size);
+		memcpy(buf, (void *)hdr + BPF_RINGBUF_HDR_SZ, copy);
+		memset(buf + copy, 0, size - copy);
+	}
+
+	/* pairs with the user space producer's smp_load_acquire() */
+	smp_store_release(&rb->consumer_pos, cons_pos + total_len);
+
+	return flags & BPF_RINGBUF_DISCARD_BIT ? -EAGAIN : sample_len;
+}
+
+BPF_CALL_4(bpf_user_ringbuf_consume, struct bpf_map *, map, void *, buf,
+	   u32, size, u64, flags)
+{
+	struct bpf_ringbuf *rb;
+	long ret;
+
+	if (unlikely(flags & ~(BPF_RB_NO_WAKEUP | BPF_RB_FORCE_WAKEUP))) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	rb = container_of(map, struct bpf_ringbuf_map, map)->rb;
+
+	/* user ring buffers have a single consumer at a time */
+	if (atomic_cmpxchg(&rb->busy, 0, 1)) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	ret = __bpf_user_ringbuf_consume(rb, buf, size);
+	atomic_set_release(&rb->busy, 0);
+
+	/* consuming a sample freed up space for a waiting producer */
+	if (flags & BPF_RB_FORCE_WAKEUP)
+		irq_work_queue(&rb->work);
+	else if ((ret >= 0 || ret == -EAGAIN) && !(flags & BPF_RB_NO_WAKEUP))
+		irq_work_queue(&rb->work);
+out:
+	if (ret < 0)
+		memset(buf, 0, size);
+	return ret;
+}
+
+const struct bpf_func_proto bpf_user_ringbuf_consume_proto = {
+	.func		= bpf_user_ringbuf_consume,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_CONST_MAP_PTR,
+	.arg2_type	= ARG_PTR_TO_UNINIT_MEM,
+	.arg3_type	= ARG_CONST_SIZE,
+	.arg4_type	= ARG_ANYTHING,
+};
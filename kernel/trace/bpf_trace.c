@@ -16,6 +16,9 @@
 #include <linux/syscalls.h>
 #include <linux/error-injection.h>
 #include <linux/btf_ids.h>
+#include <linux/bsearch.h>
+#include <linux/kallsyms.h>
+#include <linux/sort.h>
 
 #include <uapi/linux/bpf.h>
 #include <uapi/linux/btf.h>
@@ -1319,6 +1322,8 @@ bpf_tracing_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
 		return &bpf_ringbuf_discard_proto;
 	case BPF_FUNC_ringbuf_query:
 		return &bpf_ringbuf_query_proto;
+	case BPF_FUNC_user_ringbuf_consume:
+		return &bpf_user_ringbuf_consume_proto;
 	case BPF_FUNC_jiffies64:
 		return &bpf_jiffies64_proto;
 	case BPF_FUNC_get_task_stack:
@@ -1336,6 +1341,66 @@ bpf_tracing_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
 	}
 }
 
+#ifdef CONFIG_DYNAMIC_FTRACE_WITH_REGS
+struct bpf_kprobe_multi_entry {
+	unsigned long ftrace_ip;	/* ftrace location, sort key */
+	unsigned long func;		/* address of the traced function */
+};
+
+struct bpf_kprobe_multi_link {
+	struct bpf_link link;
+	struct ftrace_ops ops;
+	struct bpf_kprobe_multi_entry *entries;
+	u32 cnt;
+	struct module **mods;
+	u32 mods_cnt;
+};
+
+struct bpf_kprobe_multi_run_ctx {
+	struct bpf_kprobe_multi_link *link;
+	unsigned long ftrace_ip;
+};
+
+/* bpf_prog_active keeps kprobe_multi programs from nesting on a CPU, so
+ * a single slot per CPU is enough to tell helpers where the running
+ * program was entered from.
+ */
+static DEFINE_PER_CPU(struct bpf_kprobe_multi_run_ctx, bpf_kprobe_multi_run_ctx);
+
+static int bpf_kprobe_multi_entry_cmp(const void *a, const void *b)
+{
+	const struct bpf_kprobe_multi_entry *ea = a, *eb = b;
+
+	if (ea->ftrace_ip == eb->ftrace_ip)
+		return 0;
+	return ea->ftrace_ip < eb->ftrace_ip ? -1 : 1;
+}
+
+BPF_CALL_1(bpf_get_func_ip_kprobe_multi, struct pt_regs *, regs)
+{
+	struct bpf_kprobe_multi_entry key, *entry;
+	struct bpf_kprobe_multi_run_ctx *run_ctx;
+	struct bpf_kprobe_multi_link *link;
+
+	run_ctx = this_cpu_ptr(&bpf_kprobe_multi_run_ctx);
+	link = run_ctx->link;
+	if (!link)
+		return 0;
+
+	key.ftrace_ip = run_ctx->ftrace_ip;
+	entry = bsearch(&key, link->entries, link->cnt, sizeof(key),
+			bpf_kprobe_multi_entry_cmp);
+	return entry ? entry->func : 0;
+}
+
+static const struct bpf_func_proto bpf_get_func_ip_proto_kprobe_multi = {
+	.func		= bpf_get_func_ip_kprobe_multi,
+	.gpl_only	= false,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_PTR_TO_CTX,
+};
+#endif
+
 static const struct bpf_func_proto *
 kprobe_prog_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
 {
@@ -1349,6 +1414,11 @@ kprobe_prog_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
 #ifdef CONFIG_BPF_KPROBE_OVERRIDE
 	case BPF_FUNC_override_return:
 		return &bpf_override_return_proto;
+#endif
+#ifdef CONFIG_DYNAMIC_FTRACE_WITH_REGS
+	case BPF_FUNC_get_func_ip:
+		return prog->expected_attach_type == BPF_TRACE_KPROBE_MULTI ?
+		       &bpf_get_func_ip_proto_kprobe_multi : NULL;
 #endif
 	default:
 		return bpf_tracing_func_proto(func_id, prog);
@@ -1699,6 +1769,8 @@ raw_tp_prog_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
 const struct bpf_func_proto *
 tracing_prog_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
 {
+	const struct bpf_func_proto *fn;
+
 	switch (func_id) {
 #ifdef CONFIG_NET
 	case BPF_FUNC_skb_output:
@@ -1731,7 +1803,10 @@ tracing_prog_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
 	case BPF_FUNC_d_path:
 		return &bpf_d_path_proto;
 	default:
-		return raw_tp_prog_func_proto(func_id, prog);
+		fn = raw_tp_prog_func_proto(func_id, prog);
+		if (!fn && prog->expected_attach_type == BPF_TRACE_ITER)
+			fn = bpf_iter_get_func_proto(func_id, prog);
+		return fn;
 	}
 }
 
@@ -1914,6 +1989,11 @@ int perf_event_attach_bpf_prog(struct perf_event *event,
 	     !trace_kprobe_error_injectable(event->tp_event)))
 		return -EINVAL;
 
+	/* kprobe_multi programs are only attached through their link */
+	if (prog->type == BPF_PROG_TYPE_KPROBE &&
+	    prog->expected_attach_type == BPF_TRACE_KPROBE_MULTI)
+		return -EINVAL;
+
 	mutex_lock(&bpf_event_mutex);
 
 	if (event->prog)
@@ -2231,3 +2311,373 @@ static int __init bpf_event_init(void)
 
 fs_initcall(bpf_event_init);
 #endif /* CONFIG_MODULES */
+
+#ifdef CONFIG_DYNAMIC_FTRACE_WITH_REGS
+#define MAX_KPROBE_MULTI_CNT (1U << 20)
+
+static void kprobe_multi_put_modules(struct module **mods, u32 cnt)
+{
+	u32 i;
+
+	for (i = 0; i < cnt; i++)
+		module_put(mods[i]);
+}
+
+static void bpf_kprobe_multi_link_release(struct bpf_link *link)
+{
+	struct bpf_kprobe_multi_link *kmulti_link;
+
+	kmulti_link = container_of(link, struct bpf_kprobe_multi_link, link);
+	unregister_ftrace_function(&kmulti_link->ops);
+	kprobe_multi_put_modules(kmulti_link->mods, kmulti_link->mods_cnt);
+}
+
+static void bpf_kprobe_multi_link_dealloc(struct bpf_link *link)
+{
+	struct bpf_kprobe_multi_link *kmulti_link;
+
+	kmulti_link = container_of(link, struct bpf_kprobe_multi_link, link);
+	ftrace_free_filter(&kmulti_link->ops);
+	kfree(kmulti_link->mods);
+	kvfree(kmulti_link->entries);
+	kfree(kmulti_link);
+}
+
+static const struct bpf_link_ops bpf_kprobe_multi_link_lops = {
+	.release = bpf_kprobe_multi_link_release,
+	.dealloc = bpf_kprobe_multi_link_dealloc,
+};
+
+static void bpf_kprobe_multi_link_handler(unsigned long ip,
+					  unsigned long parent_ip,
+					  struct ftrace_ops *ops,
+					  struct pt_regs *regs)
+{
+	struct bpf_kprobe_multi_run_ctx *run_ctx;
+	struct bpf_kprobe_multi_link *link;
+
+	link = container_of(ops, struct bpf_kprobe_multi_link, ops);
+
+	if (unlikely(__this_cpu_inc_return(bpf_prog_active) != 1))
+		goto out;
+
+	run_ctx = this_cpu_ptr(&bpf_kprobe_multi_run_ctx);
+	run_ctx->link = link;
+	run_ctx->ftrace_ip = ip;
+
+	rcu_read_lock();
+	BPF_PROG_RUN(link->link.prog, regs);
+	rcu_read_unlock();
+
+	run_ctx->link = NULL;
+ out:
+	__this_cpu_dec(bpf_prog_active);
+}
+
+static int symbols_cmp(const void *a, const void *b)
+{
+	const char **str_a = (const char **)a;
+	const char **str_b = (const char **)b;
+
+	return strcmp(*str_a, *str_b);
+}
+
+struct kprobe_multi_resolve {
+	const char **syms;	/* sorted */
+	unsigned long *addrs;	/* indexed like syms */
+	u32 cnt;
+	u32 found;
+};
+
+static int kprobe_multi_resolve_cb(void *data, const char *name,
+				   struct module *mod, unsigned long addr)
+{
+	struct kprobe_multi_resolve *args = data;
+	const char **sym;
+	u32 idx;
+
+	sym = bsearch(&name, args->syms, args->cnt, sizeof(*args->syms),
+		      symbols_cmp);
+	if (!sym)
+		return 0;
+
+	/* the first symbol wins, like with kallsyms_lookup_name() */
+	idx = sym - args->syms;
+	if (args->addrs[idx])
+		return 0;
+
+	args->addrs[idx] = addr;
+	args->found++;
+	return args->found == args->cnt ? 1 : 0;
+}
+
+/* Resolve all symbols with a single walk over kallsyms instead of one
+ * kallsyms_lookup_name() scan per symbol, which dominates attach time
+ * once there are thousands of them.
+ */
+static int kprobe_multi_resolve_syms(u64 __user *usyms, u32 cnt,
+				     unsigned long *addrs)
+{
+	struct kprobe_multi_resolve args = {
+		.addrs = addrs,
+		.cnt = cnt,
+	};
+	const char **syms;
+	char *buf, *p;
+	u64 usymbol;
+	u32 i;
+	int err;
+
+	syms = kvmalloc_array(cnt, sizeof(*syms), GFP_KERNEL);
+	buf = kvmalloc_array(cnt, KSYM_NAME_LEN, GFP_KERNEL);
+	if (!syms || !buf) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (p = buf, i = 0; i < cnt; i++) {
+		if (get_user(usymbol, usyms + i)) {
+			err = -EFAULT;
+			goto out;
+		}
+		err = strncpy_from_user(p, u64_to_user_ptr(usymbol),
+					KSYM_NAME_LEN);
+		if (err == KSYM_NAME_LEN)
+			err = -E2BIG;
+		if (err < 0)
+			goto out;
+		syms[i] = p;
+		p += err + 1;
+	}
+
+	sort(syms, cnt, sizeof(*syms), symbols_cmp, NULL);
+	for (i = 1; i < cnt; i++) {
+		if (!strcmp(syms[i - 1], syms[i])) {
+			err = -EINVAL;
+			goto out;
+		}
+	}
+
+	args.syms = syms;
+	kallsyms_on_each_symbol(kprobe_multi_resolve_cb, &args);
+	err = args.found == cnt ? 0 : -ENOENT;
+out:
+	kvfree(buf);
+	kvfree(syms);
+	return err;
+}
+
+/* ftrace doesn't necessarily patch the first instruction of a function,
+ * so look for its location anywhere within the symbol.
+ */
+static unsigned long kprobe_multi_ftrace_location(unsigned long addr)
+{
+	unsigned long size, offset;
+
+	if (!kallsyms_lookup_size_offset(addr, &size, &offset) || offset)
+		return 0;
+	return ftrace_location_range(addr, addr + size - 1);
+}
+
+struct modules_array {
+	struct module **mods;
+	u32 mods_cnt;
+	u32 mods_cap;
+};
+
+static int add_module(struct modules_array *arr, struct module *mod)
+{
+	struct module **mods;
+
+	if (arr->mods_cnt == arr->mods_cap) {
+		arr->mods_cap = max(16U, arr->mods_cap * 3 / 2);
+		mods = krealloc(arr->mods, arr->mods_cap * sizeof(*mods),
+				GFP_KERNEL);
+		if (!mods)
+			return -ENOMEM;
+		arr->mods = mods;
+	}
+
+	arr->mods[arr->mods_cnt++] = mod;
+	return 0;
+}
+
+static bool has_module(struct modules_array *arr, struct module *mod)
+{
+	u32 i;
+
+	for (i = arr->mods_cnt; i > 0; i--) {
+		if (arr->mods[i - 1] == mod)
+			return true;
+	}
+	return false;
+}
+
+/* Pin the modules the functions live in, so that they can't be unloaded
+ * while the link still points at their text.
+ */
+static int get_modules_for_addrs(struct module ***mods, unsigned long *addrs,
+				 u32 addrs_cnt)
+{
+	struct modules_array arr = {};
+	struct module *mod;
+	u32 i;
+	int err = 0;
+
+	for (i = 0; i < addrs_cnt; i++) {
+		preempt_disable();
+		mod = __module_address(addrs[i]);
+		/* either not in a module or already pinned */
+		if (!mod || has_module(&arr, mod)) {
+			preempt_enable();
+			continue;
+		}
+		if (!try_module_get(mod))
+			err = -EINVAL;
+		preempt_enable();
+		if (err)
+			break;
+		err = add_module(&arr, mod);
+		if (err) {
+			module_put(mod);
+			break;
+		}
+	}
+
+	if (err) {
+		kprobe_multi_put_modules(arr.mods, arr.mods_cnt);
+		kfree(arr.mods);
+		return err;
+	}
+
+	*mods = arr.mods;
+	return arr.mods_cnt;
+}
+
+int bpf_kprobe_multi_link_attach(const union bpf_attr *attr, struct bpf_prog *prog)
+{
+	struct bpf_kprobe_multi_entry *entries = NULL;
+	struct bpf_kprobe_multi_link *link = NULL;
+	struct bpf_link_primer link_primer;
+	void __user *uaddrs, *usyms;
+	unsigned long *addrs;
+	u32 flags, cnt, i;
+	int err;
+
+	/* no support for 32bit archs yet */
+	if (sizeof(u64) != sizeof(void *))
+		return -EOPNOTSUPP;
+
+	if (prog->expected_attach_type != BPF_TRACE_KPROBE_MULTI)
+		return -EINVAL;
+
+	flags = attr->link_create.kprobe_multi.flags;
+	if (flags)
+		return -EINVAL;
+
+	uaddrs = u64_to_user_ptr(attr->link_create.kprobe_multi.addrs);
+	usyms = u64_to_user_ptr(attr->link_create.kprobe_multi.syms);
+	if (!!uaddrs == !!usyms)
+		return -EINVAL;
+
+	cnt = attr->link_create.kprobe_multi.cnt;
+	if (!cnt)
+		return -EINVAL;
+	if (cnt > MAX_KPROBE_MULTI_CNT)
+		return -E2BIG;
+
+	addrs = kvcalloc(cnt, sizeof(*addrs), GFP_KERNEL);
+	entries = kvmalloc_array(cnt, sizeof(*entries), GFP_KERNEL);
+	if (!addrs || !entries) {
+		err = -ENOMEM;
+		goto error;
+	}
+
+	if (uaddrs) {
+		if (copy_from_user(addrs, uaddrs, cnt * sizeof(*addrs))) {
+			err = -EFAULT;
+			goto error;
+		}
+	} else {
+		err = kprobe_multi_resolve_syms(usyms, cnt, addrs);
+		if (err)
+			goto error;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		entries[i].func = addrs[i];
+		entries[i].ftrace_ip = kprobe_multi_ftrace_location(addrs[i]);
+		if (!entries[i].ftrace_ip) {
+			err = -EINVAL;
+			goto error;
+		}
+		/* same opt-in list as for a single kprobe override */
+		if (prog->kprobe_override &&
+		    !within_error_injection_list(addrs[i])) {
+			err = -EINVAL;
+			goto error;
+		}
+	}
+
+	/* sorted for bpf_get_func_ip(), and each function only once */
+	sort(entries, cnt, sizeof(*entries), bpf_kprobe_multi_entry_cmp, NULL);
+	for (i = 0; i < cnt; i++) {
+		if (i && entries[i].ftrace_ip == entries[i - 1].ftrace_ip) {
+			err = -EINVAL;
+			goto error;
+		}
+		addrs[i] = entries[i].ftrace_ip;
+	}
+
+	link = kzalloc(sizeof(*link), GFP_KERNEL);
+	if (!link) {
+		err = -ENOMEM;
+		goto error;
+	}
+
+	err = get_modules_for_addrs(&link->mods, addrs, cnt);
+	if (err < 0)
+		goto error;
+	link->mods_cnt = err;
+
+	bpf_link_init(&link->link, BPF_LINK_TYPE_KPROBE_MULTI,
+		      &bpf_kprobe_multi_link_lops, prog);
+	link->ops.func = bpf_kprobe_multi_link_handler;
+	link->ops.flags = FTRACE_OPS_FL_SAVE_REGS | FTRACE_OPS_FL_RCU;
+	if (prog->kprobe_override)
+		link->ops.flags |= FTRACE_OPS_FL_IPMODIFY;
+
+	err = bpf_link_prime(&link->link, &link_primer);
+	if (err)
+		goto error_put_modules;
+
+	/* from here on the link owns entries and frees them on dealloc */
+	link->entries = entries;
+	link->cnt = cnt;
+
+	/* All functions go into the filter hash in one update, so text
+	 * patching and the synchronization it needs happen only once.
+	 */
+	err = ftrace_set_filter_ips(&link->ops, addrs, cnt, 0, 0);
+	if (!err)
+		err = register_ftrace_function(&link->ops);
+	kvfree(addrs);
+	if (err) {
+		/* cleanup skips ->release(), only ->dealloc() runs */
+		kprobe_multi_put_modules(link->mods, link->mods_cnt);
+		bpf_link_cleanup(&link_primer);
+		return err;
+	}
+
+	return bpf_link_settle(&link_primer);
+
+error_put_modules:
+	kprobe_multi_put_modules(link->mods, link->mods_cnt);
+	kfree(link->mods);
+error:
+	kfree(link);
+	kvfree(entries);
+	kvfree(addrs);
+	return err;
+}
+#endif /* CONFIG_DYNAMIC_FTRACE_WITH_REGS */
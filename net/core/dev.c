@@ -3519,6 +3519,23 @@ static netdev_features_t gso_features_check(const struct sk_buff *skb,
 	if (gso_segs > dev->gso_max_segs)
 		return features & ~NETIF_F_GSO_MASK;
 
+	/* Forwarded GRO super-packets may be larger than the device takes.
+	 * Every device handles legacy sizes, and the limit applies to the
+	 * TCP payload, so only look at the headers of BIG TCP packets.
+	 */
+	if (unlikely(skb->len > GSO_LEGACY_MAX_SIZE)) {
+		unsigned int hdr_len = skb_transport_offset(skb);
+		const struct tcphdr *th;
+		struct tcphdr _tcphdr;
+
+		th = skb_header_pointer(skb, hdr_len, sizeof(_tcphdr), &_tcphdr);
+		if (likely(th))
+			hdr_len += __tcp_hdrlen(th);
+
+		if (skb->len - hdr_len > dev->tso_max_size)
+			return features & ~NETIF_F_GSO_MASK;
+	}
+
 	/* Support for GSO partial features requires software
 	 * intervention before we can actually process the packets
 	 * so we need to strip support for any partial features now
@@ -4267,6 +4284,10 @@ int dev_rx_weight __read_mostly = 64;
 int dev_tx_weight __read_mostly = 64;
 /* Maximum number of GRO_NORMAL skbs to batch up for list-RX */
 int gro_normal_batch __read_mostly = 8;
+int gro_hash_buckets __read_mostly = 8;	/* power of two */
+int gro_max_skbs __read_mostly = MAX_GRO_SKBS;
+int gro_flush_age __read_mostly;	/* in jiffies */
+int gro_sw_hash __read_mostly;
 
 /* Called with irq disabled */
 static inline void ____napi_schedule(struct softnet_data *sd,
@@ -5820,6 +5841,16 @@ static int napi_gro_complete(struct napi_struct *napi, struct sk_buff *skb)
 	return NET_RX_SUCCESS;
 }
 
+/* A chain is old once it has been held for more than gro_flush_age jiffies.
+ * With the default of 0, this means it was started before the current jiffy,
+ * which only matters for the end-of-poll flush.
+ */
+static bool gro_chain_is_old(const struct sk_buff *skb)
+{
+	return time_after(jiffies, NAPI_GRO_CB(skb)->age +
+				   READ_ONCE(gro_flush_age));
+}
+
 static void __napi_gro_flush_chain(struct napi_struct *napi, u32 index,
 				   bool flush_old)
 {
@@ -5827,8 +5858,11 @@ static void __napi_gro_flush_chain(struct napi_struct *napi, u32 index,
 	struct sk_buff *skb, *p;
 
 	list_for_each_entry_safe_reverse(skb, p, head, list) {
-		if (flush_old && NAPI_GRO_CB(skb)->age == jiffies)
-			return;
+		if (flush_old) {
+			if (!gro_chain_is_old(skb))
+				return;
+			napi->gro_stats.aged++;
+		}
 		skb_list_del_init(skb);
 		napi_gro_complete(napi, skb);
 		napi->gro_hash[index].count--;
@@ -5845,25 +5879,44 @@ static void __napi_gro_flush_chain(struct napi_struct *napi, u32 index,
 void napi_gro_flush(struct napi_struct *napi, bool flush_old)
 {
 	unsigned long bitmask = napi->gro_bitmask;
-	unsigned int i, base = ~0U;
+	unsigned int i;
 
-	while ((i = ffs(bitmask)) != 0) {
-		bitmask >>= i;
-		base += i;
-		__napi_gro_flush_chain(napi, base, flush_old);
-	}
+	for_each_set_bit(i, &bitmask, GRO_HASH_BUCKETS)
+		__napi_gro_flush_chain(napi, i, flush_old);
 }
 EXPORT_SYMBOL(napi_gro_flush);
 
+/* Pick the GRO bucket of a packet. Without an L4 hash from the device,
+ * all flows between two hosts would share a bucket, so gro_sw_hash lets
+ * the flow dissector compute one, which RPS/RFS then reuse.
+ */
+static u32 gro_hash_bucket(struct napi_struct *napi, struct sk_buff *skb)
+{
+	u32 hash;
+
+	/* A new bucket count only takes effect once no chain is held, so
+	 * that packets of a flow never sit in two buckets and get reordered.
+	 */
+	if (!napi->gro_bitmask)
+		napi->gro_hash_mask = READ_ONCE(gro_hash_buckets) - 1;
+
+	if (READ_ONCE(gro_sw_hash) && !skb->l4_hash)
+		hash = skb_get_hash(skb);
+	else
+		hash = skb_get_hash_raw(skb);
+
+	return hash & napi->gro_hash_mask;
+}
+
 static struct list_head *gro_list_prepare(struct napi_struct *napi,
-					  struct sk_buff *skb)
+					  struct sk_buff *skb, u32 bucket)
 {
 	unsigned int maclen = skb->dev->hard_header_len;
 	u32 hash = skb_get_hash_raw(skb);
 	struct list_head *head;
 	struct sk_buff *p;
 
-	head = &napi->gro_hash[hash & (GRO_HASH_BUCKETS - 1)].list;
+	head = &napi->gro_hash[bucket].list;
 	list_for_each_entry(p, head, list) {
 		unsigned long diffs;
 
@@ -5952,7 +6005,7 @@ static void gro_flush_oldest(struct napi_struct *napi, struct list_head *head)
 
 	oldest = list_last_entry(head, struct sk_buff, list);
 
-	/* We are called with head length >= MAX_GRO_SKBS, so this is
+	/* We are called with head length >= gro_max_skbs, so this is
 	 * impossible.
 	 */
 	if (WARN_ON_ONCE(!oldest))
@@ -5963,6 +6016,29 @@ static void gro_flush_oldest(struct napi_struct *napi, struct list_head *head)
 	 */
 	skb_list_del_init(oldest);
 	napi_gro_complete(napi, oldest);
+	napi->gro_stats.evicted++;
+}
+
+/* Complete the chains of a bucket that are too old to be worth holding,
+ * before a new chain is added to it. Oldest chains are at the tail.
+ * Without a configured age, chains are only flushed at the end of a poll.
+ */
+static void gro_flush_aged(struct napi_struct *napi, u32 bucket)
+{
+	struct gro_list *gro_list = &napi->gro_hash[bucket];
+	struct sk_buff *skb, *p;
+
+	if (!READ_ONCE(gro_flush_age))
+		return;
+
+	list_for_each_entry_safe_reverse(skb, p, &gro_list->list, list) {
+		if (!gro_chain_is_old(skb))
+			break;
+		skb_list_del_init(skb);
+		napi_gro_complete(napi, skb);
+		gro_list->count--;
+		napi->gro_stats.aged++;
+	}
 }
 
 INDIRECT_CALLABLE_DECLARE(struct sk_buff *inet_gro_receive(struct list_head *,
@@ -5971,7 +6047,7 @@ INDIRECT_CALLABLE_DECLARE(struct sk_buff *ipv6_gro_receive(struct list_head *,
 							   struct sk_buff *));
 static enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 {
-	u32 hash = skb_get_hash_raw(skb) & (GRO_HASH_BUCKETS - 1);
+	u32 hash = gro_hash_bucket(napi, skb);
 	struct list_head *head = &offload_base;
 	struct packet_offload *ptype;
 	__be16 type = skb->protocol;
@@ -5984,7 +6060,7 @@ static enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff
 	if (netif_elide_gro(skb->dev))
 		goto normal;
 
-	gro_head = gro_list_prepare(napi, skb);
+	gro_head = gro_list_prepare(napi, skb, hash);
 
 	rcu_read_lock();
 	list_for_each_entry_rcu(ptype, head, list) {
@@ -6042,17 +6118,21 @@ static enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff
 		napi->gro_hash[hash].count--;
 	}
 
-	if (same_flow)
+	if (same_flow) {
+		napi->gro_stats.merged++;
 		goto ok;
+	}
 
 	if (NAPI_GRO_CB(skb)->flush)
 		goto normal;
 
-	if (unlikely(napi->gro_hash[hash].count >= MAX_GRO_SKBS)) {
+	gro_flush_aged(napi, hash);
+	if (unlikely(napi->gro_hash[hash].count >= READ_ONCE(gro_max_skbs))) {
 		gro_flush_oldest(napi, gro_head);
 	} else {
 		napi->gro_hash[hash].count++;
 	}
+	napi->gro_stats.held++;
 	NAPI_GRO_CB(skb)->count = 1;
 	NAPI_GRO_CB(skb)->age = jiffies;
 	NAPI_GRO_CB(skb)->last = skb;
@@ -6075,6 +6155,7 @@ static enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff
 	return ret;
 
 normal:
+	napi->gro_stats.normal++;
 	ret = GRO_NORMAL;
 	goto pull;
 }
@@ -6734,6 +6815,8 @@ static void init_gro_hash(struct napi_struct *napi)
 		napi->gro_hash[i].count = 0;
 	}
 	napi->gro_bitmask = 0;
+	napi->gro_hash_mask = READ_ONCE(gro_hash_buckets) - 1;
+	memset(&napi->gro_stats, 0, sizeof(napi->gro_stats));
 }
 
 void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
@@ -10502,7 +10585,9 @@ struct net_device *alloc_netdev_mqs(int sizeof_priv, const char *name,
 
 	dev_net_set(dev, &init_net);
 
-	dev->gso_max_size = GSO_MAX_SIZE;
+	dev->gso_max_size = GSO_LEGACY_MAX_SIZE;
+	dev->tso_max_size = GSO_LEGACY_MAX_SIZE;
+	dev->gro_max_size = GRO_LEGACY_MAX_SIZE;
 	dev->gso_max_segs = GSO_MAX_SEGS;
 	dev->upper_level = 1;
 	dev->lower_level = 1;
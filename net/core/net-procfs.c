@@ -193,6 +193,36 @@ static const struct seq_operations softnet_seq_ops = {
 	.show  = softnet_seq_show,
 };
 
+static int gro_seq_show(struct seq_file *seq, void *v)
+{
+	struct net_device *dev = v;
+	struct napi_struct *napi;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_puts(seq, "device     napi_id held merged normal evicted aged\n");
+		return 0;
+	}
+
+	/* dev_seq_start() holds rcu_read_lock() */
+	list_for_each_entry_rcu(napi, &dev->napi_list, dev_list) {
+		const struct napi_gro_stats *st = &napi->gro_stats;
+
+		seq_printf(seq, "%-10s %7u %llu %llu %llu %llu %llu\n",
+			   dev->name, napi->napi_id,
+			   READ_ONCE(st->held), READ_ONCE(st->merged),
+			   READ_ONCE(st->normal), READ_ONCE(st->evicted),
+			   READ_ONCE(st->aged));
+	}
+	return 0;
+}
+
+static const struct seq_operations gro_seq_ops = {
+	.start = dev_seq_start,
+	.next  = dev_seq_next,
+	.stop  = dev_seq_stop,
+	.show  = gro_seq_show,
+};
+
 static void *ptype_get_idx(struct seq_file *seq, loff_t pos)
 {
 	struct list_head *ptype_list = NULL;
@@ -326,12 +356,17 @@ static int __net_init dev_proc_net_init(struct net *net)
 	if (!proc_create_net("ptype", 0444, net->proc_net, &ptype_seq_ops,
 			sizeof(struct seq_net_private)))
 		goto out_softnet;
+	if (!proc_create_net("gro_stat", 0444, net->proc_net, &gro_seq_ops,
+			sizeof(struct seq_net_private)))
+		goto out_ptype;
 
 	if (wext_proc_init(net))
-		goto out_ptype;
+		goto out_gro;
 	rc = 0;
 out:
 	return rc;
+out_gro:
+	remove_proc_entry("gro_stat", net->proc_net);
 out_ptype:
 	remove_proc_entry("ptype", net->proc_net);
 out_softnet:
@@ -345,6 +380,7 @@ static void __net_exit dev_proc_net_exit(struct net *net)
 {
 	wext_proc_exit(net);
 
+	remove_proc_entry("gro_stat", net->proc_net);
 	remove_proc_entry("ptype", net->proc_net);
 	remove_proc_entry("softnet_stat", net->proc_net);
 	remove_proc_entry("dev", net->proc_net);
@@ -232,6 +232,9 @@ static struct page *__page_pool_alloc_pages_slow(struct page_pool *pool,
 		page_pool_dma_sync_for_device(pool, page, pool->p.max_len);
 
 skip_dma_map:
+	if (pool->p.init_callback)
+		pool->p.init_callback(page, pool->p.init_arg);
+
 	/* Track how many pages are held 'in-flight' */
 	pool->pages_state_hold_cnt++;
 
@@ -227,6 +227,7 @@ static char *pkt_flag_names[] = {
 #define M_START_XMIT		0	/* Default normal TX */
 #define M_NETIF_RECEIVE 	1	/* Inject packets into stack */
 #define M_QUEUE_XMIT		2	/* Inject packet into qdisc */
+#define M_NETIF_RECEIVE_LIST	3	/* Inject lists of packets into stack */
 
 /* If lock -- protects updating of if_list */
 #define   if_lock(t)           mutex_lock(&(t->if_lock));
@@ -432,6 +433,7 @@ struct pktgen_net {
 	struct net		*net;
 	struct proc_dir_entry	*proc_dir;
 	struct list_head	pktgen_threads;
+	struct pktgen_sink	*sink;
 	bool			pktgen_exiting;
 };
 
@@ -484,6 +486,323 @@ static struct notifier_block pktgen_notifier_block = {
 	.notifier_call = pktgen_device_event,
 };
 
+/*
+ * Receive side sink.
+ *
+ * A packet tap on one device that recognises the pktgen header of UDP
+ * packets seen on that device's rx or tx path, and keeps per flow
+ * counters and latency histograms, shown in /proc/net/pktgen/sink.
+ * Flows are keyed by addresses and ports. seq_num is per pktgen device,
+ * so "lost" only makes sense for flows that carry a whole device's
+ * sequence space, i.e. one flow per pktgen device.
+ * Latency uses the sender's wall clock stamp, in usec.
+ */
+#define PKTGEN_SINK		"sink"
+#define PKTGEN_SINK_FLOWS	1024
+#define PKTGEN_SINK_PROBE	8
+#define PKTGEN_SINK_HIST	24	/* log2 usec buckets */
+
+struct pktgen_sink_key {
+	__be32	saddr[4];
+	__be32	daddr[4];
+	__be16	sport;
+	__be16	dport;
+	u16	family;
+};
+
+struct pktgen_sink_flow {
+	spinlock_t		lock;
+	bool			used;
+	struct pktgen_sink_key	key;
+	u64			packets;
+	u64			reordered;	/* seq below the highest seen */
+	u32			seq_first;
+	u32			seq_max;
+	u64			lat_packets;
+	u64			lat_sum;
+	u32			lat_min;
+	u32			lat_max;
+	u64			lat_hist[PKTGEN_SINK_HIST];
+};
+
+struct pktgen_sink {
+	struct packet_type	pt;
+	struct net_device	*dev;
+	bool			tx;
+	atomic_long_t		untracked;	/* flow table was full */
+	struct pktgen_sink_flow	flows[PKTGEN_SINK_FLOWS];
+};
+
+/* protects pktgen_net::sink */
+static DEFINE_MUTEX(pktgen_sink_lock);
+
+static bool pktgen_sink_parse(const struct sk_buff *skb,
+			      struct pktgen_sink_key *key,
+			      struct pktgen_hdr *pgh)
+{
+	int off = skb_network_offset(skb);
+	const struct pktgen_hdr *hdr;
+	const struct udphdr *udph;
+	struct udphdr _udph;
+
+	memset(key, 0, sizeof(*key));
+
+	switch (skb->protocol) {
+	case htons(ETH_P_IP): {
+		const struct iphdr *iph;
+		struct iphdr _iph;
+
+		iph = skb_header_pointer(skb, off, sizeof(_iph), &_iph);
+		if (!iph || iph->ihl < 5 || iph->protocol != IPPROTO_UDP ||
+		    ip_is_fragment(iph))
+			return false;
+		key->saddr[0] = iph->saddr;
+		key->daddr[0] = iph->daddr;
+		off += iph->ihl * 4;
+		break;
+	}
+	case htons(ETH_P_IPV6): {
+		const struct ipv6hdr *ip6h;
+		struct ipv6hdr _ip6h;
+
+		ip6h = skb_header_pointer(skb, off, sizeof(_ip6h), &_ip6h);
+		if (!ip6h || ip6h->nexthdr != IPPROTO_UDP)
+			return false;
+		memcpy(key->saddr, &ip6h->saddr, sizeof(key->saddr));
+		memcpy(key->daddr, &ip6h->daddr, sizeof(key->daddr));
+		off += sizeof(*ip6h);
+		break;
+	}
+	default:
+		return false;
+	}
+	key->family = ntohs(skb->protocol);
+
+	udph = skb_header_pointer(skb, off, sizeof(_udph), &_udph);
+	if (!udph)
+		return false;
+	key->sport = udph->source;
+	key->dport = udph->dest;
+
+	hdr = skb_header_pointer(skb, off + sizeof(_udph), sizeof(*pgh), pgh);
+	if (!hdr || hdr->pgh_magic != htonl(PKTGEN_MAGIC))
+		return false;
+	if (hdr != pgh)
+		memcpy(pgh, hdr, sizeof(*pgh));
+	return true;
+}
+
+static void pktgen_sink_account(struct pktgen_sink_flow *f,
+				const struct pktgen_hdr *pgh)
+{
+	u32 seq = ntohl(pgh->seq_num);
+	struct timespec64 now;
+	s64 lat;
+	int b;
+
+	if (!f->packets) {
+		f->seq_first = seq;
+		f->seq_max = seq;
+	} else if ((s32)(seq - f->seq_max) < 0) {
+		f->reordered++;
+		if ((s32)(seq - f->seq_first) < 0)
+			f->seq_first = seq;
+	} else {
+		f->seq_max = seq;
+	}
+	f->packets++;
+
+	/* F_NO_TIMESTAMP */
+	if (!pgh->tv_sec && !pgh->tv_usec)
+		return;
+
+	ktime_get_real_ts64(&now);
+	lat = (s64)(s32)((u32)now.tv_sec - ntohl(pgh->tv_sec)) * USEC_PER_SEC +
+	      now.tv_nsec / NSEC_PER_USEC - ntohl(pgh->tv_usec);
+	if (lat < 0)
+		lat = 0;
+	lat = min_t(s64, lat, U32_MAX);
+
+	b = lat ? min(ilog2(lat) + 1, PKTGEN_SINK_HIST - 1) : 0;
+	f->lat_hist[b]++;
+	if (!f->lat_packets || lat < f->lat_min)
+		f->lat_min = lat;
+	if (lat > f->lat_max)
+		f->lat_max = lat;
+	f->lat_sum += lat;
+	f->lat_packets++;
+}
+
+static int pktgen_sink_rcv(struct sk_buff *skb, struct net_device *dev,
+			   struct packet_type *pt, struct net_device *orig_dev)
+{
+	struct pktgen_sink *sink = container_of(pt, struct pktgen_sink, pt);
+	struct pktgen_sink_key key;
+	struct pktgen_hdr pgh;
+	u32 hash;
+	int i;
+
+	if ((skb->pkt_type == PACKET_OUTGOING) != sink->tx ||
+	    !pktgen_sink_parse(skb, &key, &pgh))
+		goto out;
+
+	hash = jhash(&key, sizeof(key), 0);
+	for (i = 0; i < PKTGEN_SINK_PROBE; i++) {
+		struct pktgen_sink_flow *f;
+
+		f = &sink->flows[(hash + i) & (PKTGEN_SINK_FLOWS - 1)];
+		spin_lock(&f->lock);
+		if (!f->used) {
+			f->used = true;
+			f->key = key;
+		}
+		if (!memcmp(&f->key, &key, sizeof(key))) {
+			pktgen_sink_account(f, &pgh);
+			spin_unlock(&f->lock);
+			goto out;
+		}
+		spin_unlock(&f->lock);
+	}
+	atomic_long_inc(&sink->untracked);
+out:
+	consume_skb(skb);
+	return NET_RX_SUCCESS;
+}
+
+static void pktgen_sink_stop(struct pktgen_net *pn)
+{
+	struct pktgen_sink *sink = pn->sink;
+
+	if (!sink)
+		return;
+	pn->sink = NULL;
+	/* dev_remove_pack() waits for running handlers */
+	dev_remove_pack(&sink->pt);
+	dev_put(sink->dev);
+	vfree(sink);
+}
+
+static int pktgen_sink_start(struct pktgen_net *pn, const char *ifname,
+			     bool tx)
+{
+	struct pktgen_sink *sink;
+	struct net_device *dev;
+	int i;
+
+	dev = dev_get_by_name(pn->net, ifname);
+	if (!dev)
+		return -ENODEV;
+
+	sink = vzalloc(sizeof(*sink));
+	if (!sink) {
+		dev_put(dev);
+		return -ENOMEM;
+	}
+	for (i = 0; i < PKTGEN_SINK_FLOWS; i++)
+		spin_lock_init(&sink->flows[i].lock);
+	atomic_long_set(&sink->untracked, 0);
+	sink->dev = dev;
+	sink->tx = tx;
+	sink->pt.type = htons(ETH_P_ALL);
+	sink->pt.dev = dev;
+	sink->pt.func = pktgen_sink_rcv;
+
+	pktgen_sink_stop(pn);
+	pn->sink = sink;
+	dev_add_pack(&sink->pt);
+	return 0;
+}
+
+/* "sink rx <ifname>", "sink tx <ifname>" or "sink stop" */
+static int pktgen_sink_ctrl(struct pktgen_net *pn, const char *arg)
+{
+	int ret = 0;
+
+	mutex_lock(&pktgen_sink_lock);
+	if (!strcmp(arg, "stop"))
+		pktgen_sink_stop(pn);
+	else if (!strncmp(arg, "rx ", 3))
+		ret = pktgen_sink_start(pn, arg + 3, false);
+	else if (!strncmp(arg, "tx ", 3))
+		ret = pktgen_sink_start(pn, arg + 3, true);
+	else
+		ret = -EINVAL;
+	mutex_unlock(&pktgen_sink_lock);
+
+	return ret;
+}
+
+static void pktgen_sink_show_flow(struct seq_file *seq,
+				  const struct pktgen_sink_flow *f)
+{
+	u64 expected = (u64)(f->seq_max - f->seq_first) + 1;
+	int i;
+
+	if (f->key.family == ETH_P_IP)
+		seq_printf(seq, "%pI4:%u -> %pI4:%u",
+			   &f->key.saddr[0], ntohs(f->key.sport),
+			   &f->key.daddr[0], ntohs(f->key.dport));
+	else
+		seq_printf(seq, "[%pI6c]:%u -> [%pI6c]:%u",
+			   f->key.saddr, ntohs(f->key.sport),
+			   f->key.daddr, ntohs(f->key.dport));
+
+	seq_printf(seq, "\n     pkts: %llu  lost: %llu  reordered: %llu\n",
+		   f->packets,
+		   expected > f->packets ? expected - f->packets : 0,
+		   f->reordered);
+	if (!f->lat_packets)
+		return;
+
+	seq_printf(seq, "     latency_us: min %u  avg %llu  max %u\n",
+		   f->lat_min, div64_u64(f->lat_sum, f->lat_packets),
+		   f->lat_max);
+	seq_puts(seq, "     hist_us:");
+	for (i = 0; i < PKTGEN_SINK_HIST; i++) {
+		if (!f->lat_hist[i])
+			continue;
+		if (i == PKTGEN_SINK_HIST - 1)
+			seq_printf(seq, " >=%lu:%llu", 1UL << (i - 1),
+				   f->lat_hist[i]);
+		else
+			seq_printf(seq, " <%lu:%llu", 1UL << i,
+				   f->lat_hist[i]);
+	}
+	seq_putc(seq, '\n');
+}
+
+static int pktgen_sink_show(struct seq_file *seq, void *v)
+{
+	struct pktgen_net *pn = net_generic(seq_file_net(seq), pg_net_id);
+	struct pktgen_sink_flow *f;
+	struct pktgen_sink *sink;
+	int i;
+
+	mutex_lock(&pktgen_sink_lock);
+	sink = pn->sink;
+	if (!sink) {
+		seq_puts(seq, "sink: stopped\n");
+		goto out;
+	}
+	seq_printf(seq, "sink: %s %s  untracked: %lu\n", sink->dev->name,
+		   sink->tx ? "tx" : "rx", atomic_long_read(&sink->untracked));
+
+	f = kmalloc(sizeof(*f), GFP_KERNEL);
+	if (!f)
+		goto out;
+	for (i = 0; i < PKTGEN_SINK_FLOWS; i++) {
+		spin_lock_bh(&sink->flows[i].lock);
+		memcpy(f, &sink->flows[i], sizeof(*f));
+		spin_unlock_bh(&sink->flows[i].lock);
+		if (f->used)
+			pktgen_sink_show_flow(seq, f);
+	}
+	kfree(f);
+out:
+	mutex_unlock(&pktgen_sink_lock);
+	return 0;
+}
+
 /*
  * /proc handling functions
  *
@@ -524,6 +843,13 @@ static ssize_t pgctrl_write(struct file *file, const char __user *buf,
 	else if (!strcmp(data, "reset"))
 		pktgen_reset_all_threads(pn);
 
+	else if (!strncmp(data, "sink ", 5)) {
+		int ret = pktgen_sink_ctrl(pn, data + 5);
+
+		if (ret)
+			return ret;
+	}
+
 	else
 		return -EINVAL;
 
@@ -639,6 +965,8 @@ static int pktgen_if_show(struct seq_file *seq, void *v)
 
 	if (pkt_dev->xmit_mode == M_NETIF_RECEIVE)
 		seq_puts(seq, "     xmit_mode: netif_receive\n");
+	else if (pkt_dev->xmit_mode == M_NETIF_RECEIVE_LIST)
+		seq_puts(seq, "     xmit_mode: netif_receive_list\n");
 	else if (pkt_dev->xmit_mode == M_QUEUE_XMIT)
 		seq_puts(seq, "     xmit_mode: xmit_queue\n");
 
@@ -1087,6 +1415,7 @@ static ssize_t pktgen_if_write(struct file *file,
 			return len;
 		if ((value > 0) &&
 		    ((pkt_dev->xmit_mode == M_NETIF_RECEIVE) ||
+		     (pkt_dev->xmit_mode == M_NETIF_RECEIVE_LIST) ||
 		     !(pkt_dev->odev->priv_flags & IFF_TX_SKB_SHARING)))
 			return -ENOTSUPP;
 		i += len;
@@ -1198,13 +1527,21 @@ static ssize_t pktgen_if_write(struct file *file,
 			 * at module loading time
 			 */
 			pkt_dev->clone_skb = 0;
+		} else if (strcmp(f, "netif_receive_list") == 0) {
+			/* every packet of a list is a separate skb */
+			if (pkt_dev->clone_skb > 0)
+				return -ENOTSUPP;
+
+			pkt_dev->xmit_mode = M_NETIF_RECEIVE_LIST;
+			pkt_dev->last_ok = 1;
+			pkt_dev->clone_skb = 0;
 		} else if (strcmp(f, "queue_xmit") == 0) {
 			pkt_dev->xmit_mode = M_QUEUE_XMIT;
 			pkt_dev->last_ok = 1;
 		} else {
 			sprintf(pg_result,
 				"xmit_mode -:%s:- unknown\nAvailable modes: %s",
-				f, "start_xmit, netif_receive\n");
+				f, "start_xmit, netif_receive, netif_receive_list, queue_xmit\n");
 			return count;
 		}
 		sprintf(pg_result, "OK: xmit_mode=%s", f);
@@ -1944,13 +2281,20 @@ static int pktgen_device_event(struct notifier_block *unused,
 	struct net_device *dev = netdev_notifier_info_to_dev(ptr);
 	struct pktgen_net *pn = net_generic(dev_net(dev), pg_net_id);
 
-	if (pn->pktgen_exiting)
-		return NOTIFY_DONE;
-
 	/* It is OK that we do not hold the group lock right now,
 	 * as we run under the RTNL lock.
 	 */
 
+	if (event == NETDEV_UNREGISTER) {
+		mutex_lock(&pktgen_sink_lock);
+		if (pn->sink && pn->sink->dev == dev)
+			pktgen_sink_stop(pn);
+		mutex_unlock(&pktgen_sink_lock);
+	}
+
+	if (pn->pktgen_exiting)
+		return NOTIFY_DONE;
+
 	switch (event) {
 	case NETDEV_CHANGENAME:
 		pktgen_change_name(pn, dev);
@@ -3296,6 +3640,47 @@ static void pktgen_wait_for_skb(struct pktgen_dev *pkt_dev)
 	pkt_dev->idle_acc += ktime_to_ns(ktime_sub(ktime_get(), idle_start));
 }
 
+/* Inject up to burst freshly built packets with one netif_receive_skb_list().
+ * Each packet gets its own sequence number, unlike the netif_receive mode
+ * which hands the same skb to the stack again.
+ */
+static void pktgen_receive_list(struct pktgen_dev *pkt_dev, unsigned int burst)
+{
+	struct net_device *odev = pkt_dev->odev;
+	unsigned long dropped;
+	struct sk_buff *skb;
+	LIST_HEAD(list);
+	unsigned int n;
+	u64 bytes = 0;
+
+	if (pkt_dev->count && pkt_dev->count - pkt_dev->sofar < burst)
+		burst = pkt_dev->count - pkt_dev->sofar;
+
+	for (n = 0; n < burst; n++) {
+		skb = fill_packet(odev, pkt_dev);
+		if (!skb) {
+			pkt_dev->errors++;
+			break;
+		}
+		pkt_dev->last_pkt_size = skb->len;
+		bytes += skb->len;
+		skb->protocol = eth_type_trans(skb, skb->dev);
+		list_add_tail(&skb->list, &list);
+		pkt_dev->seq_num++;
+	}
+
+	/* netif_receive_skb_list() reports no per-packet result, so count
+	 * the packets the stack dropped on odev instead of NET_RX_DROP.
+	 */
+	dropped = atomic_long_read(&odev->rx_dropped);
+	local_bh_disable();
+	netif_receive_skb_list(&list);
+	local_bh_enable();
+	pkt_dev->errors += atomic_long_read(&odev->rx_dropped) - dropped;
+	pkt_dev->sofar += n;
+	pkt_dev->tx_bytes += bytes;
+}
+
 static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 {
 	unsigned int burst = READ_ONCE(pkt_dev->burst);
@@ -3318,6 +3703,15 @@ static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 		return;
 	}
 
+	if (pkt_dev->xmit_mode == M_NETIF_RECEIVE_LIST) {
+		if (pkt_dev->delay)
+			spin(pkt_dev, pkt_dev->next_tx);
+		pktgen_receive_list(pkt_dev, burst);
+		if (pkt_dev->count && pkt_dev->sofar >= pkt_dev->count)
+			pktgen_stop_device(pkt_dev);
+		return;
+	}
+
 	/* If no skb or clone count exhausted then get new one */
 	if (!pkt_dev->skb || (pkt_dev->last_ok &&
 			      ++pkt_dev->clone_count >= pkt_dev->clone_skb)) {
@@ -3799,6 +4193,13 @@ static int __net_init pg_net_init(struct net *net)
 		ret = -EINVAL;
 		goto remove;
 	}
+	pe = proc_create_net_single(PKTGEN_SINK, 0400, pn->proc_dir,
+				    pktgen_sink_show, NULL);
+	if (pe == NULL) {
+		pr_err("cannot create %s procfs entry\n", PKTGEN_SINK);
+		ret = -EINVAL;
+		goto remove_ctrl;
+	}
 
 	for_each_online_cpu(cpu) {
 		int err;
@@ -3812,12 +4213,14 @@ static int __net_init pg_net_init(struct net *net)
 	if (list_empty(&pn->pktgen_threads)) {
 		pr_err("Initialization failed for all threads\n");
 		ret = -ENODEV;
-		goto remove_entry;
+		goto remove_sink;
 	}
 
 	return 0;
 
-remove_entry:
+remove_sink:
+	remove_proc_entry(PKTGEN_SINK, pn->proc_dir);
+remove_ctrl:
 	remove_proc_entry(PGCTRL, pn->proc_dir);
 remove:
 	remove_proc_entry(PG_PROC_DIR, pn->net->proc_net);
@@ -3846,6 +4249,11 @@ static void __net_exit pg_net_exit(struct net *net)
 		kfree(t);
 	}
 
+	mutex_lock(&pktgen_sink_lock);
+	pktgen_sink_stop(pn);
+	mutex_unlock(&pktgen_sink_lock);
+
+	remove_proc_entry(PKTGEN_SINK, pn->proc_dir);
 	remove_proc_entry(PGCTRL, pn->proc_dir);
 	remove_proc_entry(PG_PROC_DIR, pn->net->proc_net);
 }
@@ -2012,6 +2012,26 @@ void sk_free_unlock_clone(struct sock *sk)
 }
 EXPORT_SYMBOL_GPL(sk_free_unlock_clone);
 
+/* Only IPv6 TCP can use jumbograms, see ip6_xmit(), everyone else is
+ * bound by the 16-bit length fields.
+ */
+static u32 sk_dst_gso_max_size(struct sock *sk, struct dst_entry *dst)
+{
+	u32 max_size = READ_ONCE(dst->dev->gso_max_size);
+
+	if (max_size > GSO_LEGACY_MAX_SIZE) {
+#if IS_ENABLED(CONFIG_IPV6)
+		if (sk->sk_family != AF_INET6 ||
+		    sk->sk_type != SOCK_STREAM ||
+		    sk->sk_protocol != IPPROTO_TCP ||
+		    ipv6_addr_v4mapped(&sk->sk_v6_rcv_saddr))
+#endif
+			max_size = GSO_LEGACY_MAX_SIZE;
+	}
+
+	return max_size - (MAX_TCP_HEADER + 1);
+}
+
 void sk_setup_caps(struct sock *sk, struct dst_entry *dst)
 {
 	u32 max_segs = 1;
@@ -2026,7 +2046,7 @@ void sk_setup_caps(struct sock *sk, struct dst_entry *dst)
 			sk->sk_route_caps &= ~NETIF_F_GSO_MASK;
 		} else {
 			sk->sk_route_caps |= NETIF_F_SG | NETIF_F_HW_CSUM;
-			sk->sk_gso_max_size = dst->dev->gso_max_size;
+			sk->sk_gso_max_size = sk_dst_gso_max_size(sk, dst);
 			max_segs = max_t(u32, dst->dev->gso_max_segs, 1);
 		}
 	}
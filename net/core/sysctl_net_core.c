@@ -29,6 +29,9 @@ static int min_rcvbuf = SOCK_MIN_RCVBUF;
 static int max_skb_frags = MAX_SKB_FRAGS;
 static long long_one __maybe_unused = 1;
 static long long_max __maybe_unused = LONG_MAX;
+static int gro_hash_buckets_max = GRO_HASH_BUCKETS;
+static int gro_max_skbs_max = 64;
+static int gro_flush_age_max_ms = MSEC_PER_SEC;
 
 static int net_msg_warn;	/* Unused, but still a sysctl */
 
@@ -212,6 +215,47 @@ static int flow_limit_table_len_sysctl(struct ctl_table *table, int write,
 }
 #endif /* CONFIG_NET_FLOW_LIMIT */
 
+static int gro_hash_buckets_sysctl(struct ctl_table *table, int write,
+				   void *buffer, size_t *lenp, loff_t *ppos)
+{
+	int val = READ_ONCE(gro_hash_buckets);
+	struct ctl_table tmp = {
+		.data		= &val,
+		.maxlen		= sizeof(val),
+		.mode		= table->mode,
+		.extra1		= SYSCTL_ONE,
+		.extra2		= &gro_hash_buckets_max,
+	};
+	int ret;
+
+	ret = proc_dointvec_minmax(&tmp, write, buffer, lenp, ppos);
+	if (write && !ret) {
+		if (!is_power_of_2(val))
+			return -EINVAL;
+		WRITE_ONCE(gro_hash_buckets, val);
+	}
+	return ret;
+}
+
+static int gro_flush_age_sysctl(struct ctl_table *table, int write,
+				void *buffer, size_t *lenp, loff_t *ppos)
+{
+	int val = jiffies_to_msecs(READ_ONCE(gro_flush_age));
+	struct ctl_table tmp = {
+		.data		= &val,
+		.maxlen		= sizeof(val),
+		.mode		= table->mode,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &gro_flush_age_max_ms,
+	};
+	int ret;
+
+	ret = proc_dointvec_minmax(&tmp, write, buffer, lenp, ppos);
+	if (write && !ret)
+		WRITE_ONCE(gro_flush_age, msecs_to_jiffies(val));
+	return ret;
+}
+
 #ifdef CONFIG_NET_SCHED
 static int set_default_qdisc(struct ctl_table *table, int write,
 			     void *buffer, size_t *lenp, loff_t *ppos)
@@ -575,6 +619,36 @@ static struct ctl_table net_core_table[] = {
 		.proc_handler	= proc_dointvec_minmax,
 		.extra1		= SYSCTL_ONE,
 	},
+	{
+		.procname	= "gro_hash_buckets",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= gro_hash_buckets_sysctl,
+	},
+	{
+		.procname	= "gro_max_skbs",
+		.data		= &gro_max_skbs,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ONE,
+		.extra2		= &gro_max_skbs_max,
+	},
+	{
+		.procname	= "gro_flush_age",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= gro_flush_age_sysctl,
+	},
+	{
+		.procname	= "gro_sw_hash",
+		.data		= &gro_sw_hash,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	},
 	{ }
 };
 
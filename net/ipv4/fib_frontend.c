@@ -31,6 +31,8 @@
 #include <linux/init.h>
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/jhash.h>
+#include <linux/proc_fs.h>
 
 #include <net/ip.h>
 #include <net/protocol.h>
@@ -1324,6 +1326,210 @@ void fib_del_ifaddr(struct in_ifaddr *ifa, struct in_ifaddr *iprim)
 #undef BRD1_OK
 }
 
+/* Per-CPU fib_lookup() result cache.
+ *
+ * Forwarding workloads with a few hot destinations spend a large part of
+ * the per-packet cost walking the trie (and the rules, when custom rules
+ * are installed) only to arrive at the same fib_result again.  When
+ * net.ipv4.fib_lookup_cache is set, softirq lookups consult a small
+ * direct-mapped table per CPU first.
+ *
+ * A cached fib_result holds RCU protected pointers (fi, nhc, table,
+ * fa_head), so an entry is only valid while its generation matches.  The
+ * generation combines rt_genid_ipv4(), bumped by rt_cache_flush() on every
+ * route, rule and address change, with the global fib_lookup_cache_genid,
+ * bumped right before any fib_alias, trie node, fib_info, nexthop or table
+ * is passed to call_rcu().  A reader sampling the generation before its
+ * lookup therefore never stores a result under a generation that outlives
+ * the objects it references.
+ */
+#define FIB_LOOKUP_CACHE_BITS	8
+#define FIB_LOOKUP_CACHE_SIZE	(1U << FIB_LOOKUP_CACHE_BITS)
+
+struct fib_lookup_cache_entry {
+	u32			gen;
+	__be32			daddr;
+	__be32			saddr;
+	int			oif;
+	int			iif;
+	u32			mark;
+	kuid_t			uid;
+	u8			tos;
+	u8			scope;
+	u8			fl_flags;
+	unsigned int		lookup_flags;
+	/* flow fields as rewritten by the lookup (l3mdev) */
+	int			res_oif;
+	int			res_iif;
+	u8			res_fl_flags;
+	struct fib_result	res;
+};
+
+struct fib_lookup_cache {
+	struct fib_lookup_cache_entry	entries[FIB_LOOKUP_CACHE_SIZE];
+	unsigned long			hits;
+	unsigned long			misses;
+	unsigned long			bypass;
+};
+
+DEFINE_STATIC_KEY_FALSE(fib_lookup_cache_key);
+EXPORT_SYMBOL(fib_lookup_cache_key);
+
+atomic_t fib_lookup_cache_genid;
+EXPORT_SYMBOL(fib_lookup_cache_genid);
+
+static DEFINE_MUTEX(fib_lookup_cache_mutex);
+
+static u32 fib_lookup_cache_gen(const struct net *net)
+{
+	u32 gen = rt_genid_ipv4(net) + atomic_read(&fib_lookup_cache_genid);
+
+	/* never zero, so a freshly allocated table has no valid entries */
+	return (gen << 1) | 1;
+}
+
+static bool fib_lookup_cache_match(const struct fib_lookup_cache_entry *e,
+				   const struct flowi4 *flp, u32 gen,
+				   unsigned int flags)
+{
+	return e->gen == gen &&
+	       e->daddr == flp->daddr &&
+	       e->saddr == flp->saddr &&
+	       e->oif == flp->flowi4_oif &&
+	       e->iif == flp->flowi4_iif &&
+	       e->mark == flp->flowi4_mark &&
+	       uid_eq(e->uid, flp->flowi4_uid) &&
+	       e->tos == flp->flowi4_tos &&
+	       e->scope == flp->flowi4_scope &&
+	       e->fl_flags == flp->flowi4_flags &&
+	       e->lookup_flags == flags;
+}
+
+/* Tunnel keys and port/proto rules are not part of the cache key */
+static bool fib_lookup_cache_bypass(const struct net *net,
+				    const struct flowi4 *flp)
+{
+	if (flp->flowi4_tun_key.tun_id)
+		return true;
+#ifdef CONFIG_IP_MULTIPLE_TABLES
+	if (net->ipv4.fib_rules_require_fldissect)
+		return true;
+#endif
+	return false;
+}
+
+int fib_lookup_cached(struct net *net, struct flowi4 *flp,
+		      struct fib_result *res, unsigned int flags)
+{
+	struct fib_lookup_cache_entry *e;
+	struct fib_lookup_cache *cache;
+	struct flowi4 key;
+	u32 gen, hash;
+	int err;
+
+	cache = READ_ONCE(net->ipv4.fib_lookup_cache);
+	if (!cache || !READ_ONCE(net->ipv4.sysctl_fib_lookup_cache))
+		return fib_lookup_uncached(net, flp, res, flags);
+
+	/* Only softirq context keeps us on this CPU for the whole lookup */
+	if (!in_softirq())
+		return fib_lookup_uncached(net, flp, res, flags);
+
+	if (fib_lookup_cache_bypass(net, flp)) {
+		this_cpu_inc(net->ipv4.fib_lookup_cache->bypass);
+		return fib_lookup_uncached(net, flp, res, flags);
+	}
+
+	cache = this_cpu_ptr(cache);
+	hash = jhash_3words((__force u32)flp->daddr,
+			    (__force u32)flp->saddr ^ flp->flowi4_mark,
+			    flp->flowi4_oif ^ (flp->flowi4_iif << 16) ^
+			    flp->flowi4_tos, net_hash_mix(net));
+	e = &cache->entries[hash >> (32 - FIB_LOOKUP_CACHE_BITS)];
+
+	gen = fib_lookup_cache_gen(net);
+	smp_rmb();
+
+	if (fib_lookup_cache_match(e, flp, gen, flags)) {
+		flp->flowi4_oif = e->res_oif;
+		flp->flowi4_iif = e->res_iif;
+		flp->flowi4_flags = e->res_fl_flags;
+		*res = e->res;
+		cache->hits++;
+		return 0;
+	}
+
+	key = *flp;
+	err = fib_lookup_uncached(net, flp, res, flags);
+	cache->misses++;
+	if (err)
+		return err;
+
+	e->gen = gen;
+	e->daddr = key.daddr;
+	e->saddr = key.saddr;
+	e->oif = key.flowi4_oif;
+	e->iif = key.flowi4_iif;
+	e->mark = key.flowi4_mark;
+	e->uid = key.flowi4_uid;
+	e->tos = key.flowi4_tos;
+	e->scope = key.flowi4_scope;
+	e->fl_flags = key.flowi4_flags;
+	e->lookup_flags = flags;
+	e->res_oif = flp->flowi4_oif;
+	e->res_iif = flp->flowi4_iif;
+	e->res_fl_flags = flp->flowi4_flags;
+	e->res = *res;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(fib_lookup_cached);
+
+int fib_lookup_cache_enable(struct net *net)
+{
+	struct fib_lookup_cache __percpu *cache;
+
+	mutex_lock(&fib_lookup_cache_mutex);
+	if (!net->ipv4.fib_lookup_cache) {
+		cache = alloc_percpu(struct fib_lookup_cache);
+		if (!cache) {
+			mutex_unlock(&fib_lookup_cache_mutex);
+			return -ENOMEM;
+		}
+		smp_store_release(&net->ipv4.fib_lookup_cache, cache);
+	}
+	mutex_unlock(&fib_lookup_cache_mutex);
+
+	static_branch_enable(&fib_lookup_cache_key);
+	return 0;
+}
+
+void fib_lookup_cache_free(struct net *net)
+{
+	free_percpu(net->ipv4.fib_lookup_cache);
+	net->ipv4.fib_lookup_cache = NULL;
+}
+
+#ifdef CONFIG_PROC_FS
+static int fib_lookup_cache_seq_show(struct seq_file *seq, void *v)
+{
+	struct net *net = seq_file_net(seq);
+	struct fib_lookup_cache *cache;
+	int cpu;
+
+	seq_puts(seq, "hits     misses   bypass\n");
+	if (!net->ipv4.fib_lookup_cache)
+		return 0;
+
+	for_each_possible_cpu(cpu) {
+		cache = per_cpu_ptr(net->ipv4.fib_lookup_cache, cpu);
+		seq_printf(seq, "%08lx %08lx %08lx\n",
+			   cache->hits, cache->misses, cache->bypass);
+	}
+	return 0;
+}
+#endif
+
 static void nl_fib_lookup(struct net *net, struct fib_result_nl *frn)
 {
 
@@ -1595,9 +1801,21 @@ static int __net_init fib_net_init(struct net *net)
 	error = fib_proc_init(net);
 	if (error < 0)
 		goto out_proc;
+#ifdef CONFIG_PROC_FS
+	if (!proc_create_net_single("fib_lookup_cache", 0444,
+				    net->proc_net_stat,
+				    fib_lookup_cache_seq_show, NULL)) {
+		error = -ENOMEM;
+		goto out_stat;
+	}
+#endif
 out:
 	return error;
 
+#ifdef CONFIG_PROC_FS
+out_stat:
+	fib_proc_exit(net);
+#endif
 out_proc:
 	nl_fib_lookup_exit(net);
 out_nlfl:
@@ -1607,9 +1825,11 @@ static int __net_init fib_net_init(struct net *net)
 
 static void __net_exit fib_net_exit(struct net *net)
 {
+	remove_proc_entry("fib_lookup_cache", net->proc_net_stat);
 	fib_proc_exit(net);
 	nl_fib_lookup_exit(net);
 	ip_fib_net_exit(net);
+	fib_lookup_cache_free(net);
 }
 
 static struct pernet_operations fib_net_ops = {
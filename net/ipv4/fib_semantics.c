@@ -253,6 +253,7 @@ void free_fib_info(struct fib_info *fi)
 		return;
 	}
 
+	fib_lookup_cache_invalidate();
 	call_rcu(&fi->rcu, free_fib_info_rcu);
 }
 EXPORT_SYMBOL_GPL(free_fib_info);
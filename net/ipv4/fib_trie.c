@@ -298,6 +298,7 @@ static void __alias_free_mem(struct rcu_head *head)
 
 static inline void alias_free_mem_rcu(struct fib_alias *fa)
 {
+	fib_lookup_cache_invalidate();
 	call_rcu(&fa->rcu, __alias_free_mem);
 }
 
@@ -314,7 +315,12 @@ static void __node_free_rcu(struct rcu_head *head)
 		kvfree(n);
 }
 
-#define node_free(n) call_rcu(&tn_info(n)->rcu, __node_free_rcu)
+static void node_free(struct key_vector *n)
+{
+	/* a cached fib_result may point at the leaf's hlist head */
+	fib_lookup_cache_invalidate();
+	call_rcu(&tn_info(n)->rcu, __node_free_rcu);
+}
 
 static struct tnode *tnode_alloc(int bits)
 {
@@ -2216,6 +2222,7 @@ static void __trie_free_rcu(struct rcu_head *head)
 
 void fib_free_table(struct fib_table *tb)
 {
+	fib_lookup_cache_invalidate();
 	call_rcu(&tb->rcu, __trie_free_rcu);
 }
 
@@ -389,6 +389,25 @@ void sock_edemux(struct sk_buff *skb)
 }
 EXPORT_SYMBOL(sock_edemux);
 
+/* Prefetch the established hash bucket __inet_lookup_established() will
+ * walk for this tuple and return it, so that batched callers can issue
+ * the loads for a group of packets before doing any of the lookups.
+ */
+struct inet_ehash_bucket *inet_ehash_prefetch(const struct net *net,
+					      struct inet_hashinfo *hashinfo,
+					      const __be32 saddr,
+					      const __be16 sport,
+					      const __be32 daddr,
+					      const u16 hnum)
+{
+	unsigned int hash = inet_ehashfn(net, daddr, hnum, saddr, sport);
+	struct inet_ehash_bucket *head = inet_ehash_bucket(hashinfo, hash);
+
+	prefetch(head);
+	return head;
+}
+EXPORT_SYMBOL_GPL(inet_ehash_prefetch);
+
 struct sock *__inet_lookup_established(struct net *net,
 				  struct inet_hashinfo *hashinfo,
 				  const __be32 saddr, const __be16 sport,
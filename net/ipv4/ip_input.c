@@ -310,6 +310,7 @@ static bool ip_can_use_hint(const struct sk_buff *skb, const struct iphdr *iph,
 }
 
 int tcp_v4_early_demux(struct sk_buff *skb);
+void tcp_v4_early_demux_prefetch(struct net *net, struct list_head *head);
 int udp_v4_early_demux(struct sk_buff *skb);
 static int ip_rcv_finish_core(struct net *net, struct sock *sk,
 			      struct sk_buff *skb, struct net_device *dev,
@@ -579,6 +580,10 @@ static void ip_list_rcv_finish(struct net *net, struct sock *sk,
 	struct dst_entry *curr_dst = NULL;
 	struct list_head sublist;
 
+	if (READ_ONCE(net->ipv4.sysctl_ip_early_demux) &&
+	    READ_ONCE(net->ipv4.sysctl_tcp_early_demux))
+		tcp_v4_early_demux_prefetch(net, head);
+
 	INIT_LIST_HEAD(&sublist);
 	list_for_each_entry_safe(skb, next, head, list) {
 		struct net_device *dev = skb->dev;
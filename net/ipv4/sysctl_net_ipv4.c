@@ -393,6 +393,32 @@ static int proc_tcp_available_ulp(struct ctl_table *ctl,
 	return ret;
 }
 
+static int proc_fib_lookup_cache(struct ctl_table *table, int write,
+				 void *buffer, size_t *lenp, loff_t *ppos)
+{
+	struct net *net = container_of(table->data, struct net,
+	    ipv4.sysctl_fib_lookup_cache);
+	int val = READ_ONCE(net->ipv4.sysctl_fib_lookup_cache);
+	struct ctl_table tmp = {
+		.data = &val,
+		.maxlen = sizeof(val),
+		.mode = table->mode,
+		.extra1 = SYSCTL_ZERO,
+		.extra2 = SYSCTL_ONE,
+	};
+	int ret;
+
+	ret = proc_dointvec_minmax(&tmp, write, buffer, lenp, ppos);
+	if (write && ret == 0) {
+		if (val)
+			ret = fib_lookup_cache_enable(net);
+		if (ret == 0)
+			WRITE_ONCE(net->ipv4.sysctl_fib_lookup_cache, val);
+	}
+
+	return ret;
+}
+
 #ifdef CONFIG_IP_ROUTE_MULTIPATH
 static int proc_fib_multipath_hash_policy(struct ctl_table *table, int write,
 					  void *buffer, size_t *lenp,
@@ -991,6 +1017,13 @@ static struct ctl_table ipv4_net_table[] = {
 		.extra2		= &two,
 	},
 #endif
+	{
+		.procname	= "fib_lookup_cache",
+		.data		= &init_net.ipv4.sysctl_fib_lookup_cache,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_fib_lookup_cache,
+	},
 	{
 		.procname	= "ip_unprivileged_port_start",
 		.maxlen		= sizeof(int),
@@ -727,8 +727,10 @@ void tcp_push(struct sock *sk, int flags, int mss_now,
 		/* It is possible TX completion already happened
 		 * before we set TSQ_THROTTLED.
 		 */
-		if (refcount_read(&sk->sk_wmem_alloc) > skb->truesize)
+		if (refcount_read(&sk->sk_wmem_alloc) > skb->truesize) {
+			tcp_defer_start(sk, TCP_DEFER_AUTOCORK);
 			return;
+		}
 	}
 
 	if (flags & MSG_MORE)
@@ -923,7 +925,7 @@ static unsigned int tcp_xmit_size_goal(struct sock *sk, u32 mss_now,
 		return mss_now;
 
 	/* Note : tcp_tso_autosize() will eventually split this later */
-	new_size_goal = sk->sk_gso_max_size - 1 - MAX_TCP_HEADER;
+	new_size_goal = sk->sk_gso_max_size;
 	new_size_goal = tcp_bound_to_half_wnd(tp, new_size_goal);
 
 	/* We try hard to avoid divides here */
@@ -1814,47 +1816,103 @@ static int tcp_zerocopy_handle_leftover_data(struct tcp_zerocopy_receive *zc,
 		offset = *seq - TCP_SKB_CB(skb)->seq;
 	else
 		skb = tcp_recv_skb(sk, *seq, &offset);
+	if (!skb)
+		return 0;
+	/* The straggler copy never crosses into the next skb. */
+	copylen = min_t(u32, copylen, skb->len - offset);
 
 	zc->copybuf_len = tcp_copy_straggler_data(zc, skb, copylen, &offset,
 						  seq);
 	return zc->copybuf_len < 0 ? 0 : copylen;
 }
 
+static int tcp_zerocopy_vm_insert_batch_error(struct vm_area_struct *vma,
+					      struct page **pending_pages,
+					      unsigned long pages_remaining,
+					      unsigned long *address,
+					      u32 *length,
+					      u32 *seq,
+					      struct tcp_zerocopy_receive *zc,
+					      u32 total_bytes_to_map,
+					      int err)
+{
+	/* At least one page did not map. If the range was not zapped up
+	 * front, something is still mapped there: zap what is left of the
+	 * range now and retry.
+	 */
+	if (err == -EBUSY &&
+	    zc->flags & TCP_RECEIVE_ZEROCOPY_FLAG_TLB_CLEAN_HINT) {
+		u32 maybe_zap_len;
+
+		maybe_zap_len = total_bytes_to_map -  /* All bytes to map */
+				*length + /* Mapped or pending */
+				(pages_remaining * PAGE_SIZE); /* Failed map. */
+		zap_page_range(vma, *address, maybe_zap_len);
+		err = 0;
+	}
+
+	if (!err) {
+		unsigned long leftover_pages = pages_remaining;
+		int bytes_mapped;
+
+		err = vm_insert_pages(vma, *address, pending_pages,
+				      &pages_remaining);
+		bytes_mapped = PAGE_SIZE * (leftover_pages - pages_remaining);
+		*seq += bytes_mapped;
+		*address += bytes_mapped;
+	}
+	if (err) {
+		/* Either we could not zap, or the retry failed as well:
+		 * unroll the state we speculatively touched before for the
+		 * pages that are still not mapped.
+		 */
+		const int bytes_not_mapped = PAGE_SIZE * pages_remaining;
+
+		*length -= bytes_not_mapped;
+		zc->recv_skip_hint += bytes_not_mapped;
+	}
+	return err;
+}
+
 static int tcp_zerocopy_vm_insert_batch(struct vm_area_struct *vma,
 					struct page **pages,
-					unsigned long pages_to_map,
-					unsigned long *insert_addr,
-					u32 *length_with_pending,
+					unsigned int pages_to_map,
+					unsigned long *address,
+					u32 *length,
 					u32 *seq,
-					struct tcp_zerocopy_receive *zc)
+					struct tcp_zerocopy_receive *zc,
+					u32 total_bytes_to_map)
 {
 	unsigned long pages_remaining = pages_to_map;
-	int bytes_mapped;
-	int ret;
+	unsigned int pages_mapped;
+	unsigned int bytes_mapped;
+	int err;
 
-	ret = vm_insert_pages(vma, *insert_addr, pages, &pages_remaining);
-	bytes_mapped = PAGE_SIZE * (pages_to_map - pages_remaining);
+	err = vm_insert_pages(vma, *address, pages, &pages_remaining);
+	pages_mapped = pages_to_map - (unsigned int)pages_remaining;
+	bytes_mapped = PAGE_SIZE * pages_mapped;
 	/* Even if vm_insert_pages fails, it may have partially succeeded in
 	 * mapping (some but not all of the pages).
 	 */
 	*seq += bytes_mapped;
-	*insert_addr += bytes_mapped;
-	if (ret) {
-		/* But if vm_insert_pages did fail, we have to unroll some state
-		 * we speculatively touched before.
-		 */
-		const int bytes_not_mapped = PAGE_SIZE * pages_remaining;
-		*length_with_pending -= bytes_not_mapped;
-		zc->recv_skip_hint += bytes_not_mapped;
-	}
-	return ret;
+	*address += bytes_mapped;
+
+	if (likely(!err))
+		return 0;
+
+	/* Error: maybe zap and retry + rollback state for failed inserts. */
+	return tcp_zerocopy_vm_insert_batch_error(vma, pages + pages_mapped,
+						  pages_remaining, address,
+						  length, seq, zc,
+						  total_bytes_to_map, err);
 }
 
 static int tcp_zerocopy_receive(struct sock *sk,
 				struct tcp_zerocopy_receive *zc)
 {
-	u32 length = 0, offset, vma_len, avail_len, aligned_len, copylen = 0;
+	u32 length = 0, offset, vma_len, avail_len, copylen = 0;
 	unsigned long address = (unsigned long)zc->address;
+	u32 total_bytes_to_map;
 	s32 copybuf_len = zc->copybuf_len;
 	struct tcp_sock *tp = tcp_sk(sk);
 	#define PAGE_BATCH_SIZE 8
@@ -1878,6 +1936,16 @@ static int tcp_zerocopy_receive(struct sock *sk,
 
 	sock_rps_record_flow(sk);
 
+	/* Nothing can be mapped: skip the mmap lock and vma lookup and go
+	 * straight to the copybuf.
+	 */
+	if (inq < PAGE_SIZE) {
+		zc->length = 0;
+		zc->recv_skip_hint = inq;
+		ret = 0;
+		goto out_copy;
+	}
+
 	mmap_read_lock(current->mm);
 
 	vma = find_vma(current->mm, address);
@@ -1887,10 +1955,15 @@ static int tcp_zerocopy_receive(struct sock *sk,
 	}
 	vma_len = min_t(unsigned long, zc->length, vma->vm_end - address);
 	avail_len = min_t(u32, vma_len, inq);
-	aligned_len = avail_len & ~(PAGE_SIZE - 1);
-	if (aligned_len) {
-		zap_page_range(vma, address, aligned_len);
-		zc->length = aligned_len;
+	total_bytes_to_map = avail_len & ~(PAGE_SIZE - 1);
+	if (total_bytes_to_map) {
+		/* With the clean hint the caller promises the range holds no
+		 * stale mappings, so the zap and its TLB flush are deferred
+		 * until vm_insert_pages() actually finds a page in the way.
+		 */
+		if (!(zc->flags & TCP_RECEIVE_ZEROCOPY_FLAG_TLB_CLEAN_HINT))
+			zap_page_range(vma, address, total_bytes_to_map);
+		zc->length = total_bytes_to_map;
 		zc->recv_skip_hint = 0;
 	} else {
 		zc->length = avail_len;
@@ -1908,7 +1981,8 @@ static int tcp_zerocopy_receive(struct sock *sk,
 								   pg_idx,
 								   &curr_addr,
 								   &length,
-								   &seq, zc);
+								   &seq, zc,
+								   total_bytes_to_map);
 				if (ret)
 					goto out;
 				pg_idx = 0;
@@ -1945,7 +2019,8 @@ static int tcp_zerocopy_receive(struct sock *sk,
 		if (pg_idx == PAGE_BATCH_SIZE) {
 			ret = tcp_zerocopy_vm_insert_batch(vma, pages, pg_idx,
 							   &curr_addr, &length,
-							   &seq, zc);
+							   &seq, zc,
+							   total_bytes_to_map);
 			if (ret)
 				goto out;
 			pg_idx = 0;
@@ -1954,10 +2029,11 @@ static int tcp_zerocopy_receive(struct sock *sk,
 	if (pg_idx) {
 		ret = tcp_zerocopy_vm_insert_batch(vma, pages, pg_idx,
 						   &curr_addr, &length, &seq,
-						   zc);
+						   zc, total_bytes_to_map);
 	}
 out:
 	mmap_read_unlock(current->mm);
+out_copy:
 	/* Try to copy straggler data. */
 	if (!ret)
 		copylen = tcp_zerocopy_handle_leftover_data(zc, sk, skb, &seq,
@@ -3474,6 +3550,34 @@ static void tcp_get_info_chrono_stats(const struct tcp_sock *tp,
 	info->tcpi_sndbuf_limited = stats[TCP_CHRONO_SNDBUF_LIMITED];
 }
 
+static void tcp_get_info_defer_stats(const struct tcp_sock *tp,
+				     struct tcp_info *info)
+{
+	u64 stats[__TCP_DEFER_MAX];
+	enum tcp_defer i;
+
+	for (i = TCP_DEFER_TSO; i < __TCP_DEFER_MAX; ++i) {
+		stats[i] = tp->defer_stat[i - 1];
+		if (i == tp->defer_type)
+			stats[i] += tcp_jiffies32 - tp->defer_start;
+		stats[i] *= USEC_PER_SEC / HZ;
+	}
+
+	info->tcpi_defer_tso = tp->defer_events[TCP_DEFER_TSO - 1];
+	info->tcpi_defer_tsq = tp->defer_events[TCP_DEFER_TSQ - 1];
+	info->tcpi_defer_cwnd = tp->defer_events[TCP_DEFER_CWND - 1];
+	info->tcpi_defer_rwnd = tp->defer_events[TCP_DEFER_RWND - 1];
+	info->tcpi_defer_pacing = tp->defer_events[TCP_DEFER_PACING - 1];
+	info->tcpi_defer_autocork = tp->defer_events[TCP_DEFER_AUTOCORK - 1];
+
+	info->tcpi_defer_tso_time = stats[TCP_DEFER_TSO];
+	info->tcpi_defer_tsq_time = stats[TCP_DEFER_TSQ];
+	info->tcpi_defer_cwnd_time = stats[TCP_DEFER_CWND];
+	info->tcpi_defer_rwnd_time = stats[TCP_DEFER_RWND];
+	info->tcpi_defer_pacing_time = stats[TCP_DEFER_PACING];
+	info->tcpi_defer_autocork_time = stats[TCP_DEFER_AUTOCORK];
+}
+
 /* Return information about state of tcp endpoint in API format. */
 void tcp_get_info(struct sock *sk, struct tcp_info *info)
 {
@@ -3568,6 +3672,7 @@ void tcp_get_info(struct sock *sk, struct tcp_info *info)
 	info->tcpi_bytes_received = tp->bytes_received;
 	info->tcpi_notsent_bytes = max_t(int, 0, tp->write_seq - tp->snd_nxt);
 	tcp_get_info_chrono_stats(tp, info);
+	tcp_get_info_defer_stats(tp, info);
 
 	info->tcpi_segs_out = tp->segs_out;
 	info->tcpi_segs_in = tp->segs_in;
@@ -3952,6 +4057,12 @@ static int do_tcp_getsockopt(struct sock *sk, int level,
 		}
 		if (copy_from_user(&zc, optval, len))
 			return -EFAULT;
+		/* No control messages are delivered here yet, so there is
+		 * nothing msg_flags could ask for.
+		 */
+		if (zc.reserved || zc.msg_flags ||
+		    zc.flags & ~TCP_RECEIVE_ZEROCOPY_FLAG_TLB_CLEAN_HINT)
+			return -EINVAL;
 		lock_sock(sk);
 		err = tcp_zerocopy_receive(sk, &zc);
 		release_sock(sk);
@@ -1770,6 +1770,51 @@ int tcp_v4_early_demux(struct sk_buff *skb)
 	return 0;
 }
 
+/* Batched companion of tcp_v4_early_demux() for the list receive path.
+ * With many established sockets each lookup is a cache miss on a random
+ * ehash bucket followed by one on the socket it holds.  Issue the bucket
+ * loads for the whole batch first, then the loads of the first socket in
+ * each chain, so that the per-packet lookups overlap their misses instead
+ * of stalling on them one after the other.
+ */
+#define TCP_EDEMUX_PREFETCH_MAX	64
+
+void tcp_v4_early_demux_prefetch(struct net *net, struct list_head *head)
+{
+	struct inet_ehash_bucket *buckets[TCP_EDEMUX_PREFETCH_MAX];
+	struct hlist_nulls_node *node;
+	const struct tcphdr *th;
+	const struct iphdr *iph;
+	struct sk_buff *skb;
+	int i, n = 0;
+
+	list_for_each_entry(skb, head, list) {
+		iph = ip_hdr(skb);
+		if (iph->protocol != IPPROTO_TCP ||
+		    skb->pkt_type != PACKET_HOST ||
+		    skb->sk || skb_dst(skb) || ip_is_fragment(iph))
+			continue;
+
+		/* no pulling here, tcp_v4_early_demux() will do it */
+		if (skb_transport_offset(skb) + sizeof(*th) > skb_headlen(skb))
+			continue;
+
+		th = tcp_hdr(skb);
+		buckets[n] = inet_ehash_prefetch(net, &tcp_hashinfo,
+						 iph->saddr, th->source,
+						 iph->daddr, ntohs(th->dest));
+		if (++n == TCP_EDEMUX_PREFETCH_MAX)
+			break;
+	}
+
+	for (i = 0; i < n; i++) {
+		node = rcu_dereference_raw(hlist_nulls_first_rcu(&buckets[i]->chain));
+		if (!is_a_nulls(node))
+			prefetch(hlist_nulls_entry(node, struct sock,
+						   sk_nulls_node));
+	}
+}
+
 bool tcp_add_backlog(struct sock *sk, struct sk_buff *skb)
 {
 	u32 limit, tail_gso_size, tail_gso_segs;
@@ -2675,6 +2720,20 @@ static int tcp4_seq_show(struct seq_file *seq, void *v)
 }
 
 #ifdef CONFIG_BPF_SYSCALL
+/* The bpf iterator collects the matching sockets of one bucket into a
+ * batch, taking a reference on each, and drops the bucket lock before
+ * running the program.  The program then runs with the socket itself
+ * locked, which lets it call bpf_setsockopt() and friends.
+ */
+struct bpf_tcp_iter_state {
+	struct tcp_iter_state state;
+	unsigned int cur_sk;
+	unsigned int end_sk;
+	unsigned int max_sk;
+	struct sock **batch;
+	bool st_bucket_done;
+};
+
 struct bpf_iter__tcp {
 	__bpf_md_ptr(struct bpf_iter_meta *, meta);
 	__bpf_md_ptr(struct sock_common *, sk_common);
@@ -2693,16 +2752,208 @@ static int tcp_prog_seq_show(struct bpf_prog *prog, struct bpf_iter_meta *meta,
 	return bpf_iter_run_prog(prog, &ctx);
 }
 
+static void bpf_iter_tcp_put_batch(struct bpf_tcp_iter_state *iter)
+{
+	/* The established hash also holds timewait and request socks */
+	while (iter->cur_sk < iter->end_sk)
+		sock_gen_put(iter->batch[iter->cur_sk++]);
+}
+
+static int bpf_iter_tcp_realloc_batch(struct bpf_tcp_iter_state *iter,
+				      unsigned int new_batch_sz)
+{
+	struct sock **new_batch;
+
+	new_batch = kvmalloc_array(new_batch_sz, sizeof(*new_batch),
+				   GFP_USER | __GFP_NOWARN);
+	if (!new_batch)
+		return -ENOMEM;
+
+	bpf_iter_tcp_put_batch(iter);
+	kvfree(iter->batch);
+	iter->batch = new_batch;
+	iter->max_sk = new_batch_sz;
+
+	return 0;
+}
+
+static bool bpf_iter_tcp_sk_match(struct seq_file *seq, struct sock *sk)
+{
+	struct bpf_tcp_iter_state *iter = seq->private;
+	unsigned short family = iter->state.bpf_seq_afinfo->family;
+
+	return (family == AF_UNSPEC || family == sk->sk_family) &&
+	       net_eq(sock_net(sk), seq_file_net(seq));
+}
+
+/* Called with the listening bucket lock held by tcp_seek_last_pos(),
+ * returns the number of matching sockets in the bucket from start_sk on,
+ * which may be more than the batch could take.
+ */
+static unsigned int bpf_iter_tcp_listening_batch(struct seq_file *seq,
+						 struct sock *start_sk)
+{
+	struct bpf_tcp_iter_state *iter = seq->private;
+	struct tcp_iter_state *st = &iter->state;
+	struct hlist_nulls_node *node;
+	unsigned int expected = 1;
+	struct sock *sk;
+
+	sock_hold(start_sk);
+	iter->batch[iter->end_sk++] = start_sk;
+
+	sk = sk_nulls_next(start_sk);
+	sk_nulls_for_each_from(sk, node) {
+		if (bpf_iter_tcp_sk_match(seq, sk)) {
+			if (iter->end_sk < iter->max_sk) {
+				sock_hold(sk);
+				iter->batch[iter->end_sk++] = sk;
+			}
+			expected++;
+		}
+	}
+	spin_unlock(&tcp_hashinfo.listening_hash[st->bucket].lock);
+
+	return expected;
+}
+
+static unsigned int bpf_iter_tcp_established_batch(struct seq_file *seq,
+						   struct sock *start_sk)
+{
+	struct bpf_tcp_iter_state *iter = seq->private;
+	struct tcp_iter_state *st = &iter->state;
+	struct hlist_nulls_node *node;
+	unsigned int expected = 1;
+	struct sock *sk;
+
+	sock_hold(start_sk);
+	iter->batch[iter->end_sk++] = start_sk;
+
+	sk = sk_nulls_next(start_sk);
+	sk_nulls_for_each_from(sk, node) {
+		if (bpf_iter_tcp_sk_match(seq, sk)) {
+			if (iter->end_sk < iter->max_sk) {
+				sock_hold(sk);
+				iter->batch[iter->end_sk++] = sk;
+			}
+			expected++;
+		}
+	}
+	spin_unlock_bh(inet_ehash_lockp(&tcp_hashinfo, st->bucket));
+
+	return expected;
+}
+
+static struct sock *bpf_iter_tcp_batch(struct seq_file *seq)
+{
+	struct bpf_tcp_iter_state *iter = seq->private;
+	struct tcp_iter_state *st = &iter->state;
+	unsigned int expected;
+	bool resized = false;
+	struct sock *sk;
+
+	/* The whole of st->bucket has been shown, go straight to the next
+	 * bucket instead of letting tcp_seek_last_pos() skip over it one
+	 * socket at a time.
+	 */
+	if (iter->st_bucket_done) {
+		st->offset = 0;
+		st->bucket++;
+		if (st->state == TCP_SEQ_STATE_LISTENING &&
+		    st->bucket >= INET_LHTABLE_SIZE) {
+			st->state = TCP_SEQ_STATE_ESTABLISHED;
+			st->bucket = 0;
+		}
+	}
+
+again:
+	iter->cur_sk = 0;
+	iter->end_sk = 0;
+	iter->st_bucket_done = false;
+
+	sk = tcp_seek_last_pos(seq);
+	if (!sk)
+		return NULL;
+
+	if (st->state == TCP_SEQ_STATE_LISTENING)
+		expected = bpf_iter_tcp_listening_batch(seq, sk);
+	else
+		expected = bpf_iter_tcp_established_batch(seq, sk);
+
+	if (iter->end_sk == expected) {
+		iter->st_bucket_done = true;
+		return sk;
+	}
+
+	/* Grow once and retry the bucket; if that still falls short, the
+	 * rest of the bucket is picked up by the next tcp_seek_last_pos().
+	 */
+	if (!resized && !bpf_iter_tcp_realloc_batch(iter, expected * 3 / 2)) {
+		resized = true;
+		goto again;
+	}
+
+	return sk;
+}
+
+static void *bpf_iter_tcp_seq_start(struct seq_file *seq, loff_t *pos)
+{
+	/* bpf iter does not support lseek, so it always continues from
+	 * where it was stop()-ped.
+	 */
+	if (*pos)
+		return bpf_iter_tcp_batch(seq);
+
+	return SEQ_START_TOKEN;
+}
+
+static void *bpf_iter_tcp_seq_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	struct bpf_tcp_iter_state *iter = seq->private;
+	struct tcp_iter_state *st = &iter->state;
+	struct sock *sk;
+
+	/* iter->cur_sk has been shown, move on to the next one.  st->offset
+	 * follows along so that a later start() resumes in st->bucket right
+	 * after it, see tcp_seek_last_pos().
+	 */
+	if (iter->cur_sk < iter->end_sk) {
+		st->num++;
+		st->offset++;
+		sock_gen_put(iter->batch[iter->cur_sk++]);
+	}
+
+	if (iter->cur_sk < iter->end_sk)
+		sk = iter->batch[iter->cur_sk];
+	else
+		sk = bpf_iter_tcp_batch(seq);
+
+	++*pos;
+	st->last_pos = *pos;
+	return sk;
+}
+
 static int bpf_iter_tcp_seq_show(struct seq_file *seq, void *v)
 {
 	struct bpf_iter_meta meta;
 	struct bpf_prog *prog;
 	struct sock *sk = v;
+	bool slow;
 	uid_t uid;
+	int ret;
 
 	if (v == SEQ_START_TOKEN)
 		return 0;
 
+	if (sk_fullsock(sk))
+		slow = lock_sock_fast(sk);
+
+	/* Closed while it sat in the batch */
+	if (unlikely(sk_unhashed(sk))) {
+		ret = SEQ_SKIP;
+		goto unlock;
+	}
+
 	if (sk->sk_state == TCP_TIME_WAIT) {
 		uid = 0;
 	} else if (sk->sk_state == TCP_NEW_SYN_RECV) {
@@ -2716,11 +2967,17 @@ static int bpf_iter_tcp_seq_show(struct seq_file *seq, void *v)
 
 	meta.seq = seq;
 	prog = bpf_iter_get_info(&meta, false);
-	return tcp_prog_seq_show(prog, &meta, v, uid);
+	ret = tcp_prog_seq_show(prog, &meta, v, uid);
+
+unlock:
+	if (sk_fullsock(sk))
+		unlock_sock_fast(sk, slow);
+	return ret;
 }
 
 static void bpf_iter_tcp_seq_stop(struct seq_file *seq, void *v)
 {
+	struct bpf_tcp_iter_state *iter = seq->private;
 	struct bpf_iter_meta meta;
 	struct bpf_prog *prog;
 
@@ -2731,13 +2988,19 @@ static void bpf_iter_tcp_seq_stop(struct seq_file *seq, void *v)
 			(void)tcp_prog_seq_show(prog, &meta, v, 0);
 	}
 
-	tcp_seq_stop(seq, v);
+	/* Stopped in the middle of a batch, the next start() seeks back
+	 * into the same bucket.
+	 */
+	if (iter->cur_sk < iter->end_sk) {
+		bpf_iter_tcp_put_batch(iter);
+		iter->st_bucket_done = false;
+	}
 }
 
 static const struct seq_operations bpf_iter_tcp_seq_ops = {
 	.show		= bpf_iter_tcp_seq_show,
-	.start		= tcp_seq_start,
-	.next		= tcp_seq_next,
+	.start		= bpf_iter_tcp_seq_start,
+	.next		= bpf_iter_tcp_seq_next,
 	.stop		= bpf_iter_tcp_seq_stop,
 };
 #endif
@@ -2973,9 +3236,11 @@ static struct pernet_operations __net_initdata tcp_sk_ops = {
 DEFINE_BPF_ITER_FUNC(tcp, struct bpf_iter_meta *meta,
 		     struct sock_common *sk_common, uid_t uid)
 
+#define INIT_BATCH_SZ 16
+
 static int bpf_iter_init_tcp(void *priv_data, struct bpf_iter_aux_info *aux)
 {
-	struct tcp_iter_state *st = priv_data;
+	struct bpf_tcp_iter_state *iter = priv_data;
 	struct tcp_seq_afinfo *afinfo;
 	int ret;
 
@@ -2984,28 +3249,54 @@ static int bpf_iter_init_tcp(void *priv_data, struct bpf_iter_aux_info *aux)
 		return -ENOMEM;
 
 	afinfo->family = AF_UNSPEC;
-	st->bpf_seq_afinfo = afinfo;
+	iter->state.bpf_seq_afinfo = afinfo;
 	ret = bpf_iter_init_seq_net(priv_data, aux);
 	if (ret)
-		kfree(afinfo);
+		goto free_afinfo;
+
+	ret = bpf_iter_tcp_realloc_batch(iter, INIT_BATCH_SZ);
+	if (ret)
+		goto fini_seq_net;
+
+	return 0;
+
+fini_seq_net:
+	bpf_iter_fini_seq_net(priv_data);
+free_afinfo:
+	kfree(afinfo);
 	return ret;
 }
 
 static void bpf_iter_fini_tcp(void *priv_data)
 {
-	struct tcp_iter_state *st = priv_data;
+	struct bpf_tcp_iter_state *iter = priv_data;
 
-	kfree(st->bpf_seq_afinfo);
+	kfree(iter->state.bpf_seq_afinfo);
 	bpf_iter_fini_seq_net(priv_data);
+	kvfree(iter->batch);
 }
 
 static const struct bpf_iter_seq_info tcp_seq_info = {
 	.seq_ops		= &bpf_iter_tcp_seq_ops,
 	.init_seq_private	= bpf_iter_init_tcp,
 	.fini_seq_private	= bpf_iter_fini_tcp,
-	.seq_priv_size		= sizeof(struct tcp_iter_state),
+	.seq_priv_size		= sizeof(struct bpf_tcp_iter_state),
 };
 
+static const struct bpf_func_proto *
+bpf_iter_tcp_get_func_proto(enum bpf_func_id func_id,
+			    const struct bpf_prog *prog)
+{
+	switch (func_id) {
+	case BPF_FUNC_setsockopt:
+		return &bpf_sk_setsockopt_proto;
+	case BPF_FUNC_getsockopt:
+		return &bpf_sk_getsockopt_proto;
+	default:
+		return NULL;
+	}
+}
+
 static struct bpf_iter_reg tcp_reg_info = {
 	.target			= "tcp",
 	.ctx_arg_info_size	= 1,
@@ -3013,6 +3304,7 @@ static struct bpf_iter_reg tcp_reg_info = {
 		{ offsetof(struct bpf_iter__tcp, sk_common),
 		  PTR_TO_BTF_ID_OR_NULL },
 	},
+	.get_func_proto		= bpf_iter_tcp_get_func_proto,
 	.seq_info		= &tcp_seq_info,
 };
 
@@ -1550,7 +1550,7 @@ int tcp_fragment(struct sock *sk, enum tcp_queue tcp_queue,
 	 * SO_SNDBUF values.
 	 * Also allow first and last skb in retransmit queue to be split.
 	 */
-	limit = sk->sk_sndbuf + 2 * SKB_TRUESIZE(GSO_MAX_SIZE);
+	limit = sk->sk_sndbuf + 2 * SKB_TRUESIZE(GSO_LEGACY_MAX_SIZE);
 	if (unlikely((sk->sk_wmem_queued >> 1) > limit &&
 		     tcp_queue != TCP_FRAG_IN_WRITE_QUEUE &&
 		     skb != tcp_rtx_queue_head(sk) &&
@@ -1967,7 +1967,7 @@ static u32 tcp_tso_autosize(const struct sock *sk, unsigned int mss_now,
 
 	bytes = min_t(unsigned long,
 		      sk->sk_pacing_rate >> READ_ONCE(sk->sk_pacing_shift),
-		      sk->sk_gso_max_size - 1 - MAX_TCP_HEADER);
+		      sk->sk_gso_max_size);
 
 	/* Goal is to send at least one packet per ms,
 	 * not one big TSO packet every 100 ms.
@@ -2582,6 +2582,42 @@ void tcp_chrono_stop(struct sock *sk, const enum tcp_chrono type)
 		tcp_chrono_set(tp, TCP_CHRONO_BUSY);
 }
 
+static void tcp_defer_set(struct tcp_sock *tp, const enum tcp_defer new)
+{
+	const u32 now = tcp_jiffies32;
+	enum tcp_defer old = tp->defer_type;
+
+	if (old > TCP_DEFER_NONE)
+		tp->defer_stat[old - 1] += now - tp->defer_start;
+	if (new > TCP_DEFER_NONE)
+		tp->defer_events[new - 1]++;
+	tp->defer_start = now;
+	tp->defer_type = new;
+}
+
+/* Queued data is being held back for @type.  A deferral episode lasts
+ * until data moves again or the reason changes, so repeated calls for
+ * the same reason only extend the current one.
+ */
+void tcp_defer_start(struct sock *sk, const enum tcp_defer type)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	BUILD_BUG_ON(__TCP_DEFER_MAX - 1 > ARRAY_SIZE(tp->defer_stat));
+
+	trace_tcp_defer(sk, type);
+	if (type != tp->defer_type)
+		tcp_defer_set(tp, type);
+}
+
+void tcp_defer_stop(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (tp->defer_type != TCP_DEFER_NONE)
+		tcp_defer_set(tp, TCP_DEFER_NONE);
+}
+
 /* This routine writes packets to the network.  It advances the
  * send_head.  This happens as incoming acks open up the remote
  * window for us.
@@ -2599,6 +2635,7 @@ void tcp_chrono_stop(struct sock *sk, const enum tcp_chrono type)
 static bool tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 			   int push_one, gfp_t gfp)
 {
+	enum tcp_defer deferred = TCP_DEFER_NONE;
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct sk_buff *skb;
 	unsigned int tso_segs, sent_pkts;
@@ -2632,23 +2669,28 @@ static bool tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 			goto repair; /* Skip network transmission */
 		}
 
-		if (tcp_pacing_check(sk))
+		if (tcp_pacing_check(sk)) {
+			deferred = TCP_DEFER_PACING;
 			break;
+		}
 
 		tso_segs = tcp_init_tso_segs(skb, mss_now);
 		BUG_ON(!tso_segs);
 
 		cwnd_quota = tcp_cwnd_test(tp, skb);
 		if (!cwnd_quota) {
-			if (push_one == 2)
+			if (push_one == 2) {
 				/* Force out a loss probe pkt. */
 				cwnd_quota = 1;
-			else
+			} else {
+				deferred = TCP_DEFER_CWND;
 				break;
+			}
 		}
 
 		if (unlikely(!tcp_snd_wnd_test(tp, skb, mss_now))) {
 			is_rwnd_limited = true;
+			deferred = TCP_DEFER_RWND;
 			break;
 		}
 
@@ -2660,8 +2702,10 @@ static bool tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 		} else {
 			if (!push_one &&
 			    tcp_tso_should_defer(sk, skb, &is_cwnd_limited,
-						 &is_rwnd_limited, max_segs))
+						 &is_rwnd_limited, max_segs)) {
+				deferred = TCP_DEFER_TSO;
 				break;
+			}
 		}
 
 		limit = mss_now;
@@ -2676,8 +2720,10 @@ static bool tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 		    unlikely(tso_fragment(sk, skb, limit, mss_now, gfp)))
 			break;
 
-		if (tcp_small_queue_check(sk, skb, 0))
+		if (tcp_small_queue_check(sk, skb, 0)) {
+			deferred = TCP_DEFER_TSQ;
 			break;
+		}
 
 		/* Argh, we hit an empty skb(), presumably a thread
 		 * is sleeping in sendmsg()/sk_stream_wait_memory().
@@ -2708,6 +2754,11 @@ static bool tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 	else
 		tcp_chrono_stop(sk, TCP_CHRONO_RWND_LIMITED);
 
+	if (deferred)
+		tcp_defer_start(sk, deferred);
+	else
+		tcp_defer_stop(sk);
+
 	is_cwnd_limited |= (tcp_packets_in_flight(tp) >= tp->snd_cwnd);
 	if (likely(sent_pkts || is_cwnd_limited))
 		tcp_cwnd_validate(sk, is_cwnd_limited);
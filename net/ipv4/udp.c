@@ -1784,6 +1784,37 @@ struct sk_buff *__skb_recv_udp(struct sock *sk, unsigned int flags,
 }
 EXPORT_SYMBOL(__skb_recv_udp);
 
+/* Report the payload length of every datagram carried by @skb, so that a
+ * UDP_GRO_FRAGLIST reader can split one recvmsg() into the original
+ * datagrams.  A fraglist GRO packet keeps the first datagram in the head
+ * and one datagram per frag_list member; anything else is a single
+ * datagram.
+ */
+void udp_cmsg_recv_fraglist(struct msghdr *msg, struct sk_buff *skb)
+{
+	u16 segs[UDP_GRO_CNT_MAX];
+	unsigned int head = skb->len;
+	struct sk_buff *frag;
+	int n = 1;
+
+	/* IP reassembly also builds frag_list packets, leave those whole */
+	if (!(skb_shinfo(skb)->gso_type & SKB_GSO_FRAGLIST))
+		goto out;
+
+	skb_walk_frags(skb, frag) {
+		if (n == UDP_GRO_CNT_MAX) {
+			msg->msg_flags |= MSG_CTRUNC;
+			return;
+		}
+		segs[n++] = frag->len;
+		head -= frag->len;
+	}
+out:
+	segs[0] = head;
+	put_cmsg(msg, SOL_UDP, UDP_GRO_FRAGLIST, n * sizeof(segs[0]), segs);
+}
+EXPORT_SYMBOL_GPL(udp_cmsg_recv_fraglist);
+
 /*
  * 	This should be easy, if there is something there we
  * 	return it, otherwise we block.
@@ -1871,7 +1902,7 @@ int udp_recvmsg(struct sock *sk, struct msghdr *msg, size_t len, int noblock,
 							(struct sockaddr *)sin);
 	}
 
-	if (udp_sk(sk)->gro_enabled)
+	if (udp_sk(sk)->gro_enabled || udp_sk(sk)->gro_fraglist)
 		udp_cmsg_recv(msg, sk, skb);
 
 	if (inet->cmsg_flags)
@@ -2675,6 +2706,17 @@ int udp_lib_setsockopt(struct sock *sk, int level, int optname,
 		release_sock(sk);
 		break;
 
+	case UDP_GRO_FRAGLIST:
+		lock_sock(sk);
+
+		/* GRO needs the socket lookup to see this option */
+		if (valbool)
+			udp_tunnel_encap_enable(sk->sk_socket);
+		up->gro_fraglist = valbool;
+		up->accept_udp_fraglist = valbool;
+		release_sock(sk);
+		break;
+
 	/*
 	 * 	UDP-Lite's partial checksum coverage (RFC 3828).
 	 */
@@ -2763,6 +2805,10 @@ int udp_lib_getsockopt(struct sock *sk, int level, int optname,
 		val = up->gro_enabled;
 		break;
 
+	case UDP_GRO_FRAGLIST:
+		val = up->gro_fraglist;
+		break;
+
 	/* The following two cannot be changed on UDP sockets, the return is
 	 * always 0 (which corresponds to the full checksum coverage of UDP). */
 	case UDPLITE_SEND_CSCOV:
@@ -3024,6 +3070,22 @@ int udp4_seq_show(struct seq_file *seq, void *v)
 }
 
 #ifdef CONFIG_BPF_SYSCALL
+/* As for tcp, the bpf iterator takes a reference on the matching sockets
+ * of one bucket and runs the program with the bucket lock released and
+ * the socket locked.  iter->offset counts the sockets of state->bucket
+ * shown so far, so that a stopped iteration resumes within the bucket
+ * rather than re-walking the table from the start.
+ */
+struct bpf_udp_iter_state {
+	struct udp_iter_state state;
+	unsigned int cur_sk;
+	unsigned int end_sk;
+	unsigned int max_sk;
+	int offset;
+	struct sock **batch;
+	bool st_bucket_done;
+};
+
 struct bpf_iter__udp {
 	__bpf_md_ptr(struct bpf_iter_meta *, meta);
 	__bpf_md_ptr(struct udp_sock *, udp_sk);
@@ -3044,6 +3106,140 @@ static int udp_prog_seq_show(struct bpf_prog *prog, struct bpf_iter_meta *meta,
 	return bpf_iter_run_prog(prog, &ctx);
 }
 
+static void bpf_iter_udp_put_batch(struct bpf_udp_iter_state *iter)
+{
+	while (iter->cur_sk < iter->end_sk)
+		sock_put(iter->batch[iter->cur_sk++]);
+}
+
+static int bpf_iter_udp_realloc_batch(struct bpf_udp_iter_state *iter,
+				      unsigned int new_batch_sz)
+{
+	struct sock **new_batch;
+
+	new_batch = kvmalloc_array(new_batch_sz, sizeof(*new_batch),
+				   GFP_USER | __GFP_NOWARN);
+	if (!new_batch)
+		return -ENOMEM;
+
+	bpf_iter_udp_put_batch(iter);
+	kvfree(iter->batch);
+	iter->batch = new_batch;
+	iter->max_sk = new_batch_sz;
+
+	return 0;
+}
+
+static bool bpf_iter_udp_sk_match(struct seq_file *seq, struct sock *sk)
+{
+	struct bpf_udp_iter_state *iter = seq->private;
+	unsigned short family = iter->state.bpf_seq_afinfo->family;
+
+	return (family == AF_UNSPEC || family == sk->sk_family) &&
+	       net_eq(sock_net(sk), seq_file_net(seq));
+}
+
+static struct sock *bpf_iter_udp_batch(struct seq_file *seq)
+{
+	struct bpf_udp_iter_state *iter = seq->private;
+	struct udp_iter_state *state = &iter->state;
+	struct udp_table *udptable = state->bpf_seq_afinfo->udp_table;
+	unsigned int expected;
+	bool resized = false;
+	struct sock *sk;
+	int skip;
+
+	if (iter->st_bucket_done) {
+		state->bucket++;
+		iter->offset = 0;
+	}
+
+again:
+	iter->cur_sk = 0;
+	iter->end_sk = 0;
+	iter->st_bucket_done = false;
+	expected = 0;
+
+	for (; state->bucket <= udptable->mask; state->bucket++) {
+		struct udp_hslot *hslot = &udptable->hash[state->bucket];
+
+		if (hlist_empty(&hslot->head)) {
+			iter->offset = 0;
+			continue;
+		}
+
+		skip = iter->offset;
+		spin_lock_bh(&hslot->lock);
+		sk_for_each(sk, &hslot->head) {
+			if (!bpf_iter_udp_sk_match(seq, sk))
+				continue;
+			/* Already shown before the iterator was stopped */
+			if (skip) {
+				skip--;
+				continue;
+			}
+			if (iter->end_sk < iter->max_sk) {
+				sock_hold(sk);
+				iter->batch[iter->end_sk++] = sk;
+			}
+			expected++;
+		}
+		spin_unlock_bh(&hslot->lock);
+
+		if (expected)
+			break;
+		iter->offset = 0;
+	}
+
+	if (!expected)
+		return NULL;
+
+	if (iter->end_sk == expected) {
+		iter->st_bucket_done = true;
+		return iter->batch[0];
+	}
+
+	/* Grow once and retry the bucket, iter->offset is unchanged so the
+	 * same sockets are skipped again.
+	 */
+	if (!resized && !bpf_iter_udp_realloc_batch(iter, expected * 3 / 2)) {
+		resized = true;
+		goto again;
+	}
+
+	return iter->batch[0];
+}
+
+static void *bpf_iter_udp_seq_start(struct seq_file *seq, loff_t *pos)
+{
+	/* bpf iter does not support lseek, so it always continues from
+	 * where it was stop()-ped.
+	 */
+	if (*pos)
+		return bpf_iter_udp_batch(seq);
+
+	return SEQ_START_TOKEN;
+}
+
+static void *bpf_iter_udp_seq_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	struct bpf_udp_iter_state *iter = seq->private;
+	struct sock *sk;
+
+	if (iter->cur_sk < iter->end_sk) {
+		sock_put(iter->batch[iter->cur_sk++]);
+		++iter->offset;
+	}
+
+	if (iter->cur_sk < iter->end_sk)
+		sk = iter->batch[iter->cur_sk];
+	else
+		sk = bpf_iter_udp_batch(seq);
+
+	++*pos;
+	return sk;
+}
+
 static int bpf_iter_udp_seq_show(struct seq_file *seq, void *v)
 {
 	struct udp_iter_state *state = seq->private;
@@ -3051,18 +3247,33 @@ static int bpf_iter_udp_seq_show(struct seq_file *seq, void *v)
 	struct bpf_prog *prog;
 	struct sock *sk = v;
 	uid_t uid;
+	bool slow;
+	int ret;
 
 	if (v == SEQ_START_TOKEN)
 		return 0;
 
+	slow = lock_sock_fast(sk);
+
+	/* Closed while it sat in the batch */
+	if (unlikely(sk_unhashed(sk))) {
+		ret = SEQ_SKIP;
+		goto unlock;
+	}
+
 	uid = from_kuid_munged(seq_user_ns(seq), sock_i_uid(sk));
 	meta.seq = seq;
 	prog = bpf_iter_get_info(&meta, false);
-	return udp_prog_seq_show(prog, &meta, v, uid, state->bucket);
+	ret = udp_prog_seq_show(prog, &meta, v, uid, state->bucket);
+
+unlock:
+	unlock_sock_fast(sk, slow);
+	return ret;
 }
 
 static void bpf_iter_udp_seq_stop(struct seq_file *seq, void *v)
 {
+	struct bpf_udp_iter_state *iter = seq->private;
 	struct bpf_iter_meta meta;
 	struct bpf_prog *prog;
 
@@ -3073,12 +3284,15 @@ static void bpf_iter_udp_seq_stop(struct seq_file *seq, void *v)
 			(void)udp_prog_seq_show(prog, &meta, v, 0, 0);
 	}
 
-	udp_seq_stop(seq, v);
+	if (iter->cur_sk < iter->end_sk) {
+		bpf_iter_udp_put_batch(iter);
+		iter->st_bucket_done = false;
+	}
 }
 
 static const struct seq_operations bpf_iter_udp_seq_ops = {
-	.start		= udp_seq_start,
-	.next		= udp_seq_next,
+	.start		= bpf_iter_udp_seq_start,
+	.next		= bpf_iter_udp_seq_next,
 	.stop		= bpf_iter_udp_seq_stop,
 	.show		= bpf_iter_udp_seq_show,
 };
@@ -3205,9 +3419,11 @@ static struct pernet_operations __net_initdata udp_sysctl_ops = {
 DEFINE_BPF_ITER_FUNC(udp, struct bpf_iter_meta *meta,
 		     struct udp_sock *udp_sk, uid_t uid, int bucket)
 
+#define INIT_BATCH_SZ 16
+
 static int bpf_iter_init_udp(void *priv_data, struct bpf_iter_aux_info *aux)
 {
-	struct udp_iter_state *st = priv_data;
+	struct bpf_udp_iter_state *iter = priv_data;
 	struct udp_seq_afinfo *afinfo;
 	int ret;
 
@@ -3217,28 +3433,54 @@ static int bpf_iter_init_udp(void *priv_data, struct bpf_iter_aux_info *aux)
 
 	afinfo->family = AF_UNSPEC;
 	afinfo->udp_table = &udp_table;
-	st->bpf_seq_afinfo = afinfo;
+	iter->state.bpf_seq_afinfo = afinfo;
 	ret = bpf_iter_init_seq_net(priv_data, aux);
 	if (ret)
-		kfree(afinfo);
+		goto free_afinfo;
+
+	ret = bpf_iter_udp_realloc_batch(iter, INIT_BATCH_SZ);
+	if (ret)
+		goto fini_seq_net;
+
+	return 0;
+
+fini_seq_net:
+	bpf_iter_fini_seq_net(priv_data);
+free_afinfo:
+	kfree(afinfo);
 	return ret;
 }
 
 static void bpf_iter_fini_udp(void *priv_data)
 {
-	struct udp_iter_state *st = priv_data;
+	struct bpf_udp_iter_state *iter = priv_data;
 
-	kfree(st->bpf_seq_afinfo);
+	kfree(iter->state.bpf_seq_afinfo);
 	bpf_iter_fini_seq_net(priv_data);
+	kvfree(iter->batch);
 }
 
 static const struct bpf_iter_seq_info udp_seq_info = {
 	.seq_ops		= &bpf_iter_udp_seq_ops,
 	.init_seq_private	= bpf_iter_init_udp,
 	.fini_seq_private	= bpf_iter_fini_udp,
-	.seq_priv_size		= sizeof(struct udp_iter_state),
+	.seq_priv_size		= sizeof(struct bpf_udp_iter_state),
 };
 
+static const struct bpf_func_proto *
+bpf_iter_udp_get_func_proto(enum bpf_func_id func_id,
+			    const struct bpf_prog *prog)
+{
+	switch (func_id) {
+	case BPF_FUNC_setsockopt:
+		return &bpf_sk_setsockopt_proto;
+	case BPF_FUNC_getsockopt:
+		return &bpf_sk_getsockopt_proto;
+	default:
+		return NULL;
+	}
+}
+
 static struct bpf_iter_reg udp_reg_info = {
 	.target			= "udp",
 	.ctx_arg_info_size	= 1,
@@ -3246,6 +3488,7 @@ static struct bpf_iter_reg udp_reg_info = {
 		{ offsetof(struct bpf_iter__udp, udp_sk),
 		  PTR_TO_BTF_ID_OR_NULL },
 	},
+	.get_func_proto		= bpf_iter_udp_get_func_proto,
 	.seq_info		= &udp_seq_info,
 };
 
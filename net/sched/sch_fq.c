@@ -28,6 +28,14 @@
  *  Note : When a flow becomes empty, we do not immediately remove it from
  *  rb trees, for performance reasons (its expected to send additional packets,
  *  or SLAB cache will reuse socket for another flow)
+ *
+ *  Throttled (paced) flows are kept in a two level time-slot wheel rather
+ *  than a tree sorted by time_next_packet, so that throttling and releasing
+ *  a flow are O(1) even with millions of paced flows. A level 0 slot
+ *  covers FQ_WHEEL_GRAN ns, a level 1 slot covers a full level 0 rotation,
+ *  and flows further away than that wait on an overflow list.
+ *  Slots in the past are released as a whole, only the current slot needs
+ *  to look at individual flows.
  */
 
 #include <linux/module.h>
@@ -44,6 +52,7 @@
 #include <linux/hash.h>
 #include <linux/prefetch.h>
 #include <linux/vmalloc.h>
+#include <linux/bitmap.h>
 #include <net/netlink.h>
 #include <net/pkt_sched.h>
 #include <net/sock.h>
@@ -84,10 +93,31 @@ struct fq_flow {
 
 	struct fq_flow *next;		/* next pointer in RR lists */
 
-	struct rb_node  rate_node;	/* anchor in q->delayed tree */
+	struct list_head wheel_node;	/* anchor in q->wheel slots */
 	u64		time_next_packet;
 } ____cacheline_aligned_in_smp;
 
+#define FQ_WHEEL_BITS		10
+#define FQ_WHEEL_SLOTS		(1U << FQ_WHEEL_BITS)
+#define FQ_WHEEL_MASK		(FQ_WHEEL_SLOTS - 1)
+#define FQ_WHEEL_GRAN_LOG	14	/* 16.384 usec per level 0 slot */
+#define FQ_WHEEL_LEVELS		2
+
+/*
+ * Time-slot wheel holding throttled flows.
+ * Times are expressed in ticks of (1 << FQ_WHEEL_GRAN_LOG) ns.
+ * Level 0 holds flows due in [clock, clock + FQ_WHEEL_SLOTS) ticks,
+ * level 1 groups the following FQ_WHEEL_SLOTS - 1 rotations of level 0.
+ * Bitmaps may have stale bits for slots emptied by fq_flow_unset_throttled(),
+ * they are cleared lazily.
+ */
+struct fq_wheel {
+	u64		clock;		/* current level 0 tick */
+	unsigned long	bitmap[FQ_WHEEL_LEVELS][BITS_TO_LONGS(FQ_WHEEL_SLOTS)];
+	struct list_head overflow;
+	struct list_head slots[FQ_WHEEL_LEVELS][FQ_WHEEL_SLOTS];
+};
+
 struct fq_flow_head {
 	struct fq_flow *first;
 	struct fq_flow *last;
@@ -98,7 +128,7 @@ struct fq_sched_data {
 
 	struct fq_flow_head old_flows;
 
-	struct rb_root	delayed;	/* for rate limited flows */
+	struct fq_wheel	*wheel;		/* for rate limited flows */
 	u64		time_next_delayed_flow;
 	u64		ktime_cache;	/* copy of last ktime_get_ns() */
 	unsigned long	unthrottle_latency_ns;
@@ -169,29 +199,53 @@ static void fq_flow_add_tail(struct fq_flow_head *head, struct fq_flow *flow)
 	flow->next = NULL;
 }
 
+static void fq_wheel_init(struct fq_wheel *w)
+{
+	unsigned int lvl, idx;
+
+	w->clock = 0;
+	bitmap_zero(w->bitmap[0], FQ_WHEEL_SLOTS * FQ_WHEEL_LEVELS);
+	INIT_LIST_HEAD(&w->overflow);
+	for (lvl = 0; lvl < FQ_WHEEL_LEVELS; lvl++)
+		for (idx = 0; idx < FQ_WHEEL_SLOTS; idx++)
+			INIT_LIST_HEAD(&w->slots[lvl][idx]);
+}
+
+static void fq_wheel_insert(struct fq_wheel *w, struct fq_flow *f)
+{
+	u64 tick = f->time_next_packet >> FQ_WHEEL_GRAN_LOG;
+	unsigned int lvl, idx;
+
+	if (tick < w->clock + FQ_WHEEL_SLOTS) {
+		lvl = 0;
+		idx = max(tick, w->clock) & FQ_WHEEL_MASK;
+	} else if ((tick >> FQ_WHEEL_BITS) - (w->clock >> FQ_WHEEL_BITS) <
+		   FQ_WHEEL_SLOTS) {
+		lvl = 1;
+		idx = (tick >> FQ_WHEEL_BITS) & FQ_WHEEL_MASK;
+	} else {
+		list_add_tail(&f->wheel_node, &w->overflow);
+		return;
+	}
+	list_add_tail(&f->wheel_node, &w->slots[lvl][idx]);
+	__set_bit(idx, w->bitmap[lvl]);
+}
+
 static void fq_flow_unset_throttled(struct fq_sched_data *q, struct fq_flow *f)
 {
-	rb_erase(&f->rate_node, &q->delayed);
+	list_del(&f->wheel_node);
 	q->throttled_flows--;
 	fq_flow_add_tail(&q->old_flows, f);
 }
 
 static void fq_flow_set_throttled(struct fq_sched_data *q, struct fq_flow *f)
 {
-	struct rb_node **p = &q->delayed.rb_node, *parent = NULL;
-
-	while (*p) {
-		struct fq_flow *aux;
-
-		parent = *p;
-		aux = rb_entry(parent, struct fq_flow, rate_node);
-		if (f->time_next_packet >= aux->time_next_packet)
-			p = &parent->rb_right;
-		else
-			p = &parent->rb_left;
-	}
-	rb_link_node(&f->rate_node, parent, p);
-	rb_insert_color(&f->rate_node, &q->delayed);
+	/* An empty wheel can jump to the current time, so that a long idle
+	 * period does not have to be walked slot by slot later.
+	 */
+	if (!q->throttled_flows)
+		q->wheel->clock = q->ktime_cache >> FQ_WHEEL_GRAN_LOG;
+	fq_wheel_insert(q->wheel, f);
 	q->throttled_flows++;
 	q->stat_throttled++;
 
@@ -496,10 +550,133 @@ static int fq_enqueue(struct sk_buff *skb, struct Qdisc *sch,
 	return NET_XMIT_SUCCESS;
 }
 
+/* Release all flows of a level 0 slot whose time has fully elapsed. */
+static void fq_wheel_release_slot(struct fq_sched_data *q, unsigned int idx)
+{
+	struct fq_wheel *w = q->wheel;
+	struct fq_flow *f, *tmp;
+
+	list_for_each_entry_safe(f, tmp, &w->slots[0][idx], wheel_node) {
+		q->throttled_flows--;
+		fq_flow_add_tail(&q->old_flows, f);
+	}
+	INIT_LIST_HEAD(&w->slots[0][idx]);
+	__clear_bit(idx, w->bitmap[0]);
+}
+
+/* Called when w->clock starts a new level 0 rotation: move the matching
+ * level 1 slot down, and at the start of a level 1 rotation give the
+ * overflow list a chance to enter the wheel.
+ */
+static void fq_wheel_cascade(struct fq_wheel *w)
+{
+	unsigned int idx = (w->clock >> FQ_WHEEL_BITS) & FQ_WHEEL_MASK;
+	struct fq_flow *f, *tmp;
+	LIST_HEAD(list);
+
+	if (__test_and_clear_bit(idx, w->bitmap[1]))
+		list_splice_init(&w->slots[1][idx], &list);
+	if (!idx)
+		list_splice_init(&w->overflow, &list);
+
+	list_for_each_entry_safe(f, tmp, &list, wheel_node)
+		fq_wheel_insert(w, f);
+}
+
+/* Move the wheel to @tick, releasing every level 0 slot before it. */
+static void fq_wheel_advance(struct fq_sched_data *q, u64 tick)
+{
+	struct fq_wheel *w = q->wheel;
+
+	while (w->clock < tick) {
+		unsigned int idx = w->clock & FQ_WHEEL_MASK;
+		unsigned int next;
+		u64 end;
+
+		/* do not cross the end of the current level 0 rotation */
+		end = min(tick, (w->clock | FQ_WHEEL_MASK) + 1);
+		next = find_next_bit(w->bitmap[0], FQ_WHEEL_SLOTS, idx);
+		if (next < idx + (end - w->clock)) {
+			w->clock += next - idx;
+			fq_wheel_release_slot(q, next);
+			w->clock++;
+		} else {
+			w->clock = end;
+		}
+		if (!(w->clock & FQ_WHEEL_MASK))
+			fq_wheel_cascade(w);
+	}
+}
+
+/* Find the first non empty slot of a level, starting at @start and
+ * wrapping around. Returns its distance from @start, or -1.
+ */
+static int fq_wheel_find(struct fq_wheel *w, unsigned int lvl,
+			 unsigned int start)
+{
+	unsigned int idx = start;
+	bool wrapped = false;
+
+	for (;;) {
+		idx = find_next_bit(w->bitmap[lvl], FQ_WHEEL_SLOTS, idx);
+		if (idx >= FQ_WHEEL_SLOTS) {
+			if (wrapped)
+				return -1;
+			wrapped = true;
+			idx = 0;
+			continue;
+		}
+		if (wrapped && idx >= start)
+			return -1;
+		if (!list_empty(&w->slots[lvl][idx]))
+			return (idx - start) & FQ_WHEEL_MASK;
+		__clear_bit(idx, w->bitmap[lvl]);
+		idx++;
+	}
+}
+
+/* Earliest time a throttled flow can become eligible.
+ * Exact for level 0, the start of the slot for level 1 and overflow,
+ * whose flows are sorted into level 0 once we get there.
+ */
+static u64 fq_wheel_next_time(struct fq_sched_data *q)
+{
+	struct fq_wheel *w = q->wheel;
+	u64 base, res = ~0ULL;
+	struct fq_flow *f;
+	int dist;
+
+	if (!q->throttled_flows)
+		return ~0ULL;
+
+	dist = fq_wheel_find(w, 0, (w->clock + 1) & FQ_WHEEL_MASK);
+	if (dist >= 0) {
+		unsigned int idx = (w->clock + 1 + dist) & FQ_WHEEL_MASK;
+
+		list_for_each_entry(f, &w->slots[0][idx], wheel_node)
+			res = min(res, f->time_next_packet);
+		return res;
+	}
+
+	base = (w->clock >> FQ_WHEEL_BITS) + 1;
+	dist = fq_wheel_find(w, 1, base & FQ_WHEEL_MASK);
+	if (dist >= 0)
+		return ((base + dist) << FQ_WHEEL_BITS) << FQ_WHEEL_GRAN_LOG;
+
+	if (!list_empty(&w->overflow)) {
+		base = (w->clock >> (2 * FQ_WHEEL_BITS)) + 1;
+		return (base << (2 * FQ_WHEEL_BITS)) << FQ_WHEEL_GRAN_LOG;
+	}
+	return ~0ULL;
+}
+
 static void fq_check_throttled(struct fq_sched_data *q, u64 now)
 {
+	struct fq_wheel *w = q->wheel;
+	struct list_head *slot;
 	unsigned long sample;
-	struct rb_node *p;
+	struct fq_flow *f, *tmp;
+	u64 next = ~0ULL;
 
 	if (q->time_next_delayed_flow > now)
 		return;
@@ -511,16 +688,19 @@ static void fq_check_throttled(struct fq_sched_data *q, u64 now)
 	q->unthrottle_latency_ns -= q->unthrottle_latency_ns >> 3;
 	q->unthrottle_latency_ns += sample >> 3;
 
-	q->time_next_delayed_flow = ~0ULL;
-	while ((p = rb_first(&q->delayed)) != NULL) {
-		struct fq_flow *f = rb_entry(p, struct fq_flow, rate_node);
+	fq_wheel_advance(q, now >> FQ_WHEEL_GRAN_LOG);
 
-		if (f->time_next_packet > now) {
-			q->time_next_delayed_flow = f->time_next_packet;
-			break;
-		}
-		fq_flow_unset_throttled(q, f);
+	/* The current slot is only partially elapsed. */
+	slot = &w->slots[0][w->clock & FQ_WHEEL_MASK];
+	list_for_each_entry_safe(f, tmp, slot, wheel_node) {
+		if (f->time_next_packet > now)
+			next = min(next, f->time_next_packet);
+		else
+			fq_flow_unset_throttled(q, f);
 	}
+	if (next == ~0ULL)
+		next = fq_wheel_next_time(q);
+	q->time_next_delayed_flow = next;
 }
 
 static struct sk_buff *fq_dequeue(struct Qdisc *sch)
@@ -688,7 +868,7 @@ static void fq_reset(struct Qdisc *sch)
 	}
 	q->new_flows.first	= NULL;
 	q->old_flows.first	= NULL;
-	q->delayed		= RB_ROOT;
+	fq_wheel_init(q->wheel);
 	q->flows		= 0;
 	q->inactive_flows	= 0;
 	q->throttled_flows	= 0;
@@ -920,6 +1100,7 @@ static void fq_destroy(struct Qdisc *sch)
 
 	fq_reset(sch);
 	fq_free(q->fq_root);
+	kvfree(q->wheel);
 	qdisc_watchdog_cancel(&q->watchdog);
 }
 
@@ -939,7 +1120,6 @@ static int fq_init(struct Qdisc *sch, struct nlattr *opt,
 	q->rate_enable		= 1;
 	q->new_flows.first	= NULL;
 	q->old_flows.first	= NULL;
-	q->delayed		= RB_ROOT;
 	q->fq_root		= NULL;
 	q->fq_trees_log		= ilog2(1024);
 	q->orphan_mask		= 1024 - 1;
@@ -955,6 +1135,13 @@ static int fq_init(struct Qdisc *sch, struct nlattr *opt,
 
 	qdisc_watchdog_init_clockid(&q->watchdog, sch, CLOCK_MONOTONIC);
 
+	q->wheel = kvmalloc_node(sizeof(*q->wheel),
+				 GFP_KERNEL | __GFP_RETRY_MAYFAIL,
+				 netdev_queue_numa_node_read(sch->dev_queue));
+	if (!q->wheel)
+		return -ENOMEM;
+	fq_wheel_init(q->wheel);
+
 	if (opt)
 		err = fq_change(sch, opt, extack);
 	else
@@ -0,0 +1,360 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Compare TCP receive zerocopy (TCP_ZEROCOPY_RECEIVE) against plain
+ * recvmsg() for bulk transfers.
+ *
+ * Server (receiver):
+ *	./tcp_mmap -s [-z [-T] [-c copybuf]] [-p port] [-M mss]
+ * Client (sender):
+ *	./tcp_mmap -H <host> [-z] [-l bytes] [-m msg_size] [-p port] [-M mss]
+ *
+ * With -z the receiver maps the payload into a region obtained by mmap()
+ * on the socket and copies the unaligned tail of each message into a
+ * copybuf of -c bytes in the same call.  -T sets the TLB clean hint, so
+ * the kernel only zaps the region when a page is really in the way; the
+ * receiver then has to unmap consumed pages itself, which it does with
+ * madvise(MADV_DONTNEED) once per received chunk.
+ *
+ * The sender uses MSG_ZEROCOPY with -z, which over loopback produces the
+ * page sized, page aligned frags TCP_ZEROCOPY_RECEIVE can map.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY	0x4000000
+#endif
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY	60
+#endif
+
+#ifndef TCP_RECEIVE_ZEROCOPY_FLAG_TLB_CLEAN_HINT
+#define TCP_RECEIVE_ZEROCOPY_FLAG_TLB_CLEAN_HINT 0x1
+#endif
+
+#define FILE_SZ		(1ULL << 35)
+#define CHUNK_SIZE	(512 * 1024)
+
+static int cfg_family = AF_INET6;
+static int cfg_port = 8787;
+static int cfg_mss;
+static int cfg_copybuf = 64 * 1024;
+static size_t cfg_msg_size = 256 * 1024;
+static uint64_t cfg_len = FILE_SZ;
+static bool cfg_zc;
+static bool cfg_clean_hint;
+static bool cfg_server;
+static const char *cfg_host;
+
+static void hash_zone(void *zone, unsigned int length)
+{
+	volatile unsigned long *p = zone;
+	unsigned long sum = 0;
+
+	while (length >= sizeof(*p)) {
+		sum += *p++;
+		length -= sizeof(*p);
+	}
+	(void)sum;
+}
+
+static double elapsed(const struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) * 1e-9;
+}
+
+static void report(const char *mode, uint64_t total, uint64_t mapped,
+		   const struct timespec *t0)
+{
+	struct rusage ru;
+	double secs = elapsed(t0), cpu;
+
+	getrusage(RUSAGE_THREAD, &ru);
+	cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 +
+	      ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+
+	fprintf(stderr,
+		"%s: received %llu MB (%.2f %% mmap'ed) in %.3f s, %.3f Gbit, cpu usage user:%.3f sys:%.3f, %.1f usec per MB\n",
+		mode, (unsigned long long)total >> 20,
+		total ? 100.0 * mapped / total : 0.0, secs,
+		total * 8.0 / secs / 1e9,
+		ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6,
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6,
+		total ? cpu * 1e6 / (total >> 20 ? total >> 20 : 1) : 0.0);
+}
+
+static void rx_copy(int fd)
+{
+	uint64_t total = 0;
+	struct timespec t0;
+	char *buffer;
+	ssize_t n;
+
+	buffer = malloc(CHUNK_SIZE);
+	if (!buffer)
+		error(1, errno, "malloc");
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while ((n = read(fd, buffer, CHUNK_SIZE)) > 0) {
+		hash_zone(buffer, n);
+		total += n;
+	}
+	if (n < 0)
+		error(1, errno, "read");
+
+	report("recvmsg", total, 0, &t0);
+	free(buffer);
+}
+
+static void rx_zerocopy(int fd)
+{
+	uint64_t total = 0, total_mmap = 0;
+	struct tcp_zerocopy_receive zc;
+	socklen_t zc_len;
+	struct timespec t0;
+	char *addr, *copybuf, *buffer;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	addr = mmap(NULL, CHUNK_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+		error(1, errno, "mmap");
+
+	copybuf = malloc(cfg_copybuf);
+	buffer = malloc(CHUNK_SIZE);
+	if (!copybuf || !buffer)
+		error(1, errno, "malloc");
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (;;) {
+		ssize_t n;
+
+		memset(&zc, 0, sizeof(zc));
+		zc.address = (uintptr_t)addr;
+		zc.length = CHUNK_SIZE;
+		zc.copybuf_address = (uintptr_t)copybuf;
+		zc.copybuf_len = cfg_copybuf;
+		if (cfg_clean_hint)
+			zc.flags = TCP_RECEIVE_ZEROCOPY_FLAG_TLB_CLEAN_HINT;
+		zc_len = sizeof(zc);
+
+		if (getsockopt(fd, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE,
+			       &zc, &zc_len) == -1) {
+			/* peer closed and the receive queue is empty */
+			if (errno == EIO)
+				break;
+			error(1, errno, "TCP_ZEROCOPY_RECEIVE");
+		}
+
+		if (zc.length) {
+			hash_zone(addr, zc.length);
+			/* release the pages now, the next call maps a clean range */
+			if (cfg_clean_hint &&
+			    madvise(addr, zc.length, MADV_DONTNEED))
+				error(1, errno, "madvise");
+			total_mmap += zc.length;
+			total += zc.length;
+		}
+		if (zc.copybuf_len > 0) {
+			hash_zone(copybuf, zc.copybuf_len);
+			total += zc.copybuf_len;
+		}
+		if (zc.recv_skip_hint) {
+			n = read(fd, buffer, zc.recv_skip_hint > CHUNK_SIZE ?
+				 CHUNK_SIZE : zc.recv_skip_hint);
+			if (n < 0)
+				error(1, errno, "read");
+			if (n == 0)
+				break;
+			hash_zone(buffer, n);
+			total += n;
+			continue;
+		}
+		if (!zc.length && zc.copybuf_len <= 0) {
+			if (poll(&pfd, 1, -1) == -1)
+				error(1, errno, "poll");
+			n = recv(fd, buffer, 1, MSG_PEEK | MSG_DONTWAIT);
+			if (n == 0)
+				break;
+		}
+	}
+
+	report(cfg_clean_hint ? "zerocopy+hint" : "zerocopy", total,
+	       total_mmap, &t0);
+	munmap(addr, CHUNK_SIZE);
+	free(copybuf);
+	free(buffer);
+}
+
+static void setup_sockaddr(const char *host, struct sockaddr_storage *ss,
+			   socklen_t *len)
+{
+	struct sockaddr_in6 *sin6 = (void *)ss;
+	struct sockaddr_in *sin = (void *)ss;
+
+	memset(ss, 0, sizeof(*ss));
+	if (cfg_family == AF_INET) {
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(cfg_port);
+		if (host && inet_pton(AF_INET, host, &sin->sin_addr) != 1)
+			error(1, 0, "bad ipv4 address %s", host);
+		*len = sizeof(*sin);
+	} else {
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(cfg_port);
+		if (host && inet_pton(AF_INET6, host, &sin6->sin6_addr) != 1)
+			error(1, 0, "bad ipv6 address %s", host);
+		*len = sizeof(*sin6);
+	}
+}
+
+static void set_mss(int fd)
+{
+	if (cfg_mss &&
+	    setsockopt(fd, IPPROTO_TCP, TCP_MAXSEG, &cfg_mss, sizeof(cfg_mss)))
+		error(1, errno, "setsockopt TCP_MAXSEG");
+}
+
+static void do_server(void)
+{
+	struct sockaddr_storage ss;
+	int fd, rfd, on = 1;
+	socklen_t len;
+
+	setup_sockaddr(NULL, &ss, &len);
+	fd = socket(cfg_family, SOCK_STREAM, 0);
+	if (fd == -1)
+		error(1, errno, "socket");
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	set_mss(fd);
+	if (bind(fd, (void *)&ss, len))
+		error(1, errno, "bind");
+	if (listen(fd, 1))
+		error(1, errno, "listen");
+
+	rfd = accept(fd, NULL, NULL);
+	if (rfd == -1)
+		error(1, errno, "accept");
+
+	if (cfg_zc)
+		rx_zerocopy(rfd);
+	else
+		rx_copy(rfd);
+
+	close(rfd);
+	close(fd);
+}
+
+static void do_client(void)
+{
+	struct sockaddr_storage ss;
+	uint64_t total = 0;
+	int fd, on = 1;
+	socklen_t len;
+	char *buffer;
+
+	setup_sockaddr(cfg_host, &ss, &len);
+	fd = socket(cfg_family, SOCK_STREAM, 0);
+	if (fd == -1)
+		error(1, errno, "socket");
+	set_mss(fd);
+	if (cfg_zc && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)))
+		error(1, errno, "setsockopt SO_ZEROCOPY");
+	if (connect(fd, (void *)&ss, len))
+		error(1, errno, "connect");
+
+	buffer = mmap(NULL, cfg_msg_size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffer == MAP_FAILED)
+		error(1, errno, "mmap");
+	memset(buffer, 'x', cfg_msg_size);
+
+	while (total < cfg_len) {
+		size_t chunk = cfg_msg_size;
+		ssize_t n;
+
+		if (cfg_len - total < chunk)
+			chunk = cfg_len - total;
+		n = send(fd, buffer, chunk, cfg_zc ? MSG_ZEROCOPY : 0);
+		if (n <= 0)
+			error(1, errno, "send");
+		total += n;
+	}
+	shutdown(fd, SHUT_WR);
+	close(fd);
+	munmap(buffer, cfg_msg_size);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "46c:H:l:m:M:p:sTz")) != -1) {
+		switch (c) {
+		case '4':
+			cfg_family = AF_INET;
+			break;
+		case '6':
+			cfg_family = AF_INET6;
+			break;
+		case 'c':
+			cfg_copybuf = atoi(optarg);
+			break;
+		case 'H':
+			cfg_host = optarg;
+			break;
+		case 'l':
+			cfg_len = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			cfg_msg_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'M':
+			cfg_mss = atoi(optarg);
+			break;
+		case 'p':
+			cfg_port = atoi(optarg);
+			break;
+		case 's':
+			cfg_server = true;
+			break;
+		case 'T':
+			cfg_clean_hint = true;
+			break;
+		case 'z':
+			cfg_zc = true;
+			break;
+		default:
+			error(1, 0, "bad option");
+		}
+	}
+
+	if (cfg_server)
+		do_server();
+	else if (cfg_host)
+		do_client();
+	else
+		error(1, 0, "need -s or -H <host>");
+	return 0;
+}
@@ -0,0 +1,38 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Compare recvmsg() with TCP_ZEROCOPY_RECEIVE, with and without the TLB
+# clean hint, over loopback in a private netns with a large MTU.
+
+readonly NS="ns-tcp-mmap-$(mktemp -u XXXXXX)"
+readonly LEN=$((4 << 30))
+ksft_skip=4
+ret=0
+
+cleanup() {
+	ip netns del "${NS}" 2>/dev/null
+}
+trap cleanup EXIT
+
+ip netns add "${NS}" || exit $ksft_skip
+ip -netns "${NS}" link set lo mtu 65536 up
+
+run_one() {
+	local -r name="$1"
+	local -r rx_args="$2"
+	local -r tx_args="$3"
+
+	echo "${name}"
+	# 61440 bytes of payload per segment is 15 pages
+	ip netns exec "${NS}" ./tcp_mmap -s -M 61440 ${rx_args} &
+	local -r rx_pid=$!
+	sleep 0.2
+	ip netns exec "${NS}" ./tcp_mmap -H ::1 -M 61440 -l ${LEN} ${tx_args} || ret=1
+	wait ${rx_pid} || ret=1
+}
+
+run_one "recvmsg" "" ""
+run_one "zerocopy" "-z" "-z"
+run_one "zerocopy, tlb clean hint" "-z -T" "-z"
+
+exit $ret
@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Send a burst of UDP datagrams, or receive them on a UDP_GRO_FRAGLIST
+ * socket and check that the per-segment lengths reported in the
+ * UDP_GRO_FRAGLIST cmsg split every recvmsg() back into the original
+ * datagrams, in order and without loss.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <error.h>
+#include <linux/udp.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP		17
+#endif
+
+#ifndef UDP_GRO_FRAGLIST
+#define UDP_GRO_FRAGLIST	105
+#endif
+
+#define MAX_SEGS	64
+
+static int cfg_family = PF_INET6;
+static int cfg_port = 8000;
+static int cfg_num = 1000;
+static int cfg_size = 1000;
+static int cfg_timeout_ms = 2000;
+static bool cfg_rx;
+static bool cfg_expect_gro;
+static struct sockaddr_storage cfg_addr;
+
+static socklen_t cfg_alen;
+
+static void setup_addr(const char *str)
+{
+	struct sockaddr_in6 *addr6 = (void *)&cfg_addr;
+	struct sockaddr_in *addr4 = (void *)&cfg_addr;
+
+	memset(&cfg_addr, 0, sizeof(cfg_addr));
+	if (cfg_family == PF_INET) {
+		addr4->sin_family = AF_INET;
+		addr4->sin_port = htons(cfg_port);
+		cfg_alen = sizeof(*addr4);
+		if (str && inet_pton(AF_INET, str, &addr4->sin_addr) != 1)
+			error(1, 0, "ipv4 parse error: %s", str);
+	} else {
+		addr6->sin6_family = AF_INET6;
+		addr6->sin6_port = htons(cfg_port);
+		cfg_alen = sizeof(*addr6);
+		if (str && inet_pton(AF_INET6, str, &addr6->sin6_addr) != 1)
+			error(1, 0, "ipv6 parse error: %s", str);
+	}
+}
+
+static void do_tx(int fd)
+{
+	char buf[65536];
+	uint32_t seq;
+	int ret;
+
+	if (connect(fd, (void *)&cfg_addr, cfg_alen))
+		error(1, errno, "connect");
+
+	memset(buf, 'a', cfg_size);
+	for (seq = 0; seq < cfg_num; seq++) {
+		memcpy(buf, &seq, sizeof(seq));
+		ret = send(fd, buf, cfg_size, 0);
+		if (ret != cfg_size)
+			error(1, errno, "send");
+	}
+}
+
+static void do_rx(int fd)
+{
+	char ctrl[CMSG_SPACE(MAX_SEGS * sizeof(uint16_t))];
+	int aggregates = 0, calls = 0, expected = 0;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	char buf[65536];
+
+	if (bind(fd, (void *)&cfg_addr, cfg_alen))
+		error(1, errno, "bind");
+
+	while (expected < cfg_num) {
+		struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+		struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = ctrl,
+			.msg_controllen = sizeof(ctrl),
+		};
+		uint16_t *segs = NULL;
+		struct cmsghdr *cmsg;
+		int i, nsegs = 0, off = 0, ret;
+		uint32_t seq;
+
+		ret = poll(&pfd, 1, cfg_timeout_ms);
+		if (ret == -1)
+			error(1, errno, "poll");
+		if (ret == 0)
+			break;
+
+		ret = recvmsg(fd, &msg, 0);
+		if (ret == -1)
+			error(1, errno, "recvmsg");
+		if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+			error(1, 0, "truncated message");
+		calls++;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_UDP &&
+			    cmsg->cmsg_type == UDP_GRO_FRAGLIST) {
+				segs = (void *)CMSG_DATA(cmsg);
+				nsegs = (cmsg->cmsg_len - CMSG_LEN(0)) /
+					sizeof(*segs);
+			}
+		}
+		if (!segs || !nsegs)
+			error(1, 0, "missing UDP_GRO_FRAGLIST cmsg");
+		if (nsegs > 1)
+			aggregates++;
+
+		for (i = 0; i < nsegs; i++) {
+			if (segs[i] != cfg_size)
+				error(1, 0, "segment %d: len %u, expected %d",
+				      i, segs[i], cfg_size);
+			memcpy(&seq, buf + off, sizeof(seq));
+			if (seq != expected)
+				error(1, 0, "seq %u, expected %d", seq, expected);
+			off += segs[i];
+			expected++;
+		}
+		if (off != ret)
+			error(1, 0, "segments cover %d of %d bytes", off, ret);
+	}
+
+	fprintf(stderr, "rx: %d datagrams in %d calls, %d aggregates\n",
+		expected, calls, aggregates);
+
+	if (expected != cfg_num)
+		error(1, 0, "received %d of %d datagrams", expected, cfg_num);
+	if (cfg_expect_gro && !aggregates)
+		error(1, 0, "no fraglist aggregates received");
+}
+
+static void usage(const char *filepath)
+{
+	error(1, 0, "Usage: %s [-4|-6] [-r [-G]] [-D dst] [-n num] [-p port] [-s size] [-t timeout_ms]",
+	      filepath);
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	const char *dst = NULL;
+	int c;
+
+	while ((c = getopt(argc, argv, "46D:Gn:p:rs:t:")) != -1) {
+		switch (c) {
+		case '4':
+			cfg_family = PF_INET;
+			break;
+		case '6':
+			cfg_family = PF_INET6;
+			break;
+		case 'D':
+			dst = optarg;
+			break;
+		case 'G':
+			cfg_expect_gro = true;
+			break;
+		case 'n':
+			cfg_num = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			cfg_port = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			cfg_rx = true;
+			break;
+		case 's':
+			cfg_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			cfg_timeout_ms = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc)
+		usage(argv[0]);
+	if (!cfg_rx && !dst)
+		error(1, 0, "-D <destination> is required for tx");
+	if (cfg_size < sizeof(uint32_t) || cfg_size > 1472)
+		error(1, 0, "size must be between 4 and 1472");
+
+	setup_addr(dst);
+}
+
+int main(int argc, char **argv)
+{
+	int fd, val = 1;
+
+	parse_opts(argc, argv);
+
+	fd = socket(cfg_family, SOCK_DGRAM, 0);
+	if (fd == -1)
+		error(1, errno, "socket");
+
+	if (cfg_rx) {
+		int rcvbuf = 1 << 22;
+
+		/* the whole burst may be queued before the first read */
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf,
+			       sizeof(rcvbuf)))
+			error(1, errno, "setsockopt SO_RCVBUFFORCE");
+		if (setsockopt(fd, SOL_UDP, UDP_GRO_FRAGLIST, &val, sizeof(val)))
+			error(1, errno, "setsockopt UDP_GRO_FRAGLIST");
+		do_rx(fd);
+	} else {
+		do_tx(fd);
+	}
+
+	if (close(fd))
+		error(1, errno, "close");
+	return 0;
+}
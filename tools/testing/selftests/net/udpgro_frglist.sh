@@ -0,0 +1,73 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Run a UDP_GRO_FRAGLIST receiver behind a veth pair with NAPI enabled
+# and check that bursts arrive intact and batched.
+
+readonly PEER_NS="ns-peer-$(mktemp -u XXXXXX)"
+readonly BPF_FILE="../bpf/xdp_dummy.o"
+ksft_skip=4
+ret=0
+
+cleanup() {
+	local -r jobs="$(jobs -p)"
+
+	[ -n "${jobs}" ] && kill -1 ${jobs} 2>/dev/null
+	ip netns del "${PEER_NS}" 2>/dev/null
+}
+trap cleanup EXIT
+
+if [ ! -f "${BPF_FILE}" ]; then
+	echo "SKIP: missing ${BPF_FILE}, build the bpf selftests first"
+	exit $ksft_skip
+fi
+
+cfg_veth() {
+	ip netns add "${PEER_NS}" || exit $ksft_skip
+	ip -netns "${PEER_NS}" link set lo up
+	ip link add type veth
+	ip link set dev veth0 up
+	ip addr add dev veth0 192.168.1.2/24
+	ip addr add dev veth0 2001:db8::2/64 nodad
+
+	ip link set dev veth1 netns "${PEER_NS}"
+	ip -netns "${PEER_NS}" addr add dev veth1 192.168.1.1/24
+	ip -netns "${PEER_NS}" addr add dev veth1 2001:db8::1/64 nodad
+	ip -netns "${PEER_NS}" link set dev veth1 up
+	# native XDP enables veth NAPI and thus GRO
+	ip -n "${PEER_NS}" link set veth1 xdp object ${BPF_FILE} section xdp_dummy
+}
+
+run_one() {
+	local -r name="$1"
+	local -r dst="$2"
+	local -r family="$3"
+	local -r rx_args="$4"
+
+	printf "%-40s" "${name}"
+
+	ip netns exec "${PEER_NS}" ./udpgro_frglist ${family} -r ${rx_args} -n 1000 -s 1000 &
+	local -r rx_pid=$!
+	sleep 0.2
+	./udpgro_frglist ${family} -D ${dst} -n 1000 -s 1000
+
+	if wait ${rx_pid}; then
+		echo " ok"
+	else
+		echo " fail"
+		ret=1
+	fi
+}
+
+run_all() {
+	run_one "ipv4 fraglist delivery" 192.168.1.1 -4 "-G"
+	run_one "ipv6 fraglist delivery" 2001:db8::1 -6 "-G"
+
+	ip netns exec "${PEER_NS}" ethtool -K veth1 rx-gro-list on >/dev/null 2>&1
+	run_one "ipv4 fraglist delivery, rx-gro-list" 192.168.1.1 -4 "-G"
+	run_one "ipv6 fraglist delivery, rx-gro-list" 2001:db8::1 -6 "-G"
+}
+
+cfg_veth
+run_all
+exit $ret